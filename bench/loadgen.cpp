@@ -0,0 +1,850 @@
+// HTTP压测工具：基于epoll的闭环/开环负载生成器，通过回环地址驱动服务器
+// 用法：bench [-s 场景] [-c 连接数] [-t 线程数] [-d 秒数] [-r 总请求速率] [--json 文件]
+// 闭环模式下每个连接收到响应后立即发出下一个请求；-r指定速率时为开环模式，
+// 请求按计划时间发出，延迟从计划时间开始计算，连接阻塞期间积压的请求同样计入（修正协调遗漏）
+// idle场景先建立全部连接并保持空闲，再以低速率零星发出请求，用于评估大量连接下的内存和延迟；
+// 服务器开放/metrics时，每个场景前后抓取常驻内存和accept计数，估算每连接内存和accept速率
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 对数线性分桶的延迟直方图，单位为纳秒，相对误差小于1/128
+struct Histogram {
+    static const int SUB_BITS = 7;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB;
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+    uint64_t total = 0;
+    uint64_t max = 0;
+    double sum = 0;
+
+    static int bucket_of(uint64_t v) {
+        if (v < 2 * SUB)
+            return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        int idx = (shift + 1) * SUB + (int)((v >> shift) & (SUB - 1));
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+    // 桶内的最大值
+    static uint64_t bucket_value(int idx) {
+        if (idx < 2 * SUB)
+            return idx;
+        int shift = idx / SUB - 1;
+        return (((uint64_t)(SUB + idx % SUB) + 1) << shift) - 1;
+    }
+    void record(uint64_t v, uint64_t n = 1) {
+        counts[bucket_of(v)] += n;
+        total += n;
+        sum += (double)v * n;
+        max = std::max(max, v);
+    }
+    void merge(const Histogram &o) {
+        for (int i = 0; i < BUCKETS; ++i)
+            counts[i] += o.counts[i];
+        total += o.total;
+        sum += o.sum;
+        max = std::max(max, o.max);
+    }
+    uint64_t percentile(double q) const {
+        if (total == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * total)), seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(bucket_value(i), max);
+        }
+        return max;
+    }
+    // 与HdrHistogram的copyCorrectedForCoordinatedOmission相同：
+    // 大于期望间隔的样本意味着期间本应发出的请求被推迟，按间隔递减补齐这些请求的延迟
+    Histogram corrected(uint64_t interval) const {
+        Histogram h;
+        for (int i = 0; i < BUCKETS; ++i) {
+            if (counts[i] == 0)
+                continue;
+            uint64_t v = std::min(bucket_value(i), max);
+            h.record(v, counts[i]);
+            if (interval == 0)
+                continue;
+            for (uint64_t missed = v > interval ? v - interval : 0; missed >= interval;
+                 missed -= interval)
+                h.record(missed, counts[i]);
+        }
+        return h;
+    }
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 5005;
+    int conns = 16;
+    int threads = 1;
+    double duration = 10;
+    // 总请求速率，0表示闭环
+    double rate = 0;
+    int timeout_ms = 2000;
+    std::string scenario = "keepalive";
+    std::string path;
+    bool keepalive = true;
+    int depth = 1;
+    std::string json;
+    std::string label;
+    // 客户端源地址个数，每个源地址约有两万多个本地端口可用，0表示按连接数自动确定
+    int sources = 0;
+    bool idle = false;
+};
+
+struct Scenario {
+    const char *name;
+    const char *path;
+    bool keepalive;
+    int depth;
+    bool idle;
+    const char *desc;
+};
+
+static const Scenario scenarios[] = {
+    {"keepalive", "/health", true, 1, false, "keep-alive GET of an inline route"},
+    {"close", "/health", false, 1, false, "connect/close churn, one request per connection"},
+    {"pipeline", "/health", true, 16, false, "16 pipelined GETs per connection"},
+    {"small", "/index.html", true, 1, false, "keep-alive GET of a small file from root/"},
+    {"large", "/large.bin", true, 1, false, "keep-alive GET of root/large.bin (create it first)"},
+    {"404", "/no-such-file", true, 1, false, "keep-alive GETs of a missing file"},
+    {"idle", "/health", true, 1, true,
+     "open all connections, hold them idle and trickle requests (-r, default 1 per conn per 10s)"},
+};
+
+struct Stats {
+    Histogram latency;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t timeouts = 0;
+    uint64_t connects = 0;
+    // 空闲时被服务器关闭的连接
+    uint64_t dropped = 0;
+    // idle场景建立连接的耗时及建立成功的连接数
+    Histogram connect_latency;
+    uint64_t established = 0;
+    uint64_t status[600] = {};
+
+    void merge(const Stats &o) {
+        latency.merge(o.latency);
+        requests += o.requests;
+        bytes += o.bytes;
+        errors += o.errors;
+        timeouts += o.timeouts;
+        connects += o.connects;
+        dropped += o.dropped;
+        connect_latency.merge(o.connect_latency);
+        established += o.established;
+        for (int i = 0; i < 600; ++i)
+            status[i] += o.status[i];
+    }
+};
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    std::string out;
+    size_t out_off = 0;
+    std::string in;
+    // 已发出请求的计划发送时间
+    std::deque<uint64_t> inflight;
+    // 开环模式下一个请求的计划发送时间
+    uint64_t next_send = 0;
+    // 最近一次收到数据或发出请求的时间，用于超时判断
+    uint64_t last_active = 0;
+    // 当前是否关注EPOLLOUT，避免每次发送都修改epoll注册
+    bool want_out = false;
+};
+
+// idle场景中各线程与主线程的阶段同步：主线程在连接建立后和关闭连接前抓取服务器指标
+struct Phase {
+    std::atomic<int> arrived{0};
+    std::atomic<int> stage{0};
+
+    void arrive_and_wait(int s) {
+        arrived.fetch_add(1);
+        while (stage.load() < s)
+            usleep(1000);
+    }
+    void wait_arrived(int n) {
+        while (arrived.load() < n)
+            usleep(1000);
+    }
+};
+
+class Worker {
+public:
+    Worker(const Options &opt, const sockaddr_in &addr, int nconns, int first, uint64_t start,
+           uint64_t end, Phase *phase)
+    : m_opt(opt), m_addr(addr), m_conns(nconns), m_first(first), m_start(start), m_end(end),
+      m_phase(phase) {
+        m_request = "GET " + opt.path + " HTTP/1.1\r\nHost: " + opt.host + "\r\nConnection: " +
+                    (opt.keepalive ? "keep-alive" : "close") + "\r\n\r\n";
+        if (opt.rate > 0)
+            m_interval = (uint64_t)(1e9 * opt.conns / opt.rate);
+    }
+    void run();
+    Stats stats;
+
+private:
+    bool open_conn(Conn &c);
+    void close_conn(Conn &c, bool failed);
+    void update_events(Conn &c);
+    void issue(Conn &c, uint64_t now);
+    bool flush(Conn &c);
+    void on_read(Conn &c, uint64_t now);
+    void fill(Conn &c, uint64_t now);
+    void connect_all();
+
+    const Options &m_opt;
+    sockaddr_in m_addr;
+    std::vector<Conn> m_conns;
+    // 本线程第一个连接的全局序号，用于分配源地址
+    int m_first;
+    uint64_t m_start, m_end;
+    Phase *m_phase;
+    uint64_t m_interval = 0;
+    std::string m_request;
+    int m_epfd = -1;
+};
+
+bool Worker::open_conn(Conn &c)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if (!m_opt.keepalive) {
+        // 短连接由本端先关闭，发送RST避免大量TIME_WAIT耗尽本地端口
+        linger lg = {1, 0};
+        setsockopt(c.fd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+    }
+    if (m_opt.sources > 1) {
+        // 轮流绑定127.0.0.1起的源地址，端口推迟到connect时按四元组分配
+        sockaddr_in src;
+        memset(&src, 0, sizeof src);
+        src.sin_family = AF_INET;
+        int idx = m_first + (int)(&c - m_conns.data());
+        src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + idx % m_opt.sources);
+        setsockopt(c.fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof one);
+        if (bind(c.fd, (sockaddr *)&src, sizeof src) < 0) {
+            close(c.fd);
+            c.fd = -1;
+            return false;
+        }
+    }
+    int ret = connect(c.fd, (sockaddr *)&m_addr, sizeof m_addr);
+    if (ret < 0 && errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.connecting = ret < 0;
+    c.want_out = true;
+    ++stats.connects;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = &c - m_conns.data();
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+void Worker::close_conn(Conn &c, bool failed)
+{
+    if (c.fd != -1)
+        close(c.fd);
+    c.fd = -1;
+    c.connecting = false;
+    if (failed)
+        stats.errors += c.inflight.size();
+    c.inflight.clear();
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+}
+
+void Worker::update_events(Conn &c)
+{
+    bool want_out = c.connecting || c.out_off < c.out.size();
+    if (want_out == c.want_out)
+        return;
+    c.want_out = want_out;
+    epoll_event ev;
+    ev.events = EPOLLIN | (want_out ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.u32 = &c - m_conns.data();
+    epoll_ctl(m_epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// 发出一个请求，scheduled为其计划时间；连接断开时先重新连接，连接时间计入延迟
+void Worker::issue(Conn &c, uint64_t scheduled)
+{
+    if (c.fd == -1 && !open_conn(c)) {
+        ++stats.errors;
+        return;
+    }
+    c.out += m_request;
+    c.inflight.push_back(scheduled);
+    if (c.inflight.size() == 1)
+        c.last_active = now_ns();
+}
+
+bool Worker::flush(Conn &c)
+{
+    while (c.out_off < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN)
+                break;
+            return false;
+        }
+        c.out_off += n;
+    }
+    if (c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+    update_events(c);
+    return true;
+}
+
+// 解析已收到的响应，只支持带Content-Length的响应
+void Worker::on_read(Conn &c, uint64_t now)
+{
+    char buf[65536];
+    bool eof = false;
+    while (true) {
+        ssize_t n = recv(c.fd, buf, sizeof buf, 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN)
+            eof = true;
+        break;
+    }
+    size_t off = 0;
+    while (!c.inflight.empty()) {
+        size_t hdr_end = c.in.find("\r\n\r\n", off);
+        if (hdr_end == std::string::npos)
+            break;
+        int status = c.in.size() - off > 12 ? atoi(c.in.c_str() + off + 9) : 0;
+        long length = 0;
+        for (size_t p = off; p < hdr_end;) {
+            size_t eol = c.in.find("\r\n", p);
+            if (strncasecmp(c.in.c_str() + p, "Content-Length:", 15) == 0)
+                length = atol(c.in.c_str() + p + 15);
+            p = eol + 2;
+        }
+        size_t total = hdr_end + 4 + length - off;
+        if (c.in.size() - off < total)
+            break;
+        off += total;
+        stats.latency.record(now - c.inflight.front());
+        c.inflight.pop_front();
+        // 测量时间之外的响应不计入吞吐
+        if (now <= m_end) {
+            ++stats.requests;
+            stats.bytes += total;
+            if (status > 0 && status < 600)
+                ++stats.status[status];
+        }
+        c.last_active = now;
+    }
+    c.in.erase(0, off);
+    if (!m_opt.keepalive && c.inflight.empty() && c.in.empty()) {
+        close_conn(c, false);
+        return;
+    }
+    if (eof) {
+        if (c.inflight.empty())
+            ++stats.dropped;
+        close_conn(c, true);
+    }
+}
+
+// 按闭环或开环规则补充请求
+void Worker::fill(Conn &c, uint64_t now)
+{
+    if (now >= m_end)
+        return;
+    if (m_interval == 0) {
+        while ((int)c.inflight.size() < m_opt.depth)
+            issue(c, now);
+    }
+    else {
+        // 开环：连接空闲时按计划发出，即使计划时间已过，延迟仍从计划时间开始计算
+        while (c.next_send <= now && (int)c.inflight.size() < m_opt.depth) {
+            issue(c, c.next_send);
+            c.next_send += m_interval;
+        }
+    }
+    if (c.fd != -1 && !c.connecting && c.out_off < c.out.size() && !flush(c))
+        close_conn(c, true);
+}
+
+// 建立全部连接，同时进行中的连接数有限，避免瞬间的SYN超过服务器的监听队列
+void Worker::connect_all()
+{
+    const size_t MAX_CONNECTING = 256;
+    const uint64_t timeout = (uint64_t)m_opt.timeout_ms * 1000000;
+    std::vector<epoll_event> events(1024);
+    size_t next = 0, pending = 0;
+    while (next < m_conns.size() || pending > 0) {
+        uint64_t now = now_ns();
+        while (next < m_conns.size() && pending < MAX_CONNECTING) {
+            Conn &c = m_conns[next++];
+            c.last_active = now;
+            if (!open_conn(c))
+                ++stats.errors;
+            else if (c.connecting)
+                ++pending;
+            else
+                stats.connect_latency.record(now_ns() - now);
+        }
+        int n = epoll_wait(m_epfd, events.data(), events.size(), 10);
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            Conn &c = m_conns[events[i].data.u32];
+            if (c.fd == -1)
+                continue;
+            uint32_t ev = events[i].events;
+            if (!c.connecting) {
+                // 已建立的连接被服务器关闭，如超过最大连接数
+                if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                    on_read(c, now);
+                continue;
+            }
+            int err = 0;
+            socklen_t len = sizeof err;
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0 || (ev & (EPOLLERR | EPOLLHUP))) {
+                --pending;
+                ++stats.errors;
+                close_conn(c, false);
+            }
+            else if (ev & EPOLLOUT) {
+                --pending;
+                c.connecting = false;
+                stats.connect_latency.record(now - c.last_active);
+                update_events(c);
+            }
+        }
+        for (size_t i = 0; i < next; ++i) {
+            Conn &c = m_conns[i];
+            if (c.connecting && now > c.last_active + timeout) {
+                --pending;
+                ++stats.timeouts;
+                close_conn(c, false);
+            }
+        }
+    }
+    for (auto &c : m_conns)
+        stats.established += c.fd != -1;
+}
+
+void Worker::run()
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_opt.idle) {
+        connect_all();
+        m_phase->arrive_and_wait(1);
+        m_start = now_ns();
+        m_end = m_start + (uint64_t)(m_opt.duration * 1e9);
+    }
+    // 开环模式下各连接的计划时间错开，避免同时发出
+    for (size_t i = 0; i < m_conns.size(); ++i)
+        m_conns[i].next_send = m_start + (m_interval * i) / m_conns.size();
+    std::vector<epoll_event> events(1024);
+    const uint64_t timeout = (uint64_t)m_opt.timeout_ms * 1000000;
+    while (true) {
+        uint64_t now = now_ns();
+        if (now >= m_end) {
+            // 等待已发出的请求完成，最多等待一个超时时间
+            bool idle = true;
+            for (auto &c : m_conns)
+                idle = idle && c.inflight.empty();
+            if (idle || now >= m_end + timeout)
+                break;
+        }
+        for (auto &c : m_conns) {
+            if (!c.inflight.empty() && now > c.last_active + timeout) {
+                stats.timeouts += c.inflight.size();
+                c.inflight.clear();
+                close_conn(c, false);
+            }
+            fill(c, now);
+        }
+        int n = epoll_wait(m_epfd, events.data(), events.size(), m_interval ? 1 : 10);
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            Conn &c = m_conns[events[i].data.u32];
+            if (c.fd == -1)
+                continue;
+            uint32_t ev = events[i].events;
+            if (c.connecting) {
+                int err = 0;
+                socklen_t len = sizeof err;
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (ev & (EPOLLERR | EPOLLHUP))) {
+                    close_conn(c, true);
+                    continue;
+                }
+                if (!(ev & EPOLLOUT))
+                    continue;
+                c.connecting = false;
+            }
+            if ((ev & EPOLLOUT) && !flush(c)) {
+                close_conn(c, true);
+                continue;
+            }
+            if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                on_read(c, now);
+        }
+    }
+    if (m_opt.idle)
+        m_phase->arrive_and_wait(2);
+    for (auto &c : m_conns)
+        close_conn(c, false);
+    close(m_epfd);
+}
+
+// 服务器/metrics中与连接规模相关的指标
+struct ServerSample {
+    bool ok = false;
+    uint64_t time = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t active = 0;
+    uint64_t rss = 0;
+};
+
+static uint64_t metric_value(const std::string &text, const char *name)
+{
+    std::string key = std::string("\n") + name + " ";
+    size_t pos = text.find(key);
+    return pos == std::string::npos ? 0 : strtoull(text.c_str() + pos + key.size(), nullptr, 10);
+}
+
+// 以短连接抓取/metrics，本进程历次抓取的连接都计入了accept计数，当前抓取连接计入活跃连接数，在此扣除
+static ServerSample scrape_server(const sockaddr_in &addr)
+{
+    static uint64_t scrapes = 0;
+    ServerSample s;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return s;
+    timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    std::string text;
+    const char req[] = "GET /metrics HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+    if (connect(fd, (const sockaddr *)&addr, sizeof addr) == 0 && ++scrapes &&
+        send(fd, req, sizeof req - 1, MSG_NOSIGNAL) == (ssize_t)(sizeof req - 1)) {
+        char buf[16384];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof buf, 0)) > 0)
+            text.append(buf, n);
+    }
+    close(fd);
+    if (text.compare(0, 12, "HTTP/1.1 200") != 0 ||
+        text.find("\nmango_connections_accepted_total ") == std::string::npos)
+        return s;
+    s.ok = true;
+    s.time = now_ns();
+    s.accepted = metric_value(text, "mango_connections_accepted_total") - scrapes;
+    s.rejected = metric_value(text, "mango_connections_rejected_total");
+    s.active = metric_value(text, "mango_connections_active");
+    s.active -= s.active > 0;
+    s.rss = metric_value(text, "process_resident_memory_bytes");
+    return s;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -h HOST        server address (127.0.0.1)\n"
+            "  -p PORT        server port (5005)\n"
+            "  -c N           connections (16)\n"
+            "  -t N           load generator threads (1)\n"
+            "  -d SEC         measured duration (10)\n"
+            "  -r RATE        open loop at RATE req/s in total; closed loop if omitted\n"
+            "  -s SCENARIO    scenario, or 'all' to run each in turn (keepalive)\n"
+            "  --path PATH    override the scenario's request path\n"
+            "  --depth N      override the number of pipelined requests per connection\n"
+            "  --timeout MS   per-request timeout (2000)\n"
+            "  --json FILE    append one JSON result per scenario to FILE ('-' for stdout)\n"
+            "  --label NAME   label stored in the JSON results, e.g. the build being measured\n"
+            "  --sources N    spread connections over source addresses 127.0.0.1..N\n"
+            "                 (default: one per 20000 connections for a loopback server)\n"
+            "Scenarios:\n", prog);
+    for (const auto &s : scenarios)
+        fprintf(stderr, "  %-10s %s\n", s.name, s.desc);
+}
+
+static void print_latency(const char *name, const Histogram &h)
+{
+    printf("%-10s p50 %8.1fus  p99 %8.1fus  p999 %8.1fus  max %8.1fus\n", name,
+           h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3,
+           h.max / 1e3);
+}
+
+static std::string json_latency(const Histogram &h)
+{
+    char buf[256];
+    snprintf(buf, sizeof buf, "{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}",
+             h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3,
+             h.max / 1e3, h.total ? h.sum / h.total / 1e3 : 0.0);
+    return buf;
+}
+
+static int run_scenario(Options opt, const Scenario &sc)
+{
+    if (opt.path.empty())
+        opt.path = sc.path;
+    opt.keepalive = sc.keepalive;
+    if (opt.depth <= 0)
+        opt.depth = sc.depth;
+    opt.scenario = sc.name;
+    opt.idle = sc.idle;
+    // idle场景默认每个连接约10秒发出一个请求
+    if (opt.idle && opt.rate <= 0)
+        opt.rate = std::max(1.0, opt.conns / 10.0);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad address %s\n", opt.host.c_str());
+        return 1;
+    }
+
+    if (opt.sources <= 0)
+        opt.sources = (ntohl(addr.sin_addr.s_addr) >> 24) == 127 ? (opt.conns + 19999) / 20000 : 1;
+
+    ServerSample before = scrape_server(addr), held, after;
+    Phase phase;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(opt.duration * 1e9);
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0, first = 0; i < opt.threads; ++i) {
+        int n = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+        workers.emplace_back(new Worker(opt, addr, n, first, start, end, &phase));
+        first += n;
+    }
+    for (auto &w : workers)
+        threads.emplace_back(&Worker::run, w.get());
+    double connect_secs = 0;
+    if (opt.idle) {
+        phase.wait_arrived(opt.threads);
+        connect_secs = (now_ns() - start) / 1e9;
+        uint64_t established = 0;
+        for (auto &w : workers)
+            established += w->stats.established;
+        // 客户端连接建立时服务器可能尚未accept，等待服务器计数追上
+        uint64_t deadline = now_ns() + (uint64_t)opt.timeout_ms * 1000000;
+        do {
+            held = scrape_server(addr);
+            if (!held.ok || !before.ok || held.accepted - before.accepted >= established)
+                break;
+            usleep(10000);
+        } while (now_ns() < deadline);
+        phase.stage.store(1);
+        phase.wait_arrived(2 * opt.threads);
+        after = scrape_server(addr);
+        phase.stage.store(2);
+    }
+    for (auto &t : threads)
+        t.join();
+    if (!opt.idle)
+        after = scrape_server(addr);
+    Stats total;
+    for (auto &w : workers)
+        total.merge(w->stats);
+
+    double secs = opt.duration;
+    double rps = total.requests / secs;
+    double bps = total.bytes / secs;
+    // 闭环模式下以平均延迟作为连接无阻塞时发出请求的期望间隔
+    uint64_t interval = opt.rate > 0 ? 0 :
+                        (uint64_t)(total.latency.total ? total.latency.sum / total.latency.total : 0);
+    Histogram corrected = total.latency.corrected(interval);
+
+    printf("== %s: %s %s, %d conns, %d threads, %s, %.1fs\n", sc.name, opt.path.c_str(),
+           opt.keepalive ? "keep-alive" : "close", opt.conns, opt.threads,
+           opt.rate > 0 ? "open loop" : "closed loop", secs);
+    printf("requests %llu  errors %llu  timeouts %llu  connects %llu\n",
+           (unsigned long long)total.requests, (unsigned long long)total.errors,
+           (unsigned long long)total.timeouts, (unsigned long long)total.connects);
+    printf("throughput %.1f req/s  %.2f MB/s\n", rps, bps / 1e6);
+    print_latency("latency", total.latency);
+    if (opt.rate <= 0)
+        print_latency("corrected", corrected);
+    if (total.dropped)
+        printf("dropped by server while idle %llu\n", (unsigned long long)total.dropped);
+
+    // 连接规模：idle场景以连接建立后的内存计算每连接开销，其他场景以压测前后的差值计算
+    char server[512] = "null";
+    if (opt.idle) {
+        printf("connect    %llu/%d established in %.2fs (%.0f conn/s), %d source addrs\n",
+               (unsigned long long)total.established, opt.conns, connect_secs,
+               total.established / connect_secs, opt.sources);
+        print_latency("connect", total.connect_latency);
+    }
+    const ServerSample &peak = opt.idle ? held : after;
+    if (before.ok && peak.ok) {
+        uint64_t accepted = peak.accepted - before.accepted;
+        double accept_secs = (peak.time - before.time) / 1e9;
+        int64_t grown = (int64_t)peak.rss - (int64_t)before.rss;
+        double per_conn = opt.idle && peak.active ? (double)grown / peak.active : 0;
+        printf("server     accepted %llu (%.0f conn/s)  rejected %llu  active %llu\n",
+               (unsigned long long)accepted, accepted / accept_secs,
+               (unsigned long long)(peak.rejected - before.rejected),
+               (unsigned long long)peak.active);
+        printf("server     rss %.1f MB -> %.1f MB", before.rss / 1048576.0, peak.rss / 1048576.0);
+        if (opt.idle)
+            printf(" (%.0f bytes/conn), %.1f MB after trickle", per_conn, after.rss / 1048576.0);
+        printf("\n");
+        snprintf(server, sizeof server, "{\"accepted\":%llu,\"accept_per_s\":%.1f,"
+                 "\"rejected\":%llu,\"active\":%llu,\"rss_before\":%llu,\"rss_peak\":%llu,"
+                 "\"rss_after\":%llu,\"rss_per_conn\":%.1f}",
+                 (unsigned long long)accepted, accepted / accept_secs,
+                 (unsigned long long)(peak.rejected - before.rejected),
+                 (unsigned long long)peak.active, (unsigned long long)before.rss,
+                 (unsigned long long)peak.rss, (unsigned long long)after.rss,
+                 per_conn);
+    }
+
+    std::string status;
+    for (int i = 0; i < 600; ++i) {
+        if (total.status[i] == 0)
+            continue;
+        printf("status %d: %llu\n", i, (unsigned long long)total.status[i]);
+        status += (status.empty() ? "\"" : ",\"") + std::to_string(i) + "\":" +
+                  std::to_string(total.status[i]);
+    }
+
+    if (!opt.json.empty()) {
+        FILE *fp = opt.json == "-" ? stdout : fopen(opt.json.c_str(), "a");
+        if (!fp) {
+            fprintf(stderr, "Open %s failed\n", opt.json.c_str());
+            return 1;
+        }
+        fprintf(fp, "{\"label\":\"%s\",\"scenario\":\"%s\",\"path\":\"%s\",\"keepalive\":%s,"
+                "\"depth\":%d,\"conns\":%d,\"threads\":%d,\"mode\":\"%s\",\"rate\":%.1f,"
+                "\"duration_s\":%.3f,\"requests\":%llu,\"errors\":%llu,\"timeouts\":%llu,"
+                "\"connects\":%llu,\"req_per_s\":%.1f,\"bytes_per_s\":%.1f,\"latency_us\":%s,"
+                "\"corrected_latency_us\":%s,\"established\":%llu,\"connect_s\":%.3f,"
+                "\"connect_latency_us\":%s,\"dropped\":%llu,\"server\":%s,\"status\":{%s}}\n",
+                opt.label.c_str(), sc.name, opt.path.c_str(), opt.keepalive ? "true" : "false",
+                opt.depth, opt.conns, opt.threads, opt.rate > 0 ? "open" : "closed", opt.rate,
+                secs, (unsigned long long)total.requests, (unsigned long long)total.errors,
+                (unsigned long long)total.timeouts, (unsigned long long)total.connects, rps, bps,
+                json_latency(total.latency).c_str(),
+                json_latency(opt.rate > 0 ? total.latency : corrected).c_str(),
+                (unsigned long long)total.established, connect_secs,
+                json_latency(total.connect_latency).c_str(), (unsigned long long)total.dropped,
+                server, status.c_str());
+        if (fp != stdout)
+            fclose(fp);
+    }
+    return total.requests > 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    opt.depth = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val && arg != "--help") {
+            usage(argv[0]);
+            return 1;
+        }
+        if (arg == "-h") opt.host = val;
+        else if (arg == "-p") opt.port = atoi(val);
+        else if (arg == "-c") opt.conns = atoi(val);
+        else if (arg == "-t") opt.threads = atoi(val);
+        else if (arg == "-d") opt.duration = atof(val);
+        else if (arg == "-r") opt.rate = atof(val);
+        else if (arg == "-s") opt.scenario = val;
+        else if (arg == "--path") opt.path = val;
+        else if (arg == "--depth") opt.depth = atoi(val);
+        else if (arg == "--timeout") opt.timeout_ms = atoi(val);
+        else if (arg == "--json") opt.json = val;
+        else if (arg == "--label") opt.label = val;
+        else if (arg == "--sources") opt.sources = atoi(val);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if (opt.conns <= 0 || opt.threads <= 0 || opt.threads > opt.conns || opt.duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    // 大量连接需要足够的文件描述符
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur < (rlim_t)opt.conns + 64)
+        fprintf(stderr, "Warning: fd limit %llu is below %d connections, raise it with ulimit -n\n",
+                (unsigned long long)rl.rlim_cur, opt.conns);
+    int ret = 0, found = 0;
+    for (const auto &sc : scenarios) {
+        if (opt.scenario != "all" && opt.scenario != sc.name)
+            continue;
+        ++found;
+        ret |= run_scenario(opt, sc);
+    }
+    if (!found) {
+        usage(argv[0]);
+        return 1;
+    }
+    return ret;
+}
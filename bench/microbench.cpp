@@ -0,0 +1,394 @@
+// 组件级微基准测试：解析器、线程池往返、时间轮、日志、连接表查找和路由查找
+// 用法：microbench [--filter 名称子串] [--corpus 目录] [--json 文件] [--label 名称]
+// 每项输出每次操作的耗时（ns/op）和内存分配次数（allocs/op），分配次数通过替换全局operator new统计
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <dirent.h>
+#include "httpconn.h"
+#include "threadpool.h"
+#include "timer.h"
+#include "log.h"
+
+static std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(std::size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, std::size_t) noexcept { free(p); }
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    std::string name;
+    double ns_per_op;
+    double allocs_per_op;
+    uint64_t ops;
+};
+
+static std::vector<Result> g_results;
+static std::string g_filter;
+
+static bool selected(const std::string &name)
+{
+    return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+static void report(const std::string &name, uint64_t ops, uint64_t ns, uint64_t allocs)
+{
+    Result r{name, (double)ns / ops, (double)allocs / ops, ops};
+    printf("%-32s %12.1f ns/op %10.2f allocs/op %12llu ops\n", r.name.c_str(), r.ns_per_op,
+           r.allocs_per_op, (unsigned long long)ops);
+    g_results.push_back(r);
+}
+
+// 反复执行fn(batch)直到耗时超过约0.5秒，fn每次执行batch个操作
+template <typename F>
+static void measure(const std::string &name, uint64_t batch, F fn)
+{
+    if (!selected(name))
+        return;
+    fn(batch);
+    uint64_t ops = 0, allocs = g_allocs.load(), start = now_ns(), elapsed = 0;
+    while (elapsed < 500000000ull) {
+        fn(batch);
+        ops += batch;
+        elapsed = now_ns() - start;
+    }
+    report(name, ops, elapsed, g_allocs.load() - allocs);
+}
+
+// 直接驱动HTTPConn的解析器，不经过套接字
+class HTTPConnBench {
+public:
+    static void load(HTTPConn &conn, const std::string &req) {
+        memcpy(conn.m_read_buf, req.data(), req.size());
+        conn.m_read_idx = req.size();
+    }
+    static HTTPConn::HTTP_CODE parse(HTTPConn &conn) {
+        return conn.process_read();
+    }
+    // 只重置解析状态，不清空缓冲区
+    static void rewind(HTTPConn &conn) {
+        conn.m_check_state = HTTPConn::CHECK_STATE_REQUESTLINE;
+        conn.m_checked_idx = 0;
+        conn.m_start_line = 0;
+        conn.m_read_idx = 0;
+        conn.m_linger = false;
+        conn.m_url = conn.m_version = conn.m_host = conn.m_if_none_match = nullptr;
+        conn.m_accept_gzip = false;
+        conn.m_headers.count = 0;
+        conn.m_content_length = 0;
+        conn.m_chunked = conn.m_expect_continue = false;
+    }
+    static void reset(HTTPConn &conn) {
+        conn.m_read_idx = 0;
+        conn.m_checked_idx = 0;
+        conn.init();
+    }
+};
+
+// 未提供抓包目录时使用的典型请求
+static const char *const builtin_corpus[] = {
+    "GET / HTTP/1.1\r\nHost: 127.0.0.1:5005\r\nUser-Agent: curl/7.81.0\r\nAccept: */*\r\n\r\n",
+    "GET /index.html HTTP/1.1\r\nHost: example.com\r\nConnection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\nsec-ch-ua: \"Chromium\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\nsec-ch-ua-platform: \"Linux\"\r\nUpgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\nSec-Fetch-Mode: navigate\r\nSec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n\r\n",
+    "GET /health HTTP/1.1\r\nHost: 10.0.0.1:5005\r\nConnection: keep-alive\r\n\r\n",
+    "GET http://example.com/static/app.js?v=20221012 HTTP/1.1\r\nHost: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/118.0\r\n"
+    "Accept: */*\r\nAccept-Language: en-US,en;q=0.5\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://example.com/\r\nConnection: keep-alive\r\nSec-Fetch-Dest: script\r\n"
+    "Sec-Fetch-Mode: no-cors\r\nSec-Fetch-Site: same-origin\r\n\r\n",
+};
+
+// 读取目录下的每个文件作为一个原始请求
+static std::vector<std::string> load_corpus(const std::string &dir)
+{
+    std::vector<std::string> corpus;
+    if (dir.empty()) {
+        for (const char *req : builtin_corpus)
+            corpus.push_back(req);
+        return corpus;
+    }
+    DIR *dp = opendir(dir.c_str());
+    if (!dp) {
+        fprintf(stderr, "Open corpus %s failed\n", dir.c_str());
+        exit(1);
+    }
+    while (dirent *ent = readdir(dp)) {
+        if (ent->d_name[0] == '.')
+            continue;
+        std::ifstream in(dir + "/" + ent->d_name, std::ios::binary);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        std::string req = ss.str();
+        if (!req.empty() && req.size() < HTTPConn::READ_BUFFER_SIZE)
+            corpus.push_back(req);
+    }
+    closedir(dp);
+    return corpus;
+}
+
+static void bench_parser(const std::vector<std::string> &corpus)
+{
+    std::unique_ptr<HTTPConn> conn(new HTTPConn);
+    HTTPConnBench::reset(*conn);
+    for (const auto &req : corpus) {
+        HTTPConnBench::load(*conn, req);
+        HTTPConn::HTTP_CODE ret = HTTPConnBench::parse(*conn);
+        HTTPConnBench::reset(*conn);
+        if (ret != HTTPConn::GET_REQUEST) {
+            fprintf(stderr, "Corpus request is not a complete GET:\n%s\n", req.c_str());
+            exit(1);
+        }
+    }
+    size_t i = 0;
+    // 解析会就地修改缓冲区，每次重新拷入请求，拷贝计入耗时
+    measure("parser/process_read", 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            HTTPConnBench::load(*conn, corpus[i++ % corpus.size()]);
+            HTTPConnBench::parse(*conn);
+            HTTPConnBench::rewind(*conn);
+        }
+    });
+    // 解析之间的重置，每个请求结束时都会执行
+    measure("parser/init", 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            HTTPConnBench::reset(*conn);
+    });
+}
+
+// 空任务，完成后通知提交者
+class PingRequest: public WorkRequest {
+public:
+    explicit PingRequest(std::atomic<bool> *done): m_done(done) {}
+    bool do_request() override {
+        m_done->store(true, std::memory_order_release);
+        return true;
+    }
+private:
+    std::atomic<bool> *m_done;
+};
+
+static void bench_pool()
+{
+    ThreadPool &pool = ThreadPool::getInstance();
+    for (int producers : {1, 4, 16}) {
+        std::string name = "pool/roundtrip/" + std::to_string(producers) + "p";
+        measure(name, 4096, [&](uint64_t n) {
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; ++p) {
+                threads.emplace_back([&pool, n, producers]() {
+                    std::atomic<bool> done;
+                    for (uint64_t k = 0; k < n / producers; ++k) {
+                        done.store(false, std::memory_order_relaxed);
+                        while (!pool.appendReq(std::make_shared<PingRequest>(&done)))
+                            std::this_thread::yield();
+                        while (!done.load(std::memory_order_acquire))
+                            std::this_thread::yield();
+                    }
+                });
+            }
+            for (auto &t : threads)
+                t.join();
+        });
+    }
+}
+
+// 到期时只计数，不关闭连接
+class CountingWheel: public TimerWheelHandler {
+public:
+    CountingWheel(): TimerWheelHandler(60, 1) {}
+    void callback(std::shared_ptr<timer_type>) override { ++fired; }
+    uint64_t fired = 0;
+};
+
+static void bench_timer()
+{
+    const size_t TIMERS = 100000;
+    CountingWheel wheel;
+    std::mt19937 rng(42);
+    std::vector<std::shared_ptr<timer_type>> timers;
+    timers.reserve(TIMERS);
+    // 超时时间分布在1到600秒，即最多10圈
+    for (size_t i = 0; i < TIMERS; ++i) {
+        timers.push_back(wheel.get_timer(nullptr, 1 + rng() % 600));
+        wheel.add_timer(timers.back());
+    }
+    std::string suffix = "/" + std::to_string(TIMERS / 1000) + "k";
+    size_t i = 0;
+    measure("timer/mod" + suffix, 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            wheel.mod_timer(timers[i++ % TIMERS], 1 + rng() % 600);
+    });
+    // 删除后立即重新加入，保持定时器总数不变
+    measure("timer/delete+add" + suffix, 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            auto &timer = timers[i++ % TIMERS];
+            wheel.delete_timer(timer);
+            timer = wheel.get_timer(nullptr, 1 + rng() % 600);
+            wheel.add_timer(timer);
+        }
+    });
+    // 每次tick只处理当前槽，到期的定时器之后重新加入
+    measure("timer/tick" + suffix, 60, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            uint64_t fired = wheel.fired;
+            wheel.tick();
+            for (; fired < wheel.fired; ++fired)
+                wheel.add_timer(wheel.get_timer(nullptr, 1 + rng() % 600));
+        }
+    });
+}
+
+static void bench_log()
+{
+    Log &log = Log::getInstance();
+    // 日志写入临时目录，后台线程写满时阻塞，测得的是可持续的吞吐
+    log.config("/tmp/", "microbench", false, 100, false, 256, 30, 5, false);
+    log.setOverflow(Log::BLOCK);
+    measure("log/sync", 1024, [](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            LOG_INFO<Log::HTTP>("Close connection, sock: %d", (int)k);
+    });
+    log.setAsync();
+    for (int threads : {1, 4}) {
+        measure("log/async/" + std::to_string(threads) + "t", 4096, [threads](uint64_t n) {
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([n, threads]() {
+                    for (uint64_t k = 0; k < n / threads; ++k)
+                        LOG_INFO<Log::HTTP>("Close connection, sock: %d", (int)k);
+                });
+            }
+            for (auto &w : workers)
+                w.join();
+        });
+    }
+    // 低于运行时级别的日志只有一次原子读
+    Log::setLevel(Log::WARN);
+    measure("log/filtered", 4096, [](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            LOG_INFO<Log::HTTP>("Close connection, sock: %d", (int)k);
+    });
+    Log::setLevel(Log::INFO);
+}
+
+static void bench_connhandler()
+{
+    const int CONNS = 10000;
+    ConnHandler &connhdr = ConnHandler::getInstance();
+    for (int fd = 0; fd < CONNS; ++fd)
+        connhdr.add_conn(fd);
+    std::mt19937 rng(42);
+    std::vector<int> fds(4096);
+    for (auto &fd : fds)
+        fd = rng() % CONNS;
+    size_t i = 0;
+    measure("connhandler/find_conn/10k", 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            auto conn = connhdr.find_conn(fds[i++ % fds.size()]);
+            if (!conn)
+                abort();
+        }
+    });
+    for (int fd = 0; fd < CONNS; ++fd)
+        connhdr.delete_conn(fd);
+}
+
+static void bench_router()
+{
+    HandlerTable &table = HandlerTable::getInstance();
+    Handler noop = [](const Request &, Response &) {};
+    const char *const routes[] = {
+        "/health", "/metrics", "/api/v1/users", "/api/v1/users/:id", "/api/v1/users/:id/posts",
+        "/api/v1/users/:id/posts/:post", "/api/v1/orders", "/api/v1/orders/:id",
+        "/api/v1/search", "/api/v2/users/:id", "/assets/*file", "/favicon.ico",
+    };
+    for (const char *r : routes)
+        table.add_handler(r, noop);
+    table.mount("/", "../root");
+    const char *const urls[] = {
+        "/health", "/api/v1/users/42", "/api/v1/users/42/posts/7?x=1", "/api/v1/orders",
+        "/assets/css/site.css", "/index.html", "/api/v2/users/abc", "/api/v1/search?q=mango",
+    };
+    const size_t N = sizeof urls / sizeof urls[0];
+    Params params;
+    size_t i = 0;
+    measure("router/find/13", 1024, [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            if (!table.find(urls[i++ % N], &params))
+                abort();
+        }
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    std::string corpus_dir, json, label;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--filter") g_filter = argv[i + 1];
+        else if (arg == "--corpus") corpus_dir = argv[i + 1];
+        else if (arg == "--json") json = argv[i + 1];
+        else if (arg == "--label") label = argv[i + 1];
+        else {
+            fprintf(stderr, "Usage: %s [--filter NAME] [--corpus DIR] [--json FILE] [--label NAME]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (argc % 2 == 0) {
+        fprintf(stderr, "Usage: %s [--filter NAME] [--corpus DIR] [--json FILE] [--label NAME]\n",
+                argv[0]);
+        return 1;
+    }
+    bench_parser(load_corpus(corpus_dir));
+    bench_pool();
+    bench_timer();
+    bench_connhandler();
+    bench_router();
+    // 日志最后测试，切换为异步后不能恢复
+    bench_log();
+
+    if (!json.empty()) {
+        FILE *fp = json == "-" ? stdout : fopen(json.c_str(), "a");
+        if (!fp) {
+            fprintf(stderr, "Open %s failed\n", json.c_str());
+            return 1;
+        }
+        for (const auto &r : g_results) {
+            fprintf(fp, "{\"label\":\"%s\",\"name\":\"%s\",\"ns_per_op\":%.2f,"
+                    "\"allocs_per_op\":%.3f,\"ops\":%llu}\n", label.c_str(), r.name.c_str(),
+                    r.ns_per_op, r.allocs_per_op, (unsigned long long)r.ops);
+        }
+        if (fp != stdout)
+            fclose(fp);
+    }
+    return 0;
+}
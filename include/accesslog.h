@@ -0,0 +1,97 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "ringbuffer.h"
+
+// 一个请求的访问记录，时间戳均为单调时钟纳秒，0表示未经历该阶段
+struct AccessEntry {
+    // 连接建立、读到请求的第一个字节、解析完成、工作线程取出任务、发出第一个和最后一个字节
+    uint64_t accept = 0;
+    uint64_t first_read = 0;
+    uint64_t parsed = 0;
+    uint64_t dequeued = 0;
+    uint64_t first_write = 0;
+    uint64_t last_write = 0;
+    // 已发送的字节数，包括响应头
+    uint64_t bytes = 0;
+    // 该请求之前在同一连接上已完成的请求数
+    uint32_t reuse = 0;
+    int status = 0;
+    // 指向静态字符串
+    const char *method = "-";
+};
+
+// 访问日志，每个请求一行JSON
+// 工作线程只把原始记录拷贝进线程独占的无锁缓冲区，由后台线程格式化后批量追加到文件，按大小轮转
+class AccessLog {
+public:
+    using size_t = unsigned long;
+    static AccessLog &getInstance() {
+        static AccessLog accesslog;
+        return accesslog;
+    }
+    ~AccessLog();
+
+    AccessLog(const AccessLog &) = delete;
+    AccessLog &operator=(const AccessLog &) = delete;
+    AccessLog(AccessLog &&) = delete;
+    AccessLog &operator=(AccessLog &&) = delete;
+
+    // 打开日志文件并启动后台线程，文件为dir + name + ".log"
+    // 超过maxsize字节时轮转为name.log.1 ... name.log.<maxfiles>，flushms为后台线程的最长刷新间隔
+    bool open(const std::string &dir, const std::string &name, size_t maxsize = 64 << 20,
+              int maxfiles = 4, size_t flushms = 500);
+    bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+    // 记录一个请求，path不要求以'\0'结尾，过长时截断
+    void record(const AccessEntry &entry, const char *path, size_t pathlen);
+
+    // 访问记录使用的时钟
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    AccessLog() {}
+    void work();
+    // 取出一个线程缓冲区中的记录，格式化后追加到批量缓冲
+    void drain(ThreadRings::Slot *slot);
+    void format(const AccessEntry &entry, const char *path, size_t pathlen);
+    // 写出批量缓冲，必要时轮转文件
+    void flush();
+    bool open_file();
+    void rotate();
+
+    // 单条记录中路径的最大长度
+    static const size_t MAX_PATH = 512;
+    // 批量缓冲达到该大小时写出
+    static const size_t BATCH_SIZE = 256 << 10;
+
+    std::atomic<bool> m_enabled{false};
+    std::string m_path;
+    size_t m_maxsize = 64 << 20;
+    int m_maxfiles = 4;
+    size_t m_flushms = 500;
+    int m_fd = -1;
+    size_t m_filesize = 0;
+    // 打开时的墙上时间和单调时间，用于将时间戳换算为日期
+    uint64_t m_realtime = 0;
+    uint64_t m_monotonic = 0;
+
+    ThreadRings m_rings{1 << 18};
+    std::string m_batch;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_shutdown = false;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+
+// 管理接口：在独立线程中监听Unix域套接字，按行接收命令，用于运行时查看和修改配置而不重启服务器
+// 可调整的配置项和命令由使用者注册，如 echo "set workers 16" | nc -U ../mango.sock
+// 每条命令的应答以空行结束，出错时以"ERR "开头
+class Admin {
+public:
+    // 返回配置项的当前值
+    using Getter = std::function<std::string()>;
+    // 设置配置项，值不合法时返回false
+    using Setter = std::function<bool(const std::string &)>;
+    // 执行命令，参数不含命令名，返回应答内容
+    using Command = std::function<std::string(const std::vector<std::string> &)>;
+
+    static Admin &getInstance() {
+        static Admin admin;
+        return admin;
+    }
+    ~Admin();
+    Admin(const Admin &) = delete;
+    Admin &operator=(const Admin &) = delete;
+    Admin(Admin &&) = delete;
+    Admin &operator=(Admin &&) = delete;
+
+    // 注册需在start之前完成，setter为空时配置项只读
+    void add_setting(const std::string &name, const std::string &help, Getter getter,
+                     Setter setter = nullptr);
+    void add_command(const std::string &name, const std::string &help, Command command);
+    // 在path创建套接字（仅属主可访问）并启动服务线程
+    bool start(const std::string &path);
+    // 停止服务线程并删除套接字文件，注册的回调引用的对象销毁前需要调用
+    void stop();
+    // 解析并执行一行命令
+    std::string execute(const std::string &line);
+
+private:
+    struct Setting {
+        std::string help;
+        Getter getter;
+        Setter setter;
+    };
+    struct Entry {
+        std::string help;
+        Command command;
+    };
+    struct Client {
+        int fd;
+        std::string in;
+    };
+    Admin() {}
+    void work();
+    // 读取客户端数据并执行其中的完整命令，连接关闭时返回false
+    bool serve(Client &client);
+
+    // 同时服务的最大客户端数
+    static const size_t MAX_CLIENTS = 16;
+    // 单行命令的最大长度
+    static const size_t MAX_LINE = 4096;
+
+    std::map<std::string, Setting> m_settings;
+    std::map<std::string, Entry> m_commands;
+    std::string m_path;
+    // 套接字文件的inode，退出时据此判断文件是否仍属于本进程
+    ino_t m_ino = 0;
+    int m_listenfd = -1;
+    std::thread m_thread;
+    std::atomic<bool> m_shutdown{false};
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CAPFORMAT_H
+#define CAPFORMAT_H
+
+#include <cstdint>
+
+// 流量捕获的文件格式，服务器写入端和回放工具共用
+// 文件以FileHeader开始，之后为若干条记录，每条记录以RecordHeader开始，len为之后数据的长度
+// 记录按各线程缓冲区的顺序写出，不保证全局按时间排序，回放时需要先按时间戳排序
+namespace capbin {
+
+const char MAGIC[8] = {'M', 'C', 'A', 'P', 'T', 'U', 'R', '1'};
+
+// OPEN为接受连接，DATA为从连接读到的原始字节，CLOSE为服务器关闭连接
+enum RECORD_TYPE : uint8_t { OPEN = 1, DATA = 2, CLOSE = 3 };
+
+#pragma pack(push, 1)
+// 文件头，记录开始捕获时的墙上时间
+struct FileHeader {
+    char magic[8];
+    uint64_t realtime_ns;
+};
+
+struct RecordHeader {
+    uint32_t len;
+    uint8_t type;
+    uint8_t reserved[3];
+    // 连接编号，在一次捕获中唯一，不随文件描述符复用
+    uint32_t conn;
+    // 相对于开始捕获的纳秒数
+    uint64_t ts;
+};
+#pragma pack(pop)
+
+}
+
+#endif
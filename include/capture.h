@@ -0,0 +1,71 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "ringbuffer.h"
+#include "capformat.h"
+
+// 流量捕获，记录各连接读到的原始请求字节和相对时间，由tools/replay按原节奏回放
+// 与访问日志相同，读取路径只把数据拷贝进线程独占的无锁缓冲区，由后台线程批量写入文件
+class Capture {
+public:
+    using size_t = unsigned long;
+    static Capture &getInstance() {
+        static Capture capture;
+        return capture;
+    }
+    ~Capture();
+
+    Capture(const Capture &) = delete;
+    Capture &operator=(const Capture &) = delete;
+    Capture(Capture &&) = delete;
+    Capture &operator=(Capture &&) = delete;
+
+    // 开始捕获到path，文件达到maxsize字节后停止捕获
+    bool open(const std::string &path, size_t maxsize = 1ul << 30);
+    static bool enabled() {
+        return getInstance().m_enabled.load(std::memory_order_relaxed);
+    }
+    // 为新连接分配编号并记录，未开启捕获时返回0
+    static uint32_t open_conn();
+    static void record(capbin::RECORD_TYPE type, uint32_t conn, const char *data = nullptr,
+                       size_t len = 0);
+
+private:
+    Capture() {}
+    void work();
+    void drain(ThreadRings::Slot *slot);
+    void flush();
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 批量缓冲达到该大小时写出
+    static const size_t BATCH_SIZE = 256 << 10;
+
+    std::atomic<bool> m_enabled{false};
+    std::atomic<uint32_t> m_next_conn{0};
+    std::string m_path;
+    size_t m_maxsize = 1ul << 30;
+    size_t m_filesize = 0;
+    int m_fd = -1;
+    // 开始捕获时的单调时间，记录中的时间戳相对于它
+    uint64_t m_start = 0;
+
+    // 每条记录最多为读缓冲区大小，缓冲区需要容纳一个刷新间隔内的数据
+    ThreadRings m_rings{1 << 20};
+    std::string m_batch;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_shutdown = false;
+};
+
+#endif
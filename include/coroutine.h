@@ -0,0 +1,238 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+// C++20协程处理器，仅在以MANGO_COROUTINES构建时可用
+#ifdef MANGO_COROUTINES
+
+#include <coroutine>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// 协程任务，创建后先挂起，由co_await或CoScheduler::start开始执行
+// 被co_await的任务结束时直接恢复等待它的协程；顶层任务结束时销毁自身并调用结束回调
+class CoTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        std::function<void()> done;
+
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // 处理器不应抛出异常
+        void unhandled_exception() { std::terminate(); }
+    };
+    using handle = std::coroutine_handle<promise_type>;
+
+    CoTask(CoTask &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+    CoTask &operator=(CoTask &&) = delete;
+    ~CoTask() {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    // 在另一个协程中co_await，等待该任务结束
+    bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+        m_handle.promise().continuation = h;
+        return m_handle;
+    }
+    void await_resume() noexcept {}
+    // 交出协程帧的所有权
+    handle release() { return std::exchange(m_handle, {}); }
+
+private:
+    explicit CoTask(handle h) : m_handle(h) {}
+    handle m_handle;
+};
+
+// 协程调度器：挂起的协程登记在独立的epoll实例和定时器堆中，该epoll实例注册在主线程的epoll上
+// 协程可以在任意线程中开始执行和挂起，但只在主线程的poll中恢复，两次挂起之间的代码不能阻塞
+class CoScheduler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static CoScheduler &getInstance() {
+        static CoScheduler scheduler;
+        return scheduler;
+    }
+    ~CoScheduler();
+    CoScheduler(const CoScheduler &) = delete;
+    CoScheduler &operator=(const CoScheduler &) = delete;
+    CoScheduler(CoScheduler &&) = delete;
+    CoScheduler &operator=(CoScheduler &&) = delete;
+
+    // 主线程的epoll监听该fd，可读时调用poll
+    int fd() const { return m_epfd; }
+    // 开始执行顶层任务直到其第一次挂起，结束时调用done
+    // 任务可能在start返回前就已结束，done也可能在其他线程中被调用
+    void start(CoTask task, std::function<void()> done);
+    // 主线程：恢复fd就绪和定时到期的协程
+    void poll();
+    // 挂起中的顶层任务数
+    size_t tasks();
+
+    // 以下由等待对象调用：登记后协程可能立即在主线程中被恢复，调用者不能再访问协程帧
+    // 等待fd上的事件，就绪的事件写入revents
+    void wait_fd(int fd, uint32_t events, std::coroutine_handle<> h, uint32_t *revents);
+    void wait_until(clock::time_point when, std::coroutine_handle<> h);
+    // 顶层任务结束
+    void forget(std::coroutine_handle<> h);
+
+private:
+    CoScheduler();
+    // 按最早的到期时间设置timerfd，调用时持有锁
+    void arm_timer();
+
+    struct Waiter {
+        std::coroutine_handle<> handle;
+        uint32_t *revents;
+    };
+    struct Timer {
+        clock::time_point when;
+        std::coroutine_handle<> handle;
+        bool operator>(const Timer &other) const { return when > other.when; }
+    };
+
+    int m_epfd = -1;
+    int m_timerfd = -1;
+    std::mutex m_mutex;
+    std::unordered_map<int, Waiter> m_waiters;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+    clock::time_point m_armed = clock::time_point::max();
+    // 未结束的顶层任务，退出时销毁
+    std::unordered_set<void *> m_tasks;
+};
+
+// co_await co_sleep(std::chrono::milliseconds(100))
+struct SleepAwaiter {
+    CoScheduler::clock::time_point when;
+    bool await_ready() const { return when <= CoScheduler::clock::now(); }
+    void await_suspend(std::coroutine_handle<> h) { CoScheduler::getInstance().wait_until(when, h); }
+    void await_resume() {}
+};
+
+inline SleepAwaiter co_sleep(std::chrono::milliseconds duration)
+{
+    return SleepAwaiter{CoScheduler::clock::now() + duration};
+}
+
+// co_await co_wait(fd, EPOLLIN)，返回就绪的事件，fd在等待期间不能注册在其他epoll上
+struct WaitAwaiter {
+    int fd;
+    uint32_t events;
+    uint32_t revents = 0;
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        CoScheduler::getInstance().wait_fd(fd, events, h, &revents);
+    }
+    uint32_t await_resume() const { return revents; }
+};
+
+inline WaitAwaiter co_wait(int fd, uint32_t events)
+{
+    return WaitAwaiter{fd, events};
+}
+
+// 先尝试一次非阻塞操作，返回EAGAIN时挂起到fd就绪后重试一次
+// 结果与对应的系统调用相同，失败时返回-1并设置errno
+template <typename Op>
+struct RetryAwaiter {
+    int fd;
+    uint32_t events;
+    Op op;
+    ssize_t result = 0;
+    uint32_t revents = 0;
+    bool suspended = false;
+
+    bool await_ready() {
+        result = op();
+        return !(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        suspended = true;
+        CoScheduler::getInstance().wait_fd(fd, events, h, &revents);
+    }
+    ssize_t await_resume() {
+        if (suspended)
+            result = op();
+        return result;
+    }
+};
+
+// 协程中使用的非阻塞TCP套接字，如上游连接
+class CoSocket {
+public:
+    CoSocket() {}
+    explicit CoSocket(int fd) : m_fd(fd) {}
+    CoSocket(CoSocket &&other) noexcept : m_fd(std::exchange(other.m_fd, -1)) {}
+    CoSocket(const CoSocket &) = delete;
+    CoSocket &operator=(const CoSocket &) = delete;
+    CoSocket &operator=(CoSocket &&) = delete;
+    ~CoSocket() { close(); }
+
+    int fd() const { return m_fd; }
+    void close();
+
+    // co_await sock.connect("127.0.0.1", 8080)，成功返回0
+    struct ConnectAwaiter {
+        CoSocket &sock;
+        const char *ip;
+        int port;
+        int result = 0;
+        uint32_t revents = 0;
+        bool pending = false;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> h) {
+            CoScheduler::getInstance().wait_fd(sock.m_fd, EPOLLOUT, h, &revents);
+        }
+        int await_resume();
+    };
+    ConnectAwaiter connect(const char *ip, int port) { return ConnectAwaiter{*this, ip, port}; }
+
+    // co_await sock.read(buf, len)，返回读到的字节数，0表示对方关闭
+    auto read(void *buf, size_t len) {
+        int fd = m_fd;
+        auto op = [fd, buf, len]() { return recv(fd, buf, len, 0); };
+        return RetryAwaiter<decltype(op)>{fd, EPOLLIN, op};
+    }
+    // co_await sock.send(buf, len)，返回写入的字节数，可能只写入一部分
+    auto send(const void *buf, size_t len) {
+        int fd = m_fd;
+        auto op = [fd, buf, len]() { return ::send(fd, buf, len, MSG_NOSIGNAL); };
+        return RetryAwaiter<decltype(op)>{fd, EPOLLOUT, op};
+    }
+
+private:
+    int m_fd = -1;
+};
+
+struct Request;
+struct Response;
+// 协程处理器，request和response在协程结束前保持有效
+using CoHandler = std::function<CoTask(const Request &, Response &)>;
+
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DISKIO_H
+#define DISKIO_H
+
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// 磁盘IO执行器：冷文件的路径查找、打开和读入页缓存在独立的线程中进行，主线程和工作线程不会因磁盘阻塞
+// 任务按提交顺序执行，停止时先执行完队列中已有的任务
+class DiskIO {
+public:
+    using Job = std::function<void()>;
+
+    static DiskIO &getInstance() {
+        static DiskIO io;
+        return io;
+    }
+    ~DiskIO();
+    DiskIO(const DiskIO &) = delete;
+    DiskIO &operator=(const DiskIO &) = delete;
+    DiskIO(DiskIO &&) = delete;
+    DiskIO &operator=(DiskIO &&) = delete;
+
+    // 启动线程，只能在服务器开始运行前调用一次，0表示关闭执行器
+    void start(unsigned threads);
+    // 执行完已提交的任务后结束线程
+    void stop();
+    bool enabled() const {
+        return m_threads.size() > 0;
+    }
+    unsigned threads() const {
+        return m_threads.size();
+    }
+    // 提交任务，执行器关闭或已停止时返回false
+    bool submit(Job job);
+    // 等待执行的任务数
+    size_t queued();
+
+private:
+    DiskIO() {}
+    void run();
+
+    std::vector<std::thread> m_threads;
+    std::deque<Job> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_shutdown = false;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef HANDLER_H
+#define HANDLER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <stddef.h>
+#include "coroutine.h"
+
+// 路由匹配到的路径参数，名称指向路由表，值指向请求的读缓冲区，不以'\0'结尾
+struct Params {
+    static const int MAX_PARAMS = 8;
+    struct Param {
+        const char *name;
+        const char *value;
+        size_t len;
+    };
+    Param items[MAX_PARAMS];
+    int count = 0;
+
+    // 按名称查找参数值，不存在时返回nullptr
+    const char *get(const char *name, size_t &len) const;
+    std::string str(const char *name) const {
+        size_t len;
+        const char *v = get(name, len);
+        return v ? std::string(v, len) : std::string();
+    }
+};
+
+// 请求的头部行，名称和值指向请求的读缓冲区，值以'\0'结尾，超出MAX_HEADERS的头部不记录
+struct Headers {
+    static const int MAX_HEADERS = 64;
+    struct Header {
+        const char *name;
+        size_t name_len;
+        const char *value;
+    };
+    Header items[MAX_HEADERS];
+    int count = 0;
+
+    // 按名称查找头部的值，不区分大小写，不存在时返回nullptr
+    const char *get(const char *name) const;
+};
+
+// 提供给处理器的请求信息，指针均指向连接的读缓冲区，仅在处理期间有效
+struct Request {
+    int method = 0;
+    const char *url = nullptr;
+    const char *host = nullptr;
+    bool keepalive = false;
+    // 客户端的IP地址
+    const char *remote = nullptr;
+    // 全部头部行，包括上面已解析的头部
+    Headers headers;
+    // Accept-Encoding中包含gzip
+    bool accept_gzip = false;
+    // If-None-Match头部的值，没有时为nullptr
+    const char *if_none_match = nullptr;
+    // POST/PUT的请求体，已解除chunked编码，长度不超过HTTPConn::m_max_body
+    const char *body = nullptr;
+    size_t body_len = 0;
+    // 路由模式中:name和*name捕获的参数
+    Params params;
+};
+
+// 流式响应的消息体生产者，每次调用向out追加下一段数据，返回false表示这是最后一段
+// 只在上一段全部写入套接字后才会再次调用，写缓存满时等待可写事件，生产速度受客户端接收速度约束
+// 追加空数据同样表示消息体结束；inline处理器的生产者在主线程中调用，不能阻塞
+using BodyWriter = std::function<bool(std::string &out)>;
+
+// 处理器生成的响应
+struct Response {
+    int status = 200;
+    const char *title = "OK";
+    // 为空时不添加Content-Type头部
+    const char *content_type = "text/html";
+    // 消息体，指向处理器自身持有的内存，在响应发送完成前需保持有效
+    const char *body = nullptr;
+    size_t body_len = 0;
+    // 动态生成的消息体，body为空时发送其内容
+    std::string owned;
+    // 重定向地址，非空时添加Location头部
+    const char *location = nullptr;
+    // 附加的头部行，每行以\r\n结尾，与其他头部一起不能超出连接的写缓冲区
+    std::string headers;
+    // 非空时忽略body和owned，以Transfer-Encoding: chunked逐段发送其生成的数据
+    BodyWriter stream;
+    // 流式响应的生产者出错时置为true，连接在已发送的数据之后直接关闭，客户端不会收到结束块
+    bool abort = false;
+};
+
+using Handler = std::function<void(const Request &, Response &)>;
+
+// 路由表，启动时将路由模式构建为压缩前缀树，运行期间的查找不分配内存
+// 路由模式以/开头，其中的段可以是：
+//   /users/:id      参数段，匹配到下一个/之前的非空内容
+//   /static/*path   通配段，只能位于末尾，匹配其后的全部内容（可以为空）
+// 同一位置按静态段、参数段、通配段的优先级匹配，失败时回溯
+// 标记为inline的处理器在主线程中直接应答，无需经过线程池；挂载的目录由HTTPConn映射文件后发送
+class HandlerTable {
+public:
+    struct Entry {
+        std::string path;
+        Handler handler;
+        bool isInline = false;
+        // 挂载的目录，非空时通配段捕获的路径映射到该目录下的文件
+        std::string root;
+        // 耗时或响应较大，在线程池中排入慢队列
+        bool costly = false;
+#ifdef MANGO_COROUTINES
+        // 协程处理器，非空时忽略handler
+        CoHandler async;
+#endif
+        bool is_mount() const {
+            return !root.empty();
+        }
+        bool is_async() const {
+#ifdef MANGO_COROUTINES
+            return static_cast<bool>(async);
+#else
+            return false;
+#endif
+        }
+    };
+
+    static HandlerTable &getInstance() {
+        static HandlerTable table;
+        return table;
+    }
+    HandlerTable(const HandlerTable &) = delete;
+    HandlerTable(HandlerTable &&) = delete;
+    HandlerTable &operator=(const HandlerTable &) = delete;
+    HandlerTable &operator=(HandlerTable &&) = delete;
+
+    // 以下注册函数只能在服务器开始运行前调用，运行期间的查找不加锁
+    // 注册处理器，阻塞或耗时的处理器需要将isInline置为false，交给线程池执行
+    // 生成大响应或执行时间较长的处理器将costly置为true，不会延迟排在其后的小请求
+    // 路由模式不合法，或同一位置的参数名与已注册的不同时返回false
+    bool add_handler(const std::string &path, Handler handler, bool isInline = true,
+                     bool costly = false);
+    // 注册固定内容的响应
+    void add_static(const std::string &path, const std::string &body,
+                    const char *content_type = "text/plain");
+    // 注册重定向
+    void add_redirect(const std::string &path, const std::string &location, int status = 302);
+    // 将文件读入内存后注册为固定响应，文件超过maxsize或读取失败时返回false
+    bool add_file(const std::string &path, const std::string &filename, size_t maxsize = 64 * 1024);
+#ifdef MANGO_COROUTINES
+    // 注册协程处理器，在挂起期间不占用任何线程，结束后发送response
+    // 处理器在持有连接的线程中开始执行，之后在主线程中恢复，两次挂起之间不能阻塞
+    bool add_async(const std::string &path, CoHandler handler);
+#endif
+    // 将目录挂载到路径前缀下，如mount("/static", "../root")使/static/a.png对应../root/a.png
+    // 交给线程池的文件请求需要映射文件或读取磁盘，排入慢队列
+    bool mount(const std::string &prefix, const std::string &dir);
+
+    // 查找url对应的处理器，忽略查询字符串，不存在时返回nullptr，查找过程不分配内存
+    // params非空时写入捕获的参数，挂载目录的文件路径为最后一个参数
+    const Entry *find(const char *url, Params *params = nullptr) const;
+
+private:
+    struct Node {
+        // 静态边的标签，根节点和参数节点为空
+        std::string prefix;
+        // 各静态子节点标签的首字符，与children一一对应
+        std::string indices;
+        std::vector<std::unique_ptr<Node>> children;
+        // 参数子节点及其参数名
+        std::unique_ptr<Node> param;
+        std::string name;
+        // 在该节点结束时匹配的处理器，及通配段的处理器和参数名，均为m_entries的下标
+        int entry = -1;
+        int wildcard = -1;
+        std::string wildcard_name;
+    };
+
+    HandlerTable() : m_root(new Node) {}
+    bool insert(const std::string &path, Entry entry);
+    const Entry *match(const Node *node, const char *url, Params *params) const;
+
+    std::unique_ptr<Node> m_root;
+    std::vector<Entry> m_entries;
+};
+
+// HTTPConn::METHOD对应的方法名
+const char *method_name(int method);
+
+// 根据文件扩展名推断Content-Type
+const char *mime_type(const char *filename);
+
+#endif
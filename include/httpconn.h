@@ -20,8 +20,15 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <unordered_map>
+#include <atomic>
 #include "threadpool.h"
 #include "utils.h"
+#include "handler.h"
+#include "accesslog.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "zerocopy.h"
 
 struct RepInfo {
     const char *title;
@@ -31,6 +38,8 @@ struct RepInfo {
 
 class HTTPConn
 {
+    // 微基准测试直接驱动解析器
+    friend class HTTPConnBench;
 public:
     // 支持的文件名最大长度
     static const int FILENAME_LEN = 200;
@@ -46,37 +55,128 @@ public:
     // 从状态机分析行的三种状态：读取完成，行数据错误和行不完整。
     enum LINE_STATUS {LINE_OK = 0, LINE_BAD, LINE_OPEN};
     // 处理结果：请求不完整， 获取到完整请求，错误请求，权限错误，服务器内部错误，客户端关闭连接，资源不存在，获取文件资源成功
+    // 头部解析完成但请求体尚未读取，上传完成，方法不被允许，请求体超出上限，协程处理器已开始执行
     enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, FORBIDDEN_REQUEST, 
-    INTERNAL_ERROR, CLOSED_CONNECTION, NO_RESOURCE, FILE_REQUEST};
+    INTERNAL_ERROR, CLOSED_CONNECTION, NO_RESOURCE, FILE_REQUEST, HANDLER_REQUEST,
+    BODY_REQUEST, UPLOAD_REQUEST, BAD_METHOD, TOO_LARGE, ASYNC_REQUEST};
+    // 异步任务（协程处理器或磁盘IO）的状态：未运行，开始执行的线程仍持有处理权，持有者已退出，任务已结束
+    enum ASYNC_STATE {ASYNC_IDLE, ASYNC_STARTING, ASYNC_PARKED, ASYNC_DONE};
+    // 请求体的去向：尚未确定，丢弃，交给处理器，写入上传文件
+    enum BODY_SINK {SINK_NONE, SINK_DISCARD, SINK_MEMORY, SINK_FILE};
+    // 请求体的解码状态：按Content-Length读取，chunked的块长度行、块数据、块后的CRLF、尾部字段，读取完成
+    enum BODY_STATE {BODY_IDENTITY, BODY_CHUNK_SIZE, BODY_CHUNK_DATA, BODY_CHUNK_CRLF,
+                     BODY_TRAILER, BODY_DONE};
+    // 一轮IO的结果：连接已关闭，无待处理数据，读到了新数据需要处理
+    enum IO_STATUS {IO_CLOSED, IO_IDLE, IO_READ};
+    // 处理权标志位，不与epoll返回的事件位冲突
+    static const uint32_t CONN_OWNED = 1u << 31;
 
 public:
     HTTPConn() {}
     ~HTTPConn() {}
 
 public:
-    // 初始化新接收的连接
-    void init(int sockfd, ACTOR_MODE amode = PROACTOR, TRI_MODE tmode = ET, bool oneshot = true);
+    // 初始化新接收的连接，连接固定使用ET模式
+    void init(int sockfd, ACTOR_MODE amode = PROACTOR);
     // 关闭连接
     void close_conn(bool real_close = true);
-    // 处理请求
+    // 处理请求：解析读入的数据，得到完整请求后生成并发送响应
     void process();
+    // 为解析完成的请求生成响应并开始发送，ret为process_read()的结果
+    void respond(HTTP_CODE ret);
     // 非阻塞读写
     bool read();
     bool write();
 
+    // 主线程投递epoll事件，返回true表示调用者获得了该连接的处理权，需要负责处理事件
+    // 否则事件已被记录，由当前持有者在释放处理权前处理
+    bool post_events(uint32_t ev) {
+        return m_pending.fetch_or(ev, std::memory_order_acq_rel) == 0;
+    }
+    // 持有者取出所有已投递的事件
+    uint32_t take_events() {
+        return m_pending.exchange(CONN_OWNED, std::memory_order_acq_rel) & ~CONN_OWNED;
+    }
+    // 尝试释放处理权，若期间有新事件到达则返回false，持有者需要继续处理
+    bool release() {
+        uint32_t expected = CONN_OWNED;
+        return m_pending.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+    }
+    // 处理一轮事件：继续发送未完成的响应，然后读取新数据
+    // 缓冲区中留有流水线请求时同样返回IO_READ
+    IO_STATUS handle_io(uint32_t ev);
+    // PROACTOR模式下由主线程调用，读入并解析请求，可以在主线程完成的请求直接应答
+    // 返回true表示得到了需要工作线程处理的完整请求，处理权随任务移交给工作线程
+    bool reactor_io();
+    // 工作线程持有处理权时的事件循环，parsed表示主线程已解析出待响应的完整请求
+    void run(bool parsed);
+    // 移交处理权前由主线程调用，根据已知的请求信息选择线程池的队列
+    ThreadPool::LANE lane(bool parsed) const;
+    // 当前请求的追踪id，0表示未被采样
+    uint64_t trace_id() const { return m_trace_id; }
+
 private:
-    // 初始化连接
+    // 初始化连接，保留已读入的下一个流水线请求
     void init();
-    // 解析HTTP
+    // 取出并清除流水线请求标志
+    bool take_pipelined() {
+        bool pipelined = m_pipelined;
+        m_pipelined = false;
+        return pipelined;
+    }
+    // 解析HTTP，得到完整请求时返回GET_REQUEST，不处理请求
     HTTP_CODE process_read();
+    // 按url查找路由，记录捕获的参数
+    void route() {
+        m_handler = HandlerTable::getInstance().find(m_url, &m_params);
+    }
+    void fill_request(Request &req);
+    // 调用注册的处理器生成响应
+    HTTP_CODE do_handler();
+    bool parked() const {
+        return m_async.load(std::memory_order_acquire) != ASYNC_IDLE;
+    }
+    // 持有者在异步任务执行期间退出，任务若已结束则由本线程继续
+    void park();
+    // 异步任务结束后发送响应，放弃处理权并重新注册连接，期间到达的事件由epoll再次通知
+    void finish_async();
+    // 异步任务结束，在开始执行它的线程、主线程或磁盘IO线程中调用
+    void async_done();
+    // 异步任务结束后生成的响应类型
+    HTTP_CODE m_async_code = HANDLER_REQUEST;
+#ifdef MANGO_COROUTINES
+    HTTP_CODE do_async();
+    // 协程挂起期间保持有效的请求信息
+    Request m_async_req;
+#endif
     // 填充HTTP应答
     bool process_write(HTTP_CODE ret);
 
     // 有限状态机分析HTTP请求，用于process_read()
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    // 请求体由工作线程读取，读完后生成响应
+    void process_body();
+    bool reading_body() const {
+        return m_check_state == CHECK_STATE_CONTENT && m_body_state != BODY_DONE;
+    }
+    // 根据请求确定请求体的去向，返回NO_REQUEST表示可以开始读取
+    HTTP_CODE begin_body();
+    // 从缓冲区和套接字读取请求体，读完返回响应类型，套接字暂无数据时返回NO_REQUEST
+    HTTP_CODE read_body();
+    // 解码读缓冲区中请求体区域的数据
+    HTTP_CODE decode_body();
+    // identity编码的上传经管道从套接字直接移入文件，数据不经过用户态
+    HTTP_CODE splice_body();
+    // 将一段请求体交给其去向
+    HTTP_CODE consume_body(const char *data, size_t len);
+    HTTP_CODE finish_body();
+    // 关闭上传文件和管道，未完成的上传删除临时文件
+    void reset_body();
+    // 将挂载目录下的文件内存映射，文件可能需要读盘时交给磁盘IO执行器并返回ASYNC_REQUEST
     HTTP_CODE do_request();
+    // 打开并映射m_real_file，cached为true时不阻塞，路径或内容不在缓存中时返回ASYNC_REQUEST
+    HTTP_CODE open_file(bool cached);
     char *get_line() 
     {
         return m_read_buf + m_start_line;
@@ -89,23 +189,38 @@ private:
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
-    bool add_content_type();
+    bool add_content_type(const char *type = "text/html");
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    // 消息体是否以零拷贝发送，首次使用时为连接开启SO_ZEROCOPY
+    bool use_zerocopy(size_t len);
+    // 头部照常复制发送，之后以MSG_ZEROCOPY发送消息体，返回值与writev相同
+    ssize_t send_zerocopy();
+    // 响应结束时保留仍可能被内核引用的消息体
+    void zc_retain();
+    // 读取完成通知并释放已完成的缓冲区
+    void zc_reap();
+    // 向流式响应的生产者请求下一段数据，按chunked编码组织iovec，生产者出错时返回false
+    bool next_chunk();
+    // 响应发送结束后记录访问日志和运行指标
+    void finish_request();
 
 public:
     // epoll文件描述符
     static EpollControl &m_epoller;
-    // 用户数量
-    static int m_user_count;
+    // 用户数量，主线程和工作线程都会修改
+    static std::atomic<int> m_user_count;
+    // 平滑升级后旧进程排空连接，此后的响应都不再保持连接
+    static std::atomic<bool> m_draining;
+    // 上传目录，为空时不接受上传；PUT或POST /upload/<name>写入其中的同名文件，启动时设置
+    static std::string m_upload_dir;
+    // 交给处理器的请求体和上传文件的大小上限，超出时返回413
+    static std::atomic<uint64_t> m_max_body;
+    static std::atomic<uint64_t> m_max_upload;
 
     // 事件处理模式
     ACTOR_MODE m_actor_mode;
-    // 触发模式
-    TRI_MODE m_tri_mode;
-    // oneshot模式
-    bool m_oneshot = false;
 
 private:
     // 当前连接的socket和对应地址信息
@@ -116,13 +231,24 @@ private:
     int m_read_idx = 0;
     int m_checked_idx = 0;
     int m_start_line = 0;
+    // 上一个响应发送完成时，缓冲区中已有下一个请求的数据
+    bool m_pipelined = false;
+    // 上次读取因缓冲区已满而停止，套接字中可能还有未读的数据
+    bool m_read_more = false;
     // 写缓冲区
     char m_write_buf[WRITE_BUFFER_SIZE];
     // 标识写缓冲区中待发送的数据
     int m_write_idx = 0;
+    // 响应中待发送和已发送的字节数，跨越多次EPOLLOUT事件
+    int m_bytes_to_send = 0;
+    int m_bytes_have_send = 0;
+    // 待处理的epoll事件及处理权标志，非0时表示已有线程持有该连接
+    std::atomic<uint32_t> m_pending{0};
+    // 异步任务执行期间处理权由任务保留，结束时由后到的一方生成响应
+    std::atomic<int> m_async{ASYNC_IDLE};
 
     // 主状态机状态标识
-    CHECK_STATE m_check_state;
+    CHECK_STATE m_check_state = CHECK_STATE_REQUESTLINE;
     METHOD m_method;
 
     // 客户请求的完整路径
@@ -133,30 +259,84 @@ private:
     char *m_version = NULL;
     // 主机名
     char *m_host = NULL;
+    // 客户端接受gzip编码，及If-None-Match的值
+    bool m_accept_gzip = false;
+    char *m_if_none_match = NULL;
+    // 全部头部行，以及客户端的IP地址
+    Headers m_headers;
+    char m_remote[INET6_ADDRSTRLEN] = "";
     // 消息体长度
-    int m_content_length;
+    long long m_content_length = 0;
+    // 请求体采用chunked编码
+    bool m_chunked = false;
+    // 客户端等待100 Continue后才发送请求体
+    bool m_expect_continue = false;
     // 保持连接Keep_alive
     bool m_linger;
     
+    // 请求体的去向和解码状态
+    BODY_SINK m_body_sink = SINK_NONE;
+    BODY_STATE m_body_state = BODY_IDENTITY;
+    // 读缓冲区中请求体区域的起始位置，之前为请求行和头部，解析出的字符串仍指向其中
+    int m_body_start = 0;
+    // 当前块（identity编码时为整个请求体）未读的字节数，已接收的字节数及其上限
+    uint64_t m_body_left = 0;
+    uint64_t m_body_received = 0;
+    uint64_t m_body_limit = 0;
+    // 交给处理器的请求体
+    std::string m_body;
+    // 上传文件的描述符、临时文件和最终路径，以及splice使用的管道
+    int m_upload_fd = -1;
+    std::string m_upload_tmp;
+    std::string m_upload_path;
+    int m_pipe[2] = {-1, -1};
+
+    // 匹配到的路由及其参数，以及处理器生成的响应
+    const HandlerTable::Entry *m_handler = nullptr;
+    Params m_params;
+    Response m_response;
+
     // 客户请求文件的内存映射地址
     char *m_file_address = NULL;
     // 目标文件的状态
     struct stat m_file_stat;
     // writev函数需要的数据结构，后者指示被写内存块的数量
-    struct iovec m_iv[2];
+    // 流式响应的一段为块长度、数据、CRLF，最后一段之后还有终止块
+    struct iovec m_iv[4];
     int m_iv_count = 0;
+    // 零拷贝发送的状态：已开启SO_ZEROCOPY，不再使用零拷贝，下一次发送的序号，下一个未完成的序号
+    bool m_zc_on = false;
+    bool m_zc_off = false;
+    uint32_t m_zc_seq = 0;
+    uint32_t m_zc_done = 0;
+    // 当前响应的消息体以零拷贝发送，及是否已有发送引用了它
+    bool m_zc_body = false;
+    bool m_zc_used = false;
+    // 尚未收到完成通知的缓冲区
+    ZeroCopy::Holds m_zc_holds;
+    // 流式响应当前段的数据和块长度行
+    std::string m_chunk;
+    char m_chunk_head[24];
+
+    // 当前请求的访问记录，accept和reuse跨越连接上的多个请求
+    AccessEntry m_access;
+    uint64_t m_trace_id = 0;
+    // 流量捕获中的连接编号，0表示未捕获
+    uint32_t m_capture_id = 0;
 };
 
 // 继承自线程池任务类的网络连接任务类，重写接口
 class HTTPReq: public WorkRequest {
 public:
-    enum STATE{ READ, WRITE, NONE};
-    HTTPReq(std::shared_ptr<HTTPConn> _httpcon, STATE _state = NONE) 
+    // EVENTS: 由工作线程处理连接上所有待处理事件（REACTOR）
+    // PARSED: 主线程已解析出完整请求，工作线程先生成响应（PROACTOR）
+    enum STATE{ EVENTS, PARSED };
+    HTTPReq(std::shared_ptr<HTTPConn> _httpcon, STATE _state = EVENTS) 
     : m_httpconn(_httpcon), m_state(_state) {}
     bool do_request() override;
 private:
     std::shared_ptr<HTTPConn> m_httpconn;
-    STATE m_state = NONE;
+    STATE m_state = EVENTS;
 };
 
 // 连接管理类
@@ -173,7 +353,7 @@ public:
     ConnHandler(ConnHandler &&) = delete;
     ConnHandler &operator=(const ConnHandler &) = delete;
     ConnHandler &operator=(ConnHandler &&) = delete;
-    // 添加一个连接，成功返回对应智能指针，失败返回nullptr
+    // 添加一个连接，返回对应智能指针；fd被复用时替换已关闭的旧连接
     std::shared_ptr<HTTPConn> add_conn(int connfd);
     // 查找一个连接，成功返回对应智能指针，不存在则返回nullptr
     std::shared_ptr<HTTPConn> find_conn(int connfd);
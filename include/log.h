@@ -4,21 +4,41 @@
 #ifndef LOG_H
 #define LOG_H
 
-#include <fstream>
 #include <iostream>
 #include <cstdio>
-#include <future>
 #include <mutex>
 #include <condition_variable>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <time.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <type_traits>
+#include "ringbuffer.h"
+#include "logformat.h"
+
+// 编译期的最低日志级别，级别高于它的日志调用被编译为空函数，参数也不会被格式化
+// 取值与Log::LOG_LEVEL相同：0为ERROR，3为INFO（全部输出）
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 3
+#endif
 
 class Log {
 public:
     using size_t = unsigned;
     enum LOG_LEVEL {ERROR, WARN, DEBUG, INFO};
+    // 日志所属模块，每个模块可以单独设置运行时级别
+    enum LOG_MODULE {GENERAL, NET, HTTP, POOL, MODULE_NUM};
+    // 异步模式下线程日志缓冲区写满时的策略：丢弃新日志并计数，或等待后台线程腾出空间
+    enum OVERFLOW_POLICY {DROP, BLOCK};
     static Log &getInstance()
     {
         static Log logger;
@@ -32,7 +52,7 @@ public:
     Log(Log &&) = delete;
     Log &operator=(Log &&) = delete;
 
-    // 用于配置日志属性
+    // 用于配置日志属性，cachetime为异步线程的最长刷新间隔（毫秒）
     void config(const std::string &dir, const std::string &name, bool isAsync, size_t maxitems,
                 bool split, size_t maxlength, size_t cachetime, size_t cachesize, bool print);
     // 设置异步日志，只能在异步线程启动前进行配置
@@ -47,20 +67,95 @@ public:
     void setPrint() noexcept {
         m_isPrint = true;
     }
-    // 写日志函数
+    // 设置缓冲区写满时的策略
+    void setOverflow(OVERFLOW_POLICY policy) noexcept {
+        m_overflow = policy;
+    }
+    // 设置每个线程日志缓冲区的字节数，只影响之后创建的缓冲区
+    void setRingSize(size_t bytes) noexcept {
+        m_rings.set_ringsize(bytes);
+    }
+    // 设置二进制日志，只记录格式串id、时间戳和原始参数，由tools/logdecode离线格式化
+    // 需要在写入第一条日志前设置，二进制模式下不打印到标准输出
+    void setBinary() noexcept {
+        if (m_binary)
+            return;
+        m_binary = true;
+        // 已打开的文本日志文件不再写入，下一次写入时打开带文件头的二进制文件
+        if (m_fd != -1) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+    // 修改日志文件名，只能在异步线程启动前调用；多进程模式下每个工作进程使用各自的文件
+    // 已打开的文件（如fork前主进程打开的）不再写入，下一次写入时按新文件名打开
+    void setName(const std::string &name) {
+        m_name = name;
+        m_curfileidx = 1;
+        if (m_fd != -1) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+    // 运行时级别检查，只有一次relaxed原子读
+    static bool enabled(LOG_MODULE module, LOG_LEVEL lv);
+    // 设置模块的运行时级别，级别不高于lv的日志被输出
+    static void setLevel(LOG_LEVEL lv, LOG_MODULE module);
+    // 设置所有模块的运行时级别
+    static void setLevel(LOG_LEVEL lv);
+    // 解析级别配置，如"warn"或"warn,net=info,http=error"，格式错误时返回false
+    static bool setLevels(const std::string &spec);
+    // 当前各模块的级别，格式与setLevels相同，如"general=info,net=warn,http=info,pool=info"
+    static std::string getLevels();
+    // 写日志函数，fmt需要具有静态存储期，二进制模式下以其地址作为格式串id
     template <typename... Args>
-    void write_log(LOG_LEVEL lv, const std::string &fmt, Args &&...args);
-
-    // 重载<<运算符
+    void write_log(LOG_LEVEL lv, const char *fmt, Args &&...args);
 
 private:
+    // 每个写日志线程独占的缓冲区，由后台线程消费
+    using ThreadRing = ThreadRings::Slot;
+
+    // 每个线程已写入定义记录的格式串集合，使用开放寻址，装满后不再插入（每次都写定义）
+    struct FormatSet {
+        static const size_t SLOTS = 512;
+        const char *slots[SLOTS] = {};
+        size_t count = 0;
+        // 查找fmt，不存在时返回可插入的槽位，集合已满时返回nullptr
+        const char **find(const char *fmt, bool &found);
+    };
+
     Log() { }
+    // 写入一条记录，fill(buf)向最多cap字节的buf中填充记录并返回实际长度
+    // 异步模式下写入本线程的缓冲区，同步模式下直接写文件，缓冲区满而丢弃时返回false
+    template <typename F>
+    bool put_record(size_t cap, F fill);
+    // 格式化一条日志，返回写入buf的长度（包含换行符）
+    template <typename... Args>
+    size_t format_line(char *buf, size_t cap, LOG_LEVEL lv, const char *fmt, Args &&...args);
+    // 以二进制格式记录一条日志
+    template <typename... Args>
+    void write_binary(LOG_LEVEL lv, const char *fmt, Args &&...args);
+    // 向buf中写入格式串的定义记录，返回记录长度
+    static size_t format_record(char *buf, LOG_LEVEL lv, const char *fmt, size_t fmtlen);
+    // 生成日志前缀（级别和时间），每个线程缓存当前秒的时间字符串
+    size_t format_prefix(char *buf, size_t cap, LOG_LEVEL lv);
+    // 线程私有的数据，放在非模板函数中保证每个线程只有一份
+    static std::vector<char> &local_line();
+    static FormatSet &local_formats();
+    static uint32_t local_tid();
     // 保存日志文件，另开线程保证一直在工作
     static void asyncWork();
     void asyncSave();
-    void syncSave(const std::string &);
+    // 将一个线程缓冲区中的日志批量写入文件
+    void drain(ThreadRing *tr);
+    // 同步写入若干条日志，必要时打开或切换日志文件
+    void save(const struct iovec *iov, int cnt);
+    bool open_file();
 
+    // 同步模式下保护文件写入
     std::mutex m_mutex;
+    // 后台线程等待和退出使用
+    std::mutex m_async_mutex;
     std::condition_variable m_cv;
 
     // 日志的路径和文件名
@@ -77,161 +172,611 @@ private:
     // 日志写入的最大缓存数和缓存时间
     size_t m_cachesize = 5;
     size_t m_cachetime = 30;
-    // 日志缓冲区
-    std::vector<std::string> m_cache;
+    // 写满时的策略
+    OVERFLOW_POLICY m_overflow = DROP;
+    // 二进制日志开关
+    bool m_binary = false;
+    // 所有线程用过的格式串，每个新的二进制文件开头重新写入其定义，使文件可以单独解码
+    std::mutex m_formats_mutex;
+    std::vector<const char *> m_formats;
+    // 所有线程的日志缓冲区，线程退出后保留以便复用
+    ThreadRings m_rings;
     // 是否同步输出到标准输出
     bool m_isPrint = false;
     // 异步保存线程
     std::thread m_thread;
     bool m_shutdown = false;
-    // 目前打开的日志文件及已经写入的日志条目数
-    std::fstream m_curfile;
+    // 目前打开的日志文件
+    int m_fd = -1;
     // 当前日志的条目数和分文件的编号
     size_t m_curlogidx = 0;
     size_t m_curfileidx = 1;
 };
 
-template <typename... Args>
-void LOG_ERROR(const std::string &fmt, Args &&...args) {
-    Log::getInstance().write_log(Log::ERROR, fmt, std::forward<Args>(args)...);
+// 各模块的运行时级别，使用类模板的静态成员使其可以定义在头文件中，且在编译期完成初始化
+template <typename T = void>
+struct LogLevels {
+    static std::atomic<int> levels[Log::MODULE_NUM];
+    static const char *const level_names[4];
+    static const char *const module_names[Log::MODULE_NUM];
+};
+template <typename T>
+std::atomic<int> LogLevels<T>::levels[Log::MODULE_NUM] = {{Log::INFO}, {Log::INFO}, {Log::INFO}, {Log::INFO}};
+template <typename T>
+const char *const LogLevels<T>::level_names[4] = {"error", "warn", "debug", "info"};
+template <typename T>
+const char *const LogLevels<T>::module_names[Log::MODULE_NUM] = {"general", "net", "http", "pool"};
+static_assert(Log::MODULE_NUM == 4, "LogLevels initializer must cover every module");
+
+inline bool Log::enabled(LOG_MODULE module, LOG_LEVEL lv)
+{
+    return lv <= LogLevels<>::levels[module].load(std::memory_order_relaxed);
 }
 
-template <typename... Args>
-void LOG_INFO(const std::string &fmt, Args &&...args)
+inline void Log::setLevel(LOG_LEVEL lv, LOG_MODULE module)
 {
-    Log::getInstance().write_log(Log::INFO, fmt, std::forward<Args>(args)...);
+    LogLevels<>::levels[module].store(lv, std::memory_order_relaxed);
 }
 
-template <typename... Args>
-void LOG_WARN(const std::string &fmt, Args &&...args)
+inline void Log::setLevel(LOG_LEVEL lv)
 {
-    Log::getInstance().write_log(Log::WARN, fmt, std::forward<Args>(args)...);
+    for (int m = 0; m < MODULE_NUM; ++m)
+        setLevel(lv, (LOG_MODULE)m);
 }
 
-template <typename... Args>
-void LOG_DEBUG(const std::string &fmt, Args &&...args)
+inline bool Log::setLevels(const std::string &spec)
+{
+    const char *const *level_names = LogLevels<>::level_names;
+    const char *const *module_names = LogLevels<>::module_names;
+    auto find = [](const char *const *names, int cnt, const std::string &name) {
+        for (int i = 0; i < cnt; ++i) {
+            if (strcasecmp(names[i], name.c_str()) == 0)
+                return i;
+        }
+        return -1;
+    };
+    // 先完整解析，全部合法后再生效
+    std::vector<std::pair<int, int>> settings;
+    std::string::size_type start = 0;
+    while (start <= spec.size()) {
+        std::string::size_type end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(start, end - start);
+        std::string::size_type eq = item.find('=');
+        int module = -1;
+        if (eq != std::string::npos) {
+            module = find(module_names, MODULE_NUM, item.substr(0, eq));
+            if (module == -1)
+                return false;
+            item = item.substr(eq + 1);
+        }
+        int lv = find(level_names, 4, item);
+        if (lv == -1)
+            return false;
+        settings.emplace_back(module, lv);
+        start = end + 1;
+    }
+    for (auto &st : settings) {
+        if (st.first == -1)
+            setLevel((LOG_LEVEL)st.second);
+        else
+            setLevel((LOG_LEVEL)st.second, (LOG_MODULE)st.first);
+    }
+    return true;
+}
+
+inline std::string Log::getLevels()
+{
+    std::string spec;
+    for (int m = 0; m < MODULE_NUM; ++m) {
+        if (m)
+            spec += ',';
+        spec += LogLevels<>::module_names[m];
+        spec += '=';
+        spec += LogLevels<>::level_names[LogLevels<>::levels[m].load(std::memory_order_relaxed)];
+    }
+    return spec;
+}
+
+// 编译期被关闭的级别使用空的特化，调用被完全消除
+template <bool Compiled>
+struct LogCall {
+    template <Log::LOG_LEVEL LV, Log::LOG_MODULE M, typename... Args>
+    static void write(const char *fmt, Args &&...args) {
+        if (Log::enabled(M, LV))
+            Log::getInstance().write_log(LV, fmt, std::forward<Args>(args)...);
+    }
+};
+template <>
+struct LogCall<false> {
+    template <Log::LOG_LEVEL LV, Log::LOG_MODULE M, typename... Args>
+    static void write(const char *, Args &&...) {}
+};
+
+// 格式串只接受字符数组（字符串字面量），其地址在整个运行期间有效，可作为二进制日志的格式串id
+// 模块通过模板参数指定，如LOG_INFO<Log::NET>("handle sockfd: %d", fd)
+template <Log::LOG_MODULE M = Log::GENERAL, Log::size_t N, typename... Args>
+void LOG_ERROR(const char (&fmt)[N], Args &&...args) {
+    LogCall<Log::ERROR <= LOG_COMPILE_LEVEL>::template write<Log::ERROR, M>(fmt, std::forward<Args>(args)...);
+}
+
+template <Log::LOG_MODULE M = Log::GENERAL, Log::size_t N, typename... Args>
+void LOG_INFO(const char (&fmt)[N], Args &&...args)
 {
-    Log::getInstance().write_log(Log::DEBUG, fmt, std::forward<Args>(args)...);
+    LogCall<Log::INFO <= LOG_COMPILE_LEVEL>::template write<Log::INFO, M>(fmt, std::forward<Args>(args)...);
+}
+
+template <Log::LOG_MODULE M = Log::GENERAL, Log::size_t N, typename... Args>
+void LOG_WARN(const char (&fmt)[N], Args &&...args)
+{
+    LogCall<Log::WARN <= LOG_COMPILE_LEVEL>::template write<Log::WARN, M>(fmt, std::forward<Args>(args)...);
+}
+
+template <Log::LOG_MODULE M = Log::GENERAL, Log::size_t N, typename... Args>
+void LOG_DEBUG(const char (&fmt)[N], Args &&...args)
+{
+    LogCall<Log::DEBUG <= LOG_COMPILE_LEVEL>::template write<Log::DEBUG, M>(fmt, std::forward<Args>(args)...);
+}
+
+// 热路径日志的采样：每n次调用记录一次，在调用点声明为静态对象
+class LogSampler {
+public:
+    explicit LogSampler(unsigned n): m_n(n ? n : 1) {}
+    bool allow() {
+        return m_count.fetch_add(1, std::memory_order_relaxed) % m_n == 0;
+    }
+private:
+    const unsigned m_n;
+    std::atomic<unsigned> m_count{0};
+};
+
+// 热路径日志的限流：每秒最多记录n条，在调用点声明为静态对象
+class LogRateLimiter {
+public:
+    explicit LogRateLimiter(unsigned n): m_n(n) {}
+    bool allow() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        long sec = m_sec.load(std::memory_order_relaxed);
+        // 进入新的一秒时由一个线程重置计数
+        if (ts.tv_sec != sec && m_sec.compare_exchange_strong(sec, ts.tv_sec, std::memory_order_relaxed))
+            m_count.store(0, std::memory_order_relaxed);
+        return m_count.fetch_add(1, std::memory_order_relaxed) < m_n;
+    }
+private:
+    const unsigned m_n;
+    std::atomic<long> m_sec{0};
+    std::atomic<unsigned> m_count{0};
+};
+
+// 经过采样或限流的日志，先检查级别，再由limiter决定是否记录
+// 如：static LogSampler sampler(1024); LOG_LIMITED<Log::INFO, Log::NET>(sampler, "handle sockfd: %d", fd);
+template <Log::LOG_LEVEL LV, Log::LOG_MODULE M = Log::GENERAL, typename Limiter, Log::size_t N, typename... Args>
+void LOG_LIMITED(Limiter &limiter, const char (&fmt)[N], Args &&...args)
+{
+    if (LV <= LOG_COMPILE_LEVEL && Log::enabled(M, LV) && limiter.allow())
+        Log::getInstance().write_log(LV, fmt, std::forward<Args>(args)...);
 }
 
 inline void Log::config(const std::string &dir, const std::string &name, bool isAsync,
-                 size_t maxitems, bool split, size_t maxlength, 
+                 size_t maxitems, bool split, size_t maxlength,
                  size_t cachetime, size_t cachesize, bool print)
 {
     m_dir = dir;
     m_name = name;
-    m_async = isAsync;
     m_maxlogitems = maxitems;
     m_isSplit = split;
     m_maxlength = maxlength;
     m_cachetime = cachetime;
     m_cachesize = cachesize;
     m_isPrint = print;
-    m_cache.reserve(m_cachesize + 5);
+    if (isAsync)
+        setAsync();
+}
+
+inline Log::size_t Log::format_prefix(char *buf, size_t cap, LOG_LEVEL lv)
+{
+    static const char *const prefix[] = {"[Error] ", "[Warn] ", "[Debug] ", "[Info] "};
+    // localtime开销较大，同一秒内复用已生成的时间字符串
+    thread_local time_t last_sec = 0;
+    thread_local char curtime[50];
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != last_sec) {
+        tm tmt;
+        localtime_r(&ts.tv_sec, &tmt);
+        snprintf(curtime, sizeof curtime, "%d/%d/%d %02d:%02d:%02d ",
+                 tmt.tm_year + 1900, tmt.tm_mon + 1, tmt.tm_mday,
+                 tmt.tm_hour, tmt.tm_min, tmt.tm_sec);
+        last_sec = ts.tv_sec;
+    }
+    size_t len = snprintf(buf, cap, "%s%s", prefix[lv], curtime);
+    return len < cap ? len : cap - 1;
 }
 
 template <typename... Args>
-void Log::write_log(Log::LOG_LEVEL lv, const std::string &fmt, Args &&...args)
-{
-    std::lock_guard<std::mutex> lg(m_mutex);
-    // 若缓冲区满，则加入当前日志，并唤醒保存线程腾空缓冲区
-    char tmp[m_maxlength];
-    sprintf(tmp, fmt.c_str(), args...);
-    std::string t(tmp);
-    std::string pre;
-    switch(lv) {
-        case(INFO): {
-            pre = "[Info] ";
-            break;
+Log::size_t Log::format_line(char *buf, size_t cap, LOG_LEVEL lv, const char *fmt, Args &&...args)
+{
+    // 预留换行符的位置
+    size_t len = format_prefix(buf, cap - 1, lv);
+    int n = snprintf(buf + len, cap - 1 - len, fmt, args...);
+    if (n > 0)
+        len += (size_t)n < cap - 1 - len ? n : cap - 2 - len;
+    buf[len++] = '\n';
+    return len;
+}
+
+template <typename F>
+bool Log::put_record(size_t cap, F fill)
+{
+    if (!m_async) {
+        std::vector<char> &line = local_line();
+        line.resize(cap);
+        struct iovec iov = {line.data(), fill(line.data())};
+        std::lock_guard<std::mutex> lg(m_mutex);
+        save(&iov, 1);
+        return true;
+    }
+    // 异步模式直接写入本线程的缓冲区中，不加锁
+    ThreadRing *tr = m_rings.local();
+    char *buf = tr->ring.reserve(cap);
+    while (!buf) {
+        if (m_overflow == DROP) {
+            tr->dropped.fetch_add(1, std::memory_order_relaxed);
+            m_cv.notify_one();
+            return false;
         }
-        case(WARN): {
-            pre = "[Warn] ";
-            break;
+        m_cv.notify_one();
+        std::this_thread::yield();
+        buf = tr->ring.reserve(cap);
+    }
+    size_t used = tr->ring.used();
+    tr->ring.commit(fill(buf));
+    // 缓冲区超过半满时提前唤醒后台线程，否则等待其定时刷新
+    if (used < tr->ring.capacity() / 2 && tr->ring.used() >= tr->ring.capacity() / 2)
+        m_cv.notify_one();
+    return true;
+}
+
+template <typename... Args>
+void Log::write_log(Log::LOG_LEVEL lv, const char *fmt, Args &&...args)
+{
+    if (m_binary) {
+        write_binary(lv, fmt, std::forward<Args>(args)...);
+        return;
+    }
+    // 前缀最长约40字节，加上消息和换行符
+    size_t cap = m_maxlength + 64;
+    put_record(cap, [&](char *buf) {
+        return format_line(buf, cap, lv, fmt, std::forward<Args>(args)...);
+    });
+}
+
+// 二进制日志的参数编码，整数统一扩展为64位，字符串需要立即拷贝
+namespace logbin {
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+arg_size(T, size_t) {
+    return 9;
+}
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, size_t>::type arg_size(T, size_t) {
+    return 9;
+}
+inline size_t arg_size(const void *, size_t) {
+    return 9;
+}
+inline size_t arg_size(const char *s, size_t maxlen) {
+    size_t len = s ? strnlen(s, maxlen) : 6;
+    return 5 + len;
+}
+inline size_t arg_size(const std::string &s, size_t maxlen) {
+    return 5 + (s.size() < maxlen ? s.size() : maxlen);
+}
+
+template <typename T>
+inline void put_raw(char *&p, uint8_t tag, T v) {
+    *p++ = tag;
+    memcpy(p, &v, sizeof v);
+    p += sizeof v;
+}
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value>::type put_arg(char *&p, T v, size_t) {
+    if (std::is_signed<T>::value)
+        put_raw(p, ARG_INT, (int64_t)v);
+    else
+        put_raw(p, ARG_UINT, (uint64_t)v);
+}
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value>::type put_arg(char *&p, T v, size_t) {
+    put_raw(p, ARG_INT, (int64_t)v);
+}
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type put_arg(char *&p, T v, size_t) {
+    put_raw(p, ARG_DOUBLE, (double)v);
+}
+inline void put_arg(char *&p, const void *v, size_t) {
+    put_raw(p, ARG_PTR, (uint64_t)(uintptr_t)v);
+}
+inline void put_str(char *&p, const char *s, uint32_t len) {
+    put_raw(p, ARG_STR, len);
+    memcpy(p, s, len);
+    p += len;
+}
+inline void put_arg(char *&p, const char *s, size_t maxlen) {
+    if (!s)
+        put_str(p, "(null)", 6);
+    else
+        put_str(p, s, strnlen(s, maxlen));
+}
+inline void put_arg(char *&p, const std::string &s, size_t maxlen) {
+    put_str(p, s.data(), s.size() < maxlen ? s.size() : maxlen);
+}
+
+}
+
+inline std::vector<char> &Log::local_line()
+{
+    thread_local std::vector<char> line;
+    return line;
+}
+
+inline Log::FormatSet &Log::local_formats()
+{
+    thread_local FormatSet formats;
+    return formats;
+}
+
+inline uint32_t Log::local_tid()
+{
+    thread_local uint32_t tid = syscall(SYS_gettid);
+    return tid;
+}
+
+inline const char **Log::FormatSet::find(const char *fmt, bool &found)
+{
+    size_t idx = (size_t)(((uintptr_t)fmt >> 3) * 0x9E3779B97F4A7C15ull >> 55) % SLOTS;
+    for (size_t i = 0; i < SLOTS; ++i, idx = (idx + 1) % SLOTS) {
+        if (slots[idx] == fmt) {
+            found = true;
+            return &slots[idx];
         }
-        case(ERROR): {
-            pre = "[Error] ";
-            break;
+        if (!slots[idx]) {
+            found = false;
+            // 保留四分之一的空槽，保证探测长度
+            return count < SLOTS * 3 / 4 ? &slots[idx] : nullptr;
         }
-        case(DEBUG): {
-            pre = "[Debug] ";
-            break;
+    }
+    found = false;
+    return nullptr;
+}
+
+inline Log::size_t Log::format_record(char *buf, LOG_LEVEL lv, const char *fmt, size_t fmtlen)
+{
+    using namespace logbin;
+    FormatRecord rec = {{(uint32_t)(sizeof rec + fmtlen), FORMAT, (uint8_t)lv, 0, 0},
+                        (uint64_t)(uintptr_t)fmt};
+    memcpy(buf, &rec, sizeof rec);
+    memcpy(buf + sizeof rec, fmt, fmtlen);
+    return rec.hdr.len;
+}
+
+template <typename... Args>
+void Log::write_binary(LOG_LEVEL lv, const char *fmt, Args &&...args)
+{
+    using namespace logbin;
+    FormatSet &formats = local_formats();
+    // 本线程首次使用该格式串时，先写入定义记录
+    bool found;
+    const char **slot = formats.find(fmt, found);
+    if (!found) {
+        // 先登记再入队：引用它的日志若落入之后的文件，该文件开头一定已有定义
+        {
+            std::lock_guard<std::mutex> lg(m_formats_mutex);
+            if (std::find(m_formats.begin(), m_formats.end(), fmt) == m_formats.end())
+                m_formats.push_back(fmt);
+        }
+        size_t fmtlen = strlen(fmt);
+        bool ok = put_record(sizeof(FormatRecord) + fmtlen, [&](char *buf) {
+            return format_record(buf, lv, fmt, fmtlen);
+        });
+        // 定义记录被丢弃时，引用它的日志也无法解码
+        if (!ok)
+            return;
+        if (slot) {
+            *slot = fmt;
+            ++formats.count;
         }
     }
+    std::size_t maxlen = m_maxlength;
+    std::size_t sizes[] = {sizeof(EventRecord), arg_size(args, maxlen)...};
+    std::size_t len = 0;
+    for (std::size_t sz : sizes)
+        len += sz;
+    put_record(len, [&](char *buf) {
+        EventRecord rec;
+        rec.hdr = {(uint32_t)len, EVENT, (uint8_t)lv, (uint8_t)sizeof...(Args), 0};
+        rec.tid = local_tid();
+        rec.id = (uint64_t)(uintptr_t)fmt;
+        rec.ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch()).count();
+        memcpy(buf, &rec, sizeof rec);
+        char *p = buf + sizeof rec;
+        int expand[] = {0, (put_arg(p, args, maxlen), 0)...};
+        (void)expand;
+        return len;
+    });
+}
+
+inline void Log::asyncWork()
+{
+    getInstance().asyncSave();
+}
+
+inline bool Log::open_file()
+{
     time_t now = time(nullptr);
-    tm* tmt = localtime(&now);
+    tm tmt;
+    localtime_r(&now, &tmt);
     char curtime[50];
-    sprintf(curtime, "%d/%d/%d %02d:%02d:%02d", tmt->tm_year + 1900, tmt->tm_mon + 1,
-            tmt->tm_mday, tmt->tm_hour, tmt->tm_min, tmt->tm_sec);
-    t = pre + curtime + " " + t;
-    if (m_isPrint)
-        std::cout << t << std::endl;
-    if (!m_async) {
-        syncSave(t);
+    sprintf(curtime, "%d_%d_%d", tmt.tm_year + 1900, tmt.tm_mon + 1, tmt.tm_mday);
+    std::string log_path = m_dir + m_name + "_" + curtime;
+    if (m_isSplit)
+        log_path += "_" + std::to_string(m_curfileidx++);
+    log_path += m_binary ? ".bin" : ".txt";
+    m_fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (m_fd == -1) {
+        std::cout << "Open logfile failed!" << std::endl;
+        return false;
     }
-    else {
-        m_cache.push_back(std::move(t));
-        if (m_cache.size() >= m_cachesize) 
-            m_cv.notify_one();
+    m_curlogidx = 0;
+    // 二进制日志的每个文件都以文件头开始
+    if (m_binary) {
+        logbin::FileHeader hdr;
+        memcpy(hdr.magic, logbin::MAGIC, sizeof hdr.magic);
+        timespec real, mono;
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        hdr.realtime_ns = real.tv_sec * 1000000000ull + real.tv_nsec;
+        hdr.monotonic_ns = mono.tv_sec * 1000000000ull + mono.tv_nsec;
+        ::write(m_fd, &hdr, sizeof hdr);
+        // 之前的文件中已写过的定义在新文件中重写一遍，缓冲区中尚未写出的日志可能引用它们
+        std::string defs;
+        {
+            std::lock_guard<std::mutex> lg(m_formats_mutex);
+            for (const char *fmt : m_formats) {
+                size_t fmtlen = strlen(fmt);
+                size_t off = defs.size();
+                defs.resize(off + sizeof(logbin::FormatRecord) + fmtlen);
+                format_record(&defs[off], INFO, fmt, fmtlen);
+            }
+        }
+        if (!defs.empty())
+            ::write(m_fd, defs.data(), defs.size());
     }
+    return true;
 }
 
-inline void Log::asyncWork()
+inline void Log::save(const struct iovec *iov, int cnt)
 {
-    getInstance().asyncSave();
+    if (m_isPrint && !m_binary)
+        writev(STDOUT_FILENO, iov, cnt);
+    if (m_fd == -1 && !open_file())
+        return;
+    // 普通文件的writev一般一次写完，部分写入时逐条补写剩余部分
+    ssize_t total = 0, ret;
+    for (int i = 0; i < cnt; ++i)
+        total += iov[i].iov_len;
+    ret = writev(m_fd, iov, cnt);
+    if (ret >= 0 && ret < total) {
+        for (int i = 0; i < cnt; ++i) {
+            if ((size_t)ret >= iov[i].iov_len) {
+                ret -= iov[i].iov_len;
+                continue;
+            }
+            ::write(m_fd, (const char *)iov[i].iov_base + ret, iov[i].iov_len - ret);
+            ret = 0;
+        }
+    }
+    m_curlogidx += cnt;
+    if (m_isSplit && m_curlogidx >= m_maxlogitems) {
+        close(m_fd);
+        m_fd = -1;
+    }
 }
 
-inline void Log::syncSave(const std::string &s)
-{
-    if (!m_curfile.is_open() || 
-    (m_isSplit && m_curlogidx >= m_maxlogitems)) {
-        time_t now = time(nullptr);
-        tm* tmt = localtime(&now);
-        char curtime[50];
-        sprintf(curtime, "%d_%d_%d", tmt->tm_year + 1900, tmt->tm_mon + 1, tmt->tm_mday);
-        std::string log_path = m_dir + m_name + "_" + curtime;
-        if (m_isSplit)
-            log_path += "_" + std::to_string(m_curfileidx++);
-        log_path += ".txt";
-        m_curfile.open(log_path, std::fstream::out | std::fstream::app);
-        if (!m_curfile) {
-            std::cout << "Open logfile failed!" << std::endl;
-            return;
+inline void Log::drain(ThreadRing *tr)
+{
+    // 每批最多合并的日志条数
+    static const int BATCH = 256;
+    struct iovec iov[BATCH];
+    while (true) {
+        int cnt = 0;
+        // 分文件存储时，一批日志不能跨越文件
+        int limit = BATCH;
+        if (m_isSplit && m_curlogidx + BATCH > m_maxlogitems)
+            limit = m_curlogidx < m_maxlogitems ? m_maxlogitems - m_curlogidx : 1;
+        uint64_t pos = tr->ring.peek([&](const char *data, uint32_t len) {
+            if (cnt == limit)
+                return false;
+            iov[cnt].iov_base = (void *)data;
+            iov[cnt++].iov_len = len;
+            return true;
+        });
+        if (cnt <= 0)
+            break;
+        save(iov, cnt);
+        tr->ring.consume(pos);
+    }
+    uint64_t dropped = tr->dropped.load(std::memory_order_relaxed);
+    if (dropped != tr->reported) {
+        static const char fmt[] = "Log buffer of thread %ld full, dropped %llu lines";
+        unsigned long long cnt = dropped - tr->reported;
+        char line[128];
+        if (!m_binary) {
+            size_t len = format_prefix(line, sizeof line, WARN);
+            len += snprintf(line + len, sizeof line - len - 1, fmt, tr->tid, cnt);
+            line[len++] = '\n';
+            struct iovec warn = {line, len};
+            save(&warn, 1);
         }
-        m_curlogidx = 0;
+        else {
+            // 二进制模式下由后台线程直接写出格式串定义和日志记录
+            using namespace logbin;
+            FormatRecord def = {{(uint32_t)(sizeof def + sizeof fmt - 1), FORMAT, WARN, 2, 0},
+                                (uint64_t)(uintptr_t)fmt};
+            EventRecord rec;
+            rec.hdr = {(uint32_t)(sizeof rec + 18), EVENT, WARN, 2, 0};
+            rec.tid = local_tid();
+            rec.id = def.id;
+            rec.ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now().time_since_epoch()).count();
+            memcpy(line, &rec, sizeof rec);
+            char *p = line + sizeof rec;
+            put_raw(p, ARG_INT, (int64_t)tr->tid);
+            put_raw(p, ARG_UINT, (uint64_t)cnt);
+            struct iovec iov[] = {{&def, sizeof def}, {(void *)fmt, sizeof fmt - 1}, {line, rec.hdr.len}};
+            save(iov, 3);
+        }
+        tr->reported = dropped;
     }
-    m_curfile << s << std::endl;
-    if (++m_curlogidx == m_maxlogitems && m_isSplit)
-        m_curfile.close();
 }
 
 inline void Log::asyncSave()
 {
+    std::vector<ThreadRing *> rings;
     while (true) {
-        std::unique_lock<std::mutex> ulk(m_mutex);
-        while (m_cache.empty())
+        bool stop;
         {
-            if (m_shutdown)
-                return;    
-            m_cv.wait(ulk);
+            std::unique_lock<std::mutex> ulk(m_async_mutex);
+            if (!m_shutdown)
+                m_cv.wait_for(ulk, std::chrono::milliseconds(m_cachetime));
+            stop = m_shutdown;
         }
-        for (const auto &s : m_cache)
-        {
-            syncSave(s);
-        }
-        m_cache.clear();
+        m_rings.snapshot(rings);
+        // 文件由后台线程独占，无需加锁
+        for (auto tr : rings)
+            drain(tr);
+        if (stop)
+            return;
     }
 }
 
 inline Log::~Log()
 {
     if (m_async) {
-        m_shutdown = true;
+        {
+            std::lock_guard<std::mutex> lg(m_async_mutex);
+            m_shutdown = true;
+        }
         m_cv.notify_all();
         m_thread.join();
     }
-    if (m_curfile.is_open())
-        m_curfile.close();
+    if (m_fd != -1)
+        close(m_fd);
 }
 
 
-#endif
\ No newline at end of file
+#endif
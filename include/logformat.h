@@ -0,0 +1,51 @@
+#ifndef LOGFORMAT_H
+#define LOGFORMAT_H
+
+#include <cstdint>
+
+// 二进制日志的文件格式，日志写入端和离线解码工具共用
+// 文件以FileHeader开始，之后为若干条记录，每条记录以RecordHeader开始，len为整条记录的长度
+// FORMAT记录定义格式串，id为格式串字面量的地址，同一线程首次使用某个格式串时写入
+// EVENT记录只包含格式串id、单调时钟时间戳和原始参数，由解码工具离线格式化
+namespace logbin {
+
+const char MAGIC[8] = {'M', 'L', 'O', 'G', 'B', 'I', 'N', '1'};
+
+enum RECORD_TYPE : uint8_t { FORMAT = 1, EVENT = 2 };
+// 参数类型标记，整数统一按64位存储，字符串为u32长度加内容
+enum ARG_TAG : uint8_t { ARG_INT = 'i', ARG_UINT = 'u', ARG_DOUBLE = 'd', ARG_STR = 's', ARG_PTR = 'p' };
+
+#pragma pack(push, 1)
+// 文件头，记录打开文件时的墙上时间和单调时间，用于将时间戳换算为日期
+struct FileHeader {
+    char magic[8];
+    uint64_t realtime_ns;
+    uint64_t monotonic_ns;
+};
+
+struct RecordHeader {
+    uint32_t len;
+    uint8_t type;
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t reserved;
+};
+
+// 之后为格式串内容，不含结尾的'\0'
+struct FormatRecord {
+    RecordHeader hdr;
+    uint64_t id;
+};
+
+// 之后为nargs个参数，每个参数为1字节标记加数据
+struct EventRecord {
+    RecordHeader hdr;
+    uint32_t tid;
+    uint64_t id;
+    uint64_t ts;
+};
+#pragma pack(pop)
+
+}
+
+#endif
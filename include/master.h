@@ -0,0 +1,46 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <signal.h>
+#include <sys/types.h>
+
+// 多进程模式：主进程创建监听套接字和记分板后fork出N个工作进程，每个工作进程运行完整的WebServer
+// 工作进程共享监听套接字并以EPOLLEXCLUSIVE注册，各自拥有独立的堆、日志缓冲区和线程池
+// 一个进程崩溃不影响其他进程，由主进程重新fork补足
+// 主进程不创建线程，用sigtimedwait同步处理信号：INT/TERM转发给工作进程后等待其退出，USR1输出记分板汇总
+class Master {
+public:
+    Master(const char *ip, int port, unsigned workers);
+    // 运行到收到退出信号且所有工作进程退出，返回进程退出码
+    int run();
+
+private:
+    using clock = std::chrono::steady_clock;
+    // fork第idx个工作进程
+    bool spawn(unsigned idx);
+    // 回收已退出的工作进程，未在停止时安排重新fork
+    void reap();
+    // 向所有工作进程发送信号
+    void broadcast(int sig);
+    // 输出记分板汇总
+    void report();
+    unsigned alive() const;
+
+    std::string m_ip;
+    int m_port;
+    unsigned m_workers;
+    int m_listenfd = -1;
+    pid_t m_pid;
+    bool m_stopping = false;
+    clock::time_point m_stop_deadline;
+    std::vector<pid_t> m_pids;
+    std::vector<clock::time_point> m_started;
+    // 等待重新fork的时刻，不等待时为默认值
+    std::vector<clock::time_point> m_respawn;
+    sigset_t m_oldmask;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+// 对数线性分桶的延迟直方图（HDR风格），单位为微秒
+// 每个2的幂区间再等分为SUB_BUCKETS个子桶，相对误差不超过1/SUB_BUCKETS
+struct LatencyHistogram {
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    // 最大可记录约2^27微秒（134秒），更大的值计入最后一个桶
+    static const int MAX_BITS = 27;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB_BUCKETS;
+
+    static int bucket_of(uint64_t us) {
+        if (us < 2 * SUB_BUCKETS)
+            return (int)us;
+        int msb = 63 - __builtin_clzll(us);
+        int shift = msb - SUB_BITS;
+        int idx = (shift + 1) * SUB_BUCKETS + (int)((us >> shift) & (SUB_BUCKETS - 1));
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+    // 桶的上界（不含）
+    static uint64_t bucket_upper(int idx) {
+        if (idx < 2 * SUB_BUCKETS)
+            return idx + 1;
+        int shift = idx / SUB_BUCKETS - 1;
+        uint64_t base = (uint64_t)(SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+        return base + (1ull << shift);
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> sum{0};
+};
+
+// 运行指标，每个线程写入独占的计数器，只在抓取时汇总，写入路径上没有锁和原子读改写
+class Metrics {
+public:
+    enum COUNTER { CONN_ACCEPTED, CONN_CLOSED, CONN_REJECTED, BYTES_IN, BYTES_OUT,
+                   POOL_ENQUEUED, POOL_DEQUEUED, POOL_REJECTED, FILE_CACHED, FILE_OFFLOADED,
+                   BYTES_ZEROCOPY, COUNTER_NUM };
+    enum HISTOGRAM { REQUEST_LATENCY, POOL_WAIT, POOL_WAIT_SLOW, HISTOGRAM_NUM };
+    // 记录的最大状态码
+    static const int MAX_STATUS = 600;
+
+    static Metrics &getInstance() {
+        static Metrics metrics;
+        return metrics;
+    }
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+    Metrics(Metrics &&) = delete;
+    Metrics &operator=(Metrics &&) = delete;
+
+    static void add(COUNTER c, uint64_t n = 1) {
+        bump(local()->counters[c], n);
+    }
+    static void count_status(int status) {
+        if (status > 0 && status < MAX_STATUS)
+            bump(local()->status[status], 1);
+    }
+    static void observe(HISTOGRAM h, uint64_t ns) {
+        LatencyHistogram &hist = local()->hists[h];
+        uint64_t us = ns / 1000;
+        bump(hist.counts[LatencyHistogram::bucket_of(us)], 1);
+        bump(hist.sum, us);
+    }
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 汇总所有线程的计数，生成Prometheus文本格式
+    std::string scrape();
+    // 汇总所有线程的计数器和各状态码的响应总数，多进程模式下发布到记分板
+    void totals(uint64_t (&counters)[COUNTER_NUM], uint64_t &responses);
+
+private:
+    // 每个线程的计数器，前后填充避免与其他线程的数据共享缓存行
+    struct ThreadMetrics {
+        ThreadMetrics();
+        char pad_front[64];
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        std::atomic<uint64_t> status[MAX_STATUS];
+        LatencyHistogram hists[HISTOGRAM_NUM];
+        // 所属线程已退出，可被新线程接管并继续累加
+        std::atomic<bool> orphan{false};
+        char pad_back[64];
+    };
+    Metrics() {}
+    // 只有所属线程写入，relaxed读写即可，抓取线程读到的是近似值
+    static void bump(std::atomic<uint64_t> &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static ThreadMetrics *local();
+    std::shared_ptr<ThreadMetrics> attach();
+
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<ThreadMetrics>> m_threads;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <string>
+#include <memory>
+#include <stddef.h>
+#include "packformat.h"
+#include "handler.h"
+
+// 静态资源包：启动时将tools/mkpack生成的资源包整体映射并读入内存，按路径二分查找索引
+// 请求时没有stat、open等文件系统调用，响应直接指向映射的内容，ETag、MIME类型和gzip版本均在打包时生成
+class Pack {
+public:
+    ~Pack();
+    Pack(const Pack &) = delete;
+    Pack &operator=(const Pack &) = delete;
+    Pack(Pack &&) = delete;
+    Pack &operator=(Pack &&) = delete;
+
+    // 映射并校验资源包，失败时返回nullptr
+    static std::shared_ptr<Pack> open(const std::string &filename);
+    // 将资源包挂载到路径前缀下，如mount("/", "../root.pack")使/a.png对应包中的a.png
+    static bool mount(const std::string &prefix, const std::string &filename);
+
+    // 查找相对路径对应的文件，不存在时返回nullptr
+    const packbin::IndexEntry *find(const char *path, size_t len) const;
+    // 生成文件的响应，客户端接受gzip时发送预压缩的版本，If-None-Match匹配时应答304
+    void serve(const packbin::IndexEntry &entry, const Request &req, Response &resp) const;
+    size_t count() const {
+        return m_count;
+    }
+
+private:
+    Pack() {}
+    const char *str(const packbin::Str &s) const {
+        return m_strings + s.off;
+    }
+
+    char *m_base = nullptr;
+    size_t m_size = 0;
+    const packbin::IndexEntry *m_index = nullptr;
+    size_t m_count = 0;
+    const char *m_strings = nullptr;
+};
+
+#endif
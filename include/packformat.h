@@ -0,0 +1,51 @@
+#ifndef PACKFORMAT_H
+#define PACKFORMAT_H
+
+#include <cstdint>
+
+// 静态资源包的文件格式，由tools/mkpack生成，服务器启动时映射到内存
+// 文件依次为FileHeader、count个按路径字节序排列的IndexEntry、字符串区和数据区
+// 字符串均以'\0'结尾，Str.len不含结尾的'\0'；路径相对于打包的根目录，不以/开头
+// 生成结果只取决于目录内容，相同的目录得到相同的资源包
+namespace packbin {
+
+const char MAGIC[8] = {'M', 'P', 'A', 'C', 'K', '0', '0', '1'};
+
+#pragma pack(push, 1)
+struct FileHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+    // 字符串区在文件中的偏移和长度
+    uint64_t strings_off;
+    uint64_t strings_len;
+    // 整个文件的长度，用于校验是否完整
+    uint64_t size;
+};
+
+// 字符串区中的字符串
+struct Str {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct IndexEntry {
+    Str path;
+    Str mime;
+    // 带引号的ETag，及响应中附加的头部行（ETag、Vary、Content-Encoding）
+    Str etag;
+    Str headers;
+    // 预压缩的gzip版本，gzip_size为0时没有
+    Str gzip_etag;
+    Str gzip_headers;
+    // 文件内容在整个文件中的偏移和长度
+    uint64_t data_off;
+    uint64_t size;
+    uint64_t gzip_off;
+    uint64_t gzip_size;
+};
+#pragma pack(pop)
+
+}
+
+#endif
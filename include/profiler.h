@@ -0,0 +1,54 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <signal.h>
+
+// 采样CPU分析器：ITIMER_PROF按进程消耗的CPU时间定时发出SIGPROF，在被中断的线程上记录调用栈
+// 样本写入启动时预先分配的缓冲区，结束后聚合为折叠调用栈，可直接交给flamegraph.pl生成火焰图
+// 未启动时不安装定时器和信号处理函数，没有任何开销
+class Profiler {
+public:
+    // 每个样本记录的最大栈深度
+    static const int MAX_DEPTH = 48;
+    // 样本数上限，超出的样本只计数
+    static const unsigned MAX_SAMPLES = 1 << 16;
+
+    static Profiler &getInstance() {
+        static Profiler profiler;
+        return profiler;
+    }
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+    Profiler(Profiler &&) = delete;
+    Profiler &operator=(Profiler &&) = delete;
+
+    // 采样seconds秒后在后台线程中导出到dir下以进程号和时间命名的文件，hz为每CPU秒的采样数
+    // 已有采样在进行时返回false
+    bool start_async(const std::string &dir, unsigned seconds = 10, unsigned hz = 99);
+    bool running() const {
+        return m_running.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Sample {
+        int depth;
+        void *pcs[MAX_DEPTH];
+    };
+    Profiler() {}
+    static void on_sigprof(int sig);
+    // 停止定时器并恢复原有的信号处理
+    void stop();
+    // 按调用栈聚合样本并写出折叠格式，返回写入的样本数，失败返回-1
+    long dump(const std::string &path);
+
+    std::unique_ptr<Sample[]> m_samples;
+    unsigned m_capacity = 0;
+    std::atomic<unsigned> m_next{0};
+    std::atomic<bool> m_running{false};
+    struct sigaction m_oldact;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+#include "handler.h"
+
+// 反向代理：将匹配的路由转发给一组上游服务器，选择进行中请求数最少的上游
+// 每个上游保留一组空闲的长连接，空闲连接登记在独立的epoll实例上，该实例注册在主线程的epoll上，
+// 上游关闭空闲连接时由主线程立即移出，转发时不会拿到已失效的连接
+// 转发在工作线程中进行，以阻塞的方式读写上游并带有超时；响应以chunked编码逐段转发，不缓存完整的消息体
+// 同时进行的转发数不超过m_limit（默认为线程池线程数的一半），超出时直接应答503，慢上游不会占满线程池
+// 被动健康检查：连续失败数次的上游在一段时间内不再被选择，全部不可用时仍然尝试
+class Proxy {
+public:
+    struct Upstream {
+        std::string addr;
+        std::string ip;
+        int port = 0;
+        std::atomic<int> outstanding{0};
+        // 连续失败次数，成功后清零
+        std::atomic<int> failures{0};
+        // 被标记为不可用的截止时间，steady_clock的毫秒数
+        std::atomic<int64_t> down_until{0};
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> errors{0};
+        // 空闲连接，由Proxy::m_mutex保护
+        std::vector<int> idle;
+    };
+    using Group = std::vector<std::unique_ptr<Upstream>>;
+    // 一次转发占用的名额，析构时归还
+    struct Slot {
+        explicit Slot(Proxy *proxy) : proxy(proxy) {}
+        ~Slot() { proxy->m_active.fetch_sub(1); }
+        Proxy *proxy;
+    };
+
+    static Proxy &getInstance() {
+        static Proxy proxy;
+        return proxy;
+    }
+    ~Proxy();
+    Proxy(const Proxy &) = delete;
+    Proxy &operator=(const Proxy &) = delete;
+    Proxy(Proxy &&) = delete;
+    Proxy &operator=(Proxy &&) = delete;
+
+    // 以下注册函数只能在服务器开始运行前调用
+    // 解析配置并注册路由，如"/api=127.0.0.1:9001,127.0.0.1:9002;/auth=127.0.0.1:9100"
+    bool configure(const std::string &spec);
+    // 将prefix及其下的请求原样转发给upstreams中的一个，上游地址形如127.0.0.1:9001
+    bool add_route(const std::string &prefix, const std::vector<std::string> &upstreams);
+    bool enabled() const {
+        return !m_groups.empty();
+    }
+
+    // 主线程的epoll监听该fd，可读时调用poll
+    int fd() const {
+        return m_epfd;
+    }
+    // 主线程：关闭已被上游关闭或收到意外数据的空闲连接
+    void poll();
+    // 同时进行的转发数上限，可通过管理接口修改
+    void setLimit(unsigned limit) {
+        m_limit.store(limit);
+    }
+    unsigned limit() const {
+        return m_limit.load();
+    }
+    // 各上游的状态，用于管理接口
+    std::string status();
+    // 各上游的指标，Prometheus文本格式
+    std::string scrape();
+
+    // 以下在工作线程中调用
+    void forward(Group &group, const Request &req, Response &resp);
+    // 取得一个转发名额，已达上限时返回nullptr
+    std::shared_ptr<Slot> admit();
+    // 选择上游并增加其进行中请求数
+    Upstream *pick(Group &group);
+    // 取出空闲连接，没有时新建连接，失败返回-1
+    int acquire(Upstream *up, bool &reused);
+    // 响应完整读取后归还长连接
+    void recycle(Upstream *up, int fd);
+    // 记录一次转发的结果，用于被动健康检查
+    void report(Upstream *up, bool ok);
+
+private:
+    Proxy();
+
+    std::vector<std::unique_ptr<Group>> m_groups;
+    int m_epfd = -1;
+    std::mutex m_mutex;
+    // 空闲连接所属的上游
+    std::unordered_map<int, Upstream *> m_idle;
+    std::atomic<unsigned> m_next{0};
+    std::atomic<unsigned> m_limit{1};
+    std::atomic<unsigned> m_active{0};
+    std::atomic<uint64_t> m_rejected{0};
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// 单生产者单消费者的无锁字节环形缓冲区，存储变长记录
+// 记录格式为8字节头部（记录长度）加消息体，每条记录按8字节对齐且在缓冲区中连续存放
+class SPSCRing {
+public:
+    using size_t = unsigned long;
+    // 头部长度为PAD_RECORD时表示其后直到缓冲区末尾的空间为填充，需要跳回起始位置
+    static const uint32_t PAD_RECORD = 0xffffffffu;
+    static const size_t HEADER_SIZE = 8;
+
+    // 容量向上取整为2的幂
+    explicit SPSCRing(size_t capacity)
+    : m_capacity(round_pow2(capacity)), m_mask(m_capacity - 1), m_buf(new char[m_capacity]) {}
+
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing &operator=(const SPSCRing &) = delete;
+
+    // 生产者：预留最多len字节的连续空间，空间不足时返回nullptr
+    char *reserve(size_t len) {
+        size_t need = record_size(len);
+        if (need > m_capacity)
+            return nullptr;
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        size_t off = head & m_mask;
+        size_t to_end = m_capacity - off;
+        if (to_end < need) {
+            // 末尾空间不足，填充后从头开始
+            if (head + to_end + need - tail > m_capacity)
+                return nullptr;
+            set_header(off, PAD_RECORD);
+            head += to_end;
+            off = 0;
+        }
+        else if (head + need - tail > m_capacity) {
+            return nullptr;
+        }
+        m_reserved = head;
+        return m_buf.get() + off + HEADER_SIZE;
+    }
+    // 生产者：提交最近一次预留的空间，len为实际写入的长度，不能超过预留的长度
+    void commit(size_t len) {
+        set_header(m_reserved & m_mask, (uint32_t)len);
+        m_head.store(m_reserved + record_size(len), std::memory_order_release);
+    }
+
+    // 消费者：依次访问已提交的记录，fn(data, len)返回false时停止且不包含该记录
+    // 返回最后一条被接受的记录之后的位置，交给consume()释放空间
+    template <typename F>
+    uint64_t peek(F fn) const {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while (tail != head) {
+            size_t off = tail & m_mask;
+            uint32_t len = get_header(off);
+            if (len == PAD_RECORD) {
+                tail += m_capacity - off;
+                continue;
+            }
+            if (!fn((const char *)m_buf.get() + off + HEADER_SIZE, len))
+                break;
+            tail += record_size(len);
+        }
+        return tail;
+    }
+    // 消费者：释放pos之前的空间
+    void consume(uint64_t pos) {
+        m_tail.store(pos, std::memory_order_release);
+    }
+
+    // 已使用的字节数，可由任意一方调用，结果为近似值
+    size_t used() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return m_capacity; }
+    bool empty() const { return used() == 0; }
+
+private:
+    static size_t round_pow2(size_t n) {
+        size_t cap = 64;
+        while (cap < n)
+            cap <<= 1;
+        return cap;
+    }
+    static size_t record_size(size_t len) {
+        return (HEADER_SIZE + len + 7) & ~(size_t)7;
+    }
+    void set_header(size_t off, uint32_t len) {
+        memcpy(m_buf.get() + off, &len, sizeof len);
+    }
+    uint32_t get_header(size_t off) const {
+        uint32_t len;
+        memcpy(&len, m_buf.get() + off, sizeof len);
+        return len;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<char[]> m_buf;
+    // 生产者和消费者的位置分别独占缓存行，避免伪共享
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    // 生产者最近一次预留的位置，仅生产者访问
+    uint64_t m_reserved = 0;
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+};
+
+// 每个线程独占一个SPSCRing的集合，各线程无锁写入自己的缓冲区，由一个后台线程依次消费
+class ThreadRings {
+public:
+    using size_t = unsigned long;
+    struct Slot {
+        explicit Slot(size_t bytes): ring(bytes) {}
+        SPSCRing ring;
+        // 因缓冲区满而丢弃的记录数，以及消费者已报告的数量
+        std::atomic<uint64_t> dropped{0};
+        uint64_t reported = 0;
+        // 所属线程已退出，缓冲区清空后可被新线程复用
+        std::atomic<bool> orphan{false};
+        long tid = 0;
+    };
+
+    explicit ThreadRings(size_t ringsize = 1 << 18): m_ringsize(ringsize) {}
+    ThreadRings(const ThreadRings &) = delete;
+    ThreadRings &operator=(const ThreadRings &) = delete;
+
+    // 设置每个线程缓冲区的字节数，只影响之后创建的缓冲区
+    void set_ringsize(size_t bytes) { m_ringsize = bytes; }
+    // 生产者：获取当前线程的缓冲区，首次调用时注册
+    Slot *local();
+    // 消费者：获取目前所有的缓冲区
+    void snapshot(std::vector<Slot *> &out) {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        out.clear();
+        for (auto &slot : m_slots)
+            out.push_back(slot.get());
+    }
+
+private:
+    // 线程私有的缓冲区表，线程退出时将其缓冲区标记为可复用
+    // 使用shared_ptr保证集合先于线程析构时仍可安全访问
+    struct LocalSlots {
+        std::vector<std::pair<const ThreadRings *, std::shared_ptr<Slot>>> slots;
+        ~LocalSlots() {
+            for (auto &p : slots)
+                p.second->orphan.store(true, std::memory_order_release);
+        }
+    };
+
+    std::mutex m_mutex;
+    size_t m_ringsize;
+    std::vector<std::shared_ptr<Slot>> m_slots;
+};
+
+inline ThreadRings::Slot *ThreadRings::local()
+{
+    thread_local LocalSlots local;
+    for (auto &p : local.slots) {
+        if (p.first == this)
+            return p.second.get();
+    }
+    std::shared_ptr<Slot> slot;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        for (auto &s : m_slots) {
+            // 复用已退出线程留下且已清空的缓冲区
+            if (s->orphan.load(std::memory_order_acquire) && s->ring.empty()) {
+                s->orphan.store(false, std::memory_order_relaxed);
+                slot = s;
+                break;
+            }
+        }
+        if (!slot) {
+            slot = std::make_shared<Slot>(m_ringsize);
+            m_slots.push_back(slot);
+        }
+    }
+    slot->tid = syscall(SYS_gettid);
+    local.slots.emplace_back(this, slot);
+    return slot.get();
+}
+
+#endif
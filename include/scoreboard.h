@@ -0,0 +1,76 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "metrics.h"
+
+// 多进程模式的记分板：主进程在fork前以MAP_SHARED创建，每个工作进程独占一个槽位
+// 工作进程的后台线程每秒汇总本进程的运行指标写入槽位，主进程和所有工作进程都可以读取
+// 槽位只由一个进程写入，无锁的原子变量在进程间共享
+class Scoreboard {
+public:
+    static const unsigned MAX_WORKERS = 256;
+
+    struct alignas(64) Slot {
+        // 工作进程号，未运行时为0
+        std::atomic<int> pid;
+        // 启动时间，Unix时间戳
+        std::atomic<int64_t> started;
+        // 该槽位的工作进程被重新fork的次数
+        std::atomic<uint64_t> restarts;
+        // 已发送的响应数
+        std::atomic<uint64_t> responses;
+        std::atomic<uint64_t> counters[Metrics::COUNTER_NUM];
+    };
+
+    static Scoreboard &getInstance() {
+        static Scoreboard board;
+        return board;
+    }
+    ~Scoreboard();
+    Scoreboard(const Scoreboard &) = delete;
+    Scoreboard &operator=(const Scoreboard &) = delete;
+    Scoreboard(Scoreboard &&) = delete;
+    Scoreboard &operator=(Scoreboard &&) = delete;
+
+    // 主进程：在fork工作进程前创建共享内存
+    bool create(unsigned workers);
+    // 工作进程数，单进程模式下为0
+    unsigned workers() const {
+        return m_workers;
+    }
+    Slot &slot(unsigned idx) {
+        return m_slots[idx];
+    }
+    // 工作进程：启动后台线程，每秒将本进程的运行指标写入第idx个槽位
+    void publish(unsigned idx);
+    // 工作进程：最后发布一次并停止后台线程，需要在运行指标销毁前调用
+    void stop();
+    // 主进程：工作进程退出后将其计数并入已退出进程的总数，并清空槽位
+    void retire(unsigned idx);
+    // 所有工作进程的计数之和，包含已退出的进程
+    void totals(uint64_t (&counters)[Metrics::COUNTER_NUM], uint64_t &responses);
+    // 各工作进程的指标，Prometheus文本格式
+    std::string scrape();
+
+private:
+    Scoreboard() {}
+    void work();
+    void update();
+
+    // 前m_workers个槽位属于工作进程，最后一个累计已退出的进程
+    Slot *m_slots = nullptr;
+    unsigned m_workers = 0;
+    int m_index = -1;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_shutdown = false;
+};
+
+#endif
@@ -4,14 +4,21 @@
 #include <mutex>
 #include <queue>
 #include <vector>
+#include <memory>
 #include <condition_variable>
+#include <cstdint>
+#include <string>
 // #include "global.h"
 
 class WorkRequest;
 
+// 请求分为快慢两个队列：已知响应或请求体较大、或注册为耗时的请求进入慢队列，其余进入快队列
+// 两个队列都有请求时，每取出m_weight个快请求后取一个慢请求；慢队列队首等待超过m_max_wait时优先取出
+// 线程数多于一个时，执行慢请求的线程至少空出一个，大量下载期间小请求不必等待慢请求执行完
 class ThreadPool {
 public:
     using size_t = unsigned;
+    enum LANE { FAST, SLOW, LANE_NUM };
     static ThreadPool &getInstance(size_t thread_num = 8, size_t max_requests = 10000)
     {
         static ThreadPool pool(thread_num, max_requests);
@@ -19,6 +26,19 @@ public:
     }
     // 两种反应堆模式下的添加任务方法，不同处理方式由请求类保证
     bool appendReq(std::shared_ptr<WorkRequest> req);
+    // 运行时调整线程数，减少时多余的线程在完成手头的任务后退出
+    void resize(size_t thread_num);
+    size_t threads();
+    // 运行时调整请求队列的最大容量，已在队列中的请求不受影响
+    void setMaxRequests(size_t max_requests);
+    size_t maxRequests();
+    // 运行时调整两个队列的调度权重和慢请求的最长等待时间（毫秒）
+    void setWeight(size_t weight);
+    size_t weight();
+    void setMaxWait(size_t ms);
+    size_t maxWait();
+    // 各队列的长度和正在执行的慢请求数，用于管理接口
+    std::string status();
     // 保证所有任务执行完成后析构
     ~ThreadPool();
     ThreadPool(const ThreadPool &) = delete;
@@ -31,12 +51,23 @@ private:
     // 工作线程函数
     static void worker();
     void run();
+    // 回收已退出的线程，调用时需持有m_mtx
+    void reap();
+    // 取出下一个可执行的请求，没有时返回false，调用时需持有m_mtx
+    bool pop(std::shared_ptr<WorkRequest> &req);
 
     // MODE m_actor_mode; // IO模型
-    size_t m_thread_num; // 线程数
+    size_t m_thread_num; // 目标线程数
+    size_t m_running = 0; // 正在运行的线程数
     size_t m_max_requests; // 请求队列的最大容量
     std::vector<std::thread> m_threads; // 线程池数组
-    std::queue<std::shared_ptr<WorkRequest>> m_workqueue; // 请求队列
+    std::vector<std::thread::id> m_exited; // 缩容时已退出、尚未join的线程
+    std::queue<std::shared_ptr<WorkRequest>> m_lanes[LANE_NUM]; // 快慢两个请求队列
+    size_t m_queued = 0; // 两个队列中的请求总数
+    size_t m_weight = 4; // 每取出一个慢请求之前最多连续取出的快请求数
+    uint64_t m_max_wait; // 慢请求的最长等待时间（纳秒）
+    size_t m_streak = 0; // 上次取出慢请求后连续取出的快请求数
+    size_t m_slow_running = 0; // 正在执行慢请求的线程数
     std::mutex m_mtx; // 请求队列互斥量
     std::condition_variable m_cv; // 条件变量，用于阻塞和唤醒线程
     bool m_shutdown = false;
@@ -48,6 +79,10 @@ public:
     WorkRequest() = default;
     virtual ~WorkRequest() {}
     virtual bool do_request() = 0;
+    // 进入队列的时间，用于统计排队时长
+    uint64_t m_enqueue_time = 0;
+    // 所属队列，由提交者在入队前根据已知的请求信息设置
+    ThreadPool::LANE m_lane = ThreadPool::FAST;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+// 请求处理过程的采样追踪，导出为Chrome trace_event格式的JSON，可以在Perfetto中查看
+// 每个线程的区间记录在独占的环形缓冲区中，写满后覆盖最旧的记录，导出时不需要停止写入
+class Tracer {
+public:
+    // 普通区间记录在所在线程上；异步区间跨越线程，如在线程池中排队的时间
+    enum SPAN_KIND : uint8_t { SPAN_SYNC, SPAN_ASYNC };
+    // 每个线程保留的区间数
+    static const unsigned CAPACITY = 8192;
+
+    static Tracer &getInstance() {
+        static Tracer tracer;
+        return tracer;
+    }
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+    Tracer(Tracer &&) = delete;
+    Tracer &operator=(Tracer &&) = delete;
+
+    // 每N个请求追踪一个，0表示关闭，可在运行时修改
+    static void setSampling(unsigned n) {
+        getInstance().m_sampling.store(n, std::memory_order_relaxed);
+    }
+    static unsigned sampling() {
+        return getInstance().m_sampling.load(std::memory_order_relaxed);
+    }
+    // 决定是否追踪一个新请求，返回其追踪id，0表示不追踪
+    static uint64_t sample() {
+        unsigned n = sampling();
+        if (n == 0)
+            return 0;
+        thread_local unsigned count = 0;
+        if (++count < n)
+            return 0;
+        count = 0;
+        return getInstance().m_next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    static void record(const char *name, uint64_t start, uint64_t dur, uint64_t id,
+                       SPAN_KIND kind = SPAN_SYNC);
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 将所有线程当前保留的区间写入文件，返回写入的区间数，失败返回-1
+    long dump(const std::string &path);
+    // 在后台线程中导出到dir下以进程号和时间命名的文件，避免阻塞调用者
+    void dump_async(const std::string &dir);
+
+private:
+    // 单个区间，按序号实现顺序锁：写入期间seq为奇数，读者发现seq变化时丢弃该记录
+    struct Span {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> dur{0};
+        std::atomic<uint64_t> id{0};
+        std::atomic<uint8_t> kind{SPAN_SYNC};
+    };
+    struct ThreadTrace {
+        std::atomic<long> tid{0};
+        std::atomic<uint64_t> next{0};
+        // 所属线程已退出，可被新线程复用
+        std::atomic<bool> orphan{false};
+        Span spans[CAPACITY];
+    };
+    Tracer() {}
+    static ThreadTrace *local();
+    // 取得一个已退出线程留下的缓冲区，没有时新建
+    std::shared_ptr<ThreadTrace> attach();
+
+    std::atomic<unsigned> m_sampling{0};
+    std::atomic<uint64_t> m_next_id{0};
+    std::atomic<bool> m_dumping{false};
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<ThreadTrace>> m_threads;
+};
+
+// 记录一个作用域的执行时间，id为0时不做任何事
+class TraceSpan {
+public:
+    TraceSpan(const char *name, uint64_t id)
+    : m_name(name), m_id(id), m_start(id ? Tracer::now() : 0) {}
+    ~TraceSpan() {
+        if (m_id)
+            Tracer::record(m_name, m_start, Tracer::now() - m_start, m_id);
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *m_name;
+    uint64_t m_id;
+    uint64_t m_start;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <sys/types.h>
+
+// 平滑升级：旧进程fork并exec当前路径上的可执行文件，通过继承的Unix域套接字以SCM_RIGHTS传递监听描述符
+// 新进程初始化完成后回复一个字节，旧进程随即停止accept并在期限内处理完已有连接后退出
+// 监听套接字在整个过程中始终打开，内核队列中等待accept的连接不会被拒绝
+class Upgrade {
+public:
+    // 传给新进程的环境变量，值为与旧进程通信的描述符
+    static constexpr const char *ENV_FD = "MANGO_UPGRADE_FD";
+
+    static Upgrade &getInstance() {
+        static Upgrade upgrade;
+        return upgrade;
+    }
+    Upgrade(const Upgrade &) = delete;
+    Upgrade &operator=(const Upgrade &) = delete;
+    Upgrade(Upgrade &&) = delete;
+    Upgrade &operator=(Upgrade &&) = delete;
+
+    // 旧进程：启动新进程并发送监听描述符，返回等待就绪应答的描述符，失败或升级已在进行时返回-1
+    int start(int listenfd);
+    // 旧进程：应答描述符可读时调用，新进程就绪返回true，否则结束新进程并返回false
+    bool finish();
+    // 旧进程：放弃进行中的升级，如新进程超时未就绪
+    void abort();
+    // 新进程：由旧进程启动时返回继承的监听描述符，否则返回-1
+    int inherit();
+    // 新进程：初始化完成后通知旧进程
+    void ready();
+
+    // 等待应答的描述符，没有进行中的升级时为-1
+    int fd() const {
+        return m_sock;
+    }
+
+private:
+    Upgrade() {}
+
+    int m_sock = -1;
+    pid_t m_pid = -1;
+};
+
+#endif
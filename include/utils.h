@@ -11,6 +11,8 @@ enum TRI_MODE { LT, ET };
 
 // 将socket设置为非阻塞的函数，返回sock的原配置
 int setnonblocking(int fd);
+// 创建监听ip:port的TCP套接字，失败时返回-1
+int listen_socket(const char *ip, int port);
 
 // 采用RAII的Epoll操作类
 
@@ -35,15 +37,24 @@ public:
         }
     }
     // 向epoll对象中添加fd, oneshot属性默认启用
-    void addfd(int fd, TRI_MODE tmode, bool oneshot = true);
-    // 修改fd，主要用于重置oneshot状态，只用在启用了oneshot模式的ET，ev为EPOLLIN或者EPOLLOUT
-    void reset_oneshot(int fd, int ev);
+    // 多个进程共享的监听套接字设置exclusive，一个连接到达时只唤醒其中一个进程
+    void addfd(int fd, TRI_MODE tmode, bool oneshot = true, bool exclusive = false);
+    // 添加连接fd，一次性注册EPOLLIN|EPOLLOUT|EPOLLET，此后不再修改
+    // 同一时刻只有一个线程处理该连接，由HTTPConn的处理权标志保证
+    void addconn(int fd);
+    // 以相同的事件重新注册连接fd，epoll按其当前状态再次通知
+    void rearm(int fd);
     // 移除某个fd
     void removefd(int fd);
     // 获取本来的epollfd
     int getfd() const { return m_epollfd; }
-    // 等待并获取就绪数组，返回就绪数组的大小
-    int wait(epoll_event **events);
+    // fork得到的子进程与父进程共用同一个epoll实例，需要重新创建
+    void reopen() {
+        close(m_epollfd);
+        m_epollfd = epoll_create(5);
+    }
+    // 等待并获取就绪数组，返回就绪数组的大小；timeout为毫秒，-1表示一直等待
+    int wait(epoll_event **events, int timeout = -1);
 
 private:
     EpollControl():m_epollfd(epoll_create(5)) {}
@@ -11,11 +11,20 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
 
 #include "threadpool.h"
 #include "httpconn.h"
 #include "log.h"
 #include "signalhandler.h"
+#include "profiler.h"
+#include "admin.h"
+#include "upgrade.h"
+#include "scoreboard.h"
+#include "proxy.h"
+#include "diskio.h"
+#include "pack.h"
+#include <chrono>
 // #include "timer.h"
 
 class WebServer
@@ -26,26 +35,49 @@ public:
     WebServer(const char *ip = "192.168.8.8", int port = 5005) {
         init(ip, port);
     }
+    // 多进程模式下的第worker个工作进程，使用主进程创建的监听套接字
+    WebServer(const char *ip, int port, int listenfd, unsigned worker)
+        : m_listenfd(listenfd), m_worker(worker) {
+        init(ip, port);
+    }
     ~WebServer() {
+        // 管理接口的回调引用了本对象
+        Admin::getInstance().stop();
+        Scoreboard::getInstance().stop();
+        // 执行器中的任务会发送响应，需要在连接销毁前完成
+        DiskIO::getInstance().stop();
+        // 新进程尚未就绪时随本进程一同结束
+        m_upgrade.abort();
         if (m_listenfd != -1) {
-            LOG_INFO("Close listenfd: %d", m_listenfd);
+            LOG_INFO<Log::NET>("Close listenfd: %d", m_listenfd);
             close(m_listenfd);
         }
     }
     void run();
 
 private:
-    // 最大连接数
-    const size_t MAX_FD = 40000;
+    // 最大连接数，启动时按文件描述符上限调整，可通过管理接口修改
+    std::atomic<size_t> m_max_fd{40000};
 
     // 标识停止服务器
     bool m_stopserver = false;
     // 标识定时事件
     bool m_timeout = false;
+    // CPU采样的时长（秒）和频率
+    unsigned m_profile_seconds = 10;
+    unsigned m_profile_hz = 99;
+    // 平滑升级后排空已有连接的期限（秒），期满后关闭剩余连接退出
+    unsigned m_drain_seconds = 30;
+    // 已将监听套接字交给新进程，正在排空连接
+    bool m_draining = false;
+    // 升级或排空的截止时间
+    std::chrono::steady_clock::time_point m_deadline;
 
     // 监听fd和当前事件fd
     int m_listenfd = -1;
     int m_eventfd = -1;
+    // 多进程模式下工作进程的序号，单进程模式为-1
+    int m_worker = -1;
     // epoll就绪数组
     epoll_event *m_events;
 
@@ -55,31 +87,124 @@ private:
     EpollControl &m_epoller = EpollControl::getInstance();
     // 连接管理类
     ConnHandler &m_connhdr = ConnHandler::getInstance();
+    Upgrade &m_upgrade = Upgrade::getInstance();
 
     // 初始化的函数
     // Log类
     void init_log() {
+        // 工作进程在写入第一条日志前换用带序号的文件，如log.0_2022_5_6.txt
+        if (m_worker >= 0)
+            Log::getInstance().setName("log" + file_suffix());
+#ifdef LOG_BINARY
+        Log::getInstance().setBinary();
+#endif
         Log::getInstance().setAsync();
         Log::getInstance().setPrint();
+        // 运行时日志级别，如MANGO_LOG=warn,net=info
+        const char *levels = getenv("MANGO_LOG");
+        if (levels && !Log::setLevels(levels))
+            LOG_ERROR("Bad MANGO_LOG: %s", levels);
+        // 请求追踪的采样率，如MANGO_TRACE=100表示每100个请求追踪一个，kill -USR1导出
+        const char *trace = getenv("MANGO_TRACE");
+        if (trace)
+            Tracer::setSampling(atoi(trace));
+        // 访问日志与运行日志位于同一目录，单个文件64MB，保留4个历史文件
+        AccessLog::getInstance().open("../", "access" + file_suffix());
+        // 捕获请求流量用于回放，如MANGO_CAPTURE=../capture.bin，达到1GB后停止
+        const char *capture = getenv("MANGO_CAPTURE");
+        if (capture && *capture)
+            Capture::getInstance().open(capture + file_suffix());
+        // 收到SIGUSR2时的CPU采样时长和频率，如MANGO_PROFILE=30,199
+        const char *profile = getenv("MANGO_PROFILE");
+        if (profile && sscanf(profile, "%u,%u", &m_profile_seconds, &m_profile_hz) < 1)
+            LOG_ERROR("Bad MANGO_PROFILE: %s", profile);
+        // 平滑升级后旧进程排空连接的期限，如MANGO_DRAIN=60
+        const char *drain = getenv("MANGO_DRAIN");
+        if (drain && sscanf(drain, "%u", &m_drain_seconds) != 1)
+            LOG_ERROR("Bad MANGO_DRAIN: %s", drain);
     }
+    // 多进程模式下各工作进程写入各自的文件，如access.0.log
+    std::string file_suffix() const {
+        return m_worker >= 0 ? "." + std::to_string(m_worker) : "";
+    }
+    // 管理接口，MANGO_ADMIN指定套接字路径，默认为../mango.sock，设为空时关闭
+    // 多进程模式下每个工作进程一个套接字，路径后加序号
+    void init_admin(const char *ip, int port);
     // Signal类
     void init_signal() {
         m_sighdr.init(m_epoller);
     }
+    // 注册路由：在主线程中直接应答的处理器和网站根目录
+    void init_routes() {
+        // 负载均衡的健康检查
+        HandlerTable::getInstance().add_static("/health", "OK\n");
+        // Prometheus抓取的运行指标，汇总各线程计数的开销与线程数成正比，可以在主线程完成
+        HandlerTable::getInstance().add_handler("/metrics", [](const Request &, Response &resp) {
+            resp.content_type = "text/plain; version=0.0.4";
+            resp.owned = Metrics::getInstance().scrape();
+            // 多进程模式下附加记分板中各工作进程的计数
+            resp.owned += Scoreboard::getInstance().scrape();
+            resp.owned += Proxy::getInstance().scrape();
+        });
+        // 反向代理的路由，如MANGO_PROXY=/api=127.0.0.1:9001,127.0.0.1:9002;/auth=127.0.0.1:9100
+        const char *proxy = getenv("MANGO_PROXY");
+        if (proxy && !Proxy::getInstance().configure(proxy))
+            LOG_ERROR("Bad MANGO_PROXY: %s", proxy);
+        // 其余路径映射到网站根目录下的文件，设置MANGO_PACK时改为由tools/mkpack生成的资源包提供
+        // 如MANGO_PACK=../root.pack，加载失败时仍使用网站根目录
+        const char *pack = getenv("MANGO_PACK");
+        if (!pack || !*pack || !Pack::mount("/", pack))
+            HandlerTable::getInstance().mount("/", "../root");
+    }
+    // 请求体的大小上限和上传目录
+    // 如MANGO_MAX_BODY=1048576，MANGO_MAX_UPLOAD=1073741824，MANGO_UPLOAD=../upload，未设置上传目录时不接受上传
+    void init_body() {
+        const char *max_body = getenv("MANGO_MAX_BODY");
+        if (max_body)
+            HTTPConn::m_max_body.store(strtoull(max_body, nullptr, 10));
+        const char *max_upload = getenv("MANGO_MAX_UPLOAD");
+        if (max_upload)
+            HTTPConn::m_max_upload.store(strtoull(max_upload, nullptr, 10));
+        const char *upload = getenv("MANGO_UPLOAD");
+        if (upload && *upload) {
+            struct stat st;
+            if (stat(upload, &st) == 0 && S_ISDIR(st.st_mode))
+                HTTPConn::m_upload_dir = upload;
+            else
+                LOG_ERROR("Bad MANGO_UPLOAD: %s is not a directory", upload);
+        }
+    }
+    // 零拷贝发送的消息体长度下限，如MANGO_ZEROCOPY=10240，默认关闭，开启时不小于4096
+    void init_zerocopy() {
+        const char *env = getenv("MANGO_ZEROCOPY");
+        if (env && !ZeroCopy::setThreshold(strtoull(env, nullptr, 10)))
+            LOG_ERROR("Bad MANGO_ZEROCOPY: %s, must be 0 or at least 4096", env);
+    }
+    // 磁盘IO执行器的线程数，如MANGO_DISKIO=4，默认为2，设为0时文件请求交给线程池并在其中直接读取
+    void init_diskio() {
+        unsigned threads = 2;
+        const char *env = getenv("MANGO_DISKIO");
+        if (env)
+            threads = strtoul(env, nullptr, 10);
+        DiskIO::getInstance().start(threads);
+    }
+    // 将文件描述符软上限提高到硬上限，并据此确定最大连接数
+    void init_fdlimit();
     // 初始化连接
     void init(const char *ip, int port);
 
-    // 处理listen事件，如果成功则返回accpet的fd
-    int handle_listen();
-    // 处理epollin事件，即读取数据
-    void handle_read();
-    // 处理epollout事件，即发送数据
-    void handle_write();
+    // 处理listen事件，接受所有已到达的连接
+    void handle_listen();
+    // 处理连接上的epoll事件，获得处理权后读写数据或交给工作线程
+    void handle_conn(uint32_t ev);
     // 处理信号事件
     void handle_signal();
-    
-    // 关闭一个文件描述符并移除对应的所有资源
-    void closefd(int fd);
+    // 启动新进程并交出监听套接字，kill -HUP或管理接口触发
+    bool start_upgrade();
+    // 处理新进程的就绪应答，成功后停止accept并开始排空连接
+    void handle_upgrade();
+    // 检查升级和排空的期限，连接全部关闭或期满时停止服务器
+    void check_deadline();
 };
 
 #endif 
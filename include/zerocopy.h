@@ -0,0 +1,88 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+// 零拷贝发送：MANGO_ZEROCOPY设置阈值后，超过阈值的消息体以MSG_ZEROCOPY发送，内核直接引用用户态的页
+// 发送完成的通知由套接字的错误队列送达，表现为EPOLLERR；通知到达前消息体的缓冲区不能释放或改写
+// 连接关闭时仍有未完成的发送，套接字交给ZeroCopy保持打开，通知全部到达后才关闭并释放缓冲区
+// 超时的套接字先被重置以丢弃发送队列，此后仍等待通知；重置后仍未完成时关闭套接字并有意泄漏缓冲区，
+// 内核可能仍在发送其中的页，释放后被复用会把其他请求的数据发给对端
+// TCP套接字上的通知按序号顺序到达，只记录已完成的最大序号
+class ZeroCopy {
+public:
+    // 被内核引用的缓冲区，seq为最后一次引用它的发送的序号，析构时释放
+    struct Hold {
+        uint32_t seq = 0;
+        // 处理器生成的消息体
+        std::string owned;
+        // 文件映射
+        std::shared_ptr<char> map;
+    };
+    using Holds = std::deque<Hold>;
+
+    static ZeroCopy &getInstance() {
+        static ZeroCopy zc;
+        return zc;
+    }
+    ~ZeroCopy();
+    ZeroCopy(const ZeroCopy &) = delete;
+    ZeroCopy &operator=(const ZeroCopy &) = delete;
+    ZeroCopy(ZeroCopy &&) = delete;
+    ZeroCopy &operator=(ZeroCopy &&) = delete;
+
+    // 以零拷贝发送的消息体长度下限，0表示关闭，可通过管理接口修改
+    static std::atomic<uint64_t> m_threshold;
+    // 设置阈值，非0时不得小于4096：短消息体存放在std::string的内联缓冲区中，移交给Hold时地址会变
+    static bool setThreshold(uint64_t n);
+
+    // 读取fd错误队列中的完成通知，更新已完成的序号done（下一个未完成的序号）
+    // 内核退回复制发送时将copied置为true，此后该连接不必再使用零拷贝
+    static void reap(int fd, uint32_t &done, bool &copied);
+    // 释放已完成的缓冲区，返回是否全部释放
+    static bool release(Holds &holds, uint32_t done);
+
+    // 接管已从主epoll移除的套接字，直到holds全部完成
+    void adopt(int fd, uint32_t done, Holds holds);
+    // 主线程的epoll监听该fd，可读时调用poll
+    int fd() const {
+        return m_epfd;
+    }
+    // 主线程：处理被接管套接字的完成通知，关闭已完成的套接字，并由定时器定期处理超时的套接字
+    void poll();
+    // 被接管的套接字数
+    size_t orphans();
+    // 因通知始终未到达而泄漏的缓冲区数
+    size_t leaked();
+
+private:
+    ZeroCopy();
+    // 重置或关闭超时的套接字，调用时持有锁
+    void expire();
+    // 有被接管的套接字时每秒触发一次定时器，没有时停止，调用时持有锁
+    void arm_timer();
+    // 关闭被接管的套接字，缓冲区仍被引用时泄漏，调用时持有锁
+    void drop(int fd, Holds &holds);
+
+    struct Orphan {
+        uint32_t done;
+        Holds holds;
+        int64_t deadline;
+        // 已重置连接，正在等待丢弃的数据的通知
+        bool reset = false;
+    };
+    int m_epfd = -1;
+    int m_timerfd = -1;
+    bool m_armed = false;
+    size_t m_leaked = 0;
+    std::mutex m_mutex;
+    std::unordered_map<int, Orphan> m_orphans;
+};
+
+#endif
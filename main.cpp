@@ -1,9 +1,17 @@
 #include "webserver.h"
+#include "master.h"
 
 #define DEBUG_MODE
 
-int main()
+// 可选参数：监听地址和端口，如 ./server 127.0.0.1 5005
+int main(int argc, char *argv[])
 {
-    WebServer server;
+    const char *ip = argc > 1 ? argv[1] : "192.168.8.8";
+    int port = argc > 2 ? atoi(argv[2]) : 5005;
+    // 多进程模式，如MANGO_PROCS=4，主进程只管理工作进程，不处理请求
+    const char *procs = getenv("MANGO_PROCS");
+    if (procs && atoi(procs) > 0)
+        return Master(ip, port, atoi(procs)).run();
+    WebServer server(ip, port);
     server.run();
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "accesslog.h"
+#include "log.h"
+#include <fcntl.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+bool AccessLog::open(const std::string &dir, const std::string &name, size_t maxsize,
+                     int maxfiles, size_t flushms)
+{
+    if (m_enabled.load(std::memory_order_relaxed))
+        return false;
+    m_path = dir + name + ".log";
+    m_maxsize = maxsize;
+    m_maxfiles = maxfiles;
+    m_flushms = flushms;
+    timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    m_realtime = real.tv_sec * 1000000000ull + real.tv_nsec;
+    m_monotonic = mono.tv_sec * 1000000000ull + mono.tv_nsec;
+    if (!open_file())
+        return false;
+    m_batch.reserve(BATCH_SIZE + 4096);
+    m_thread = std::thread(&AccessLog::work, this);
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+void AccessLog::record(const AccessEntry &entry, const char *path, size_t pathlen)
+{
+    if (pathlen > MAX_PATH)
+        pathlen = MAX_PATH;
+    ThreadRings::Slot *slot = m_rings.local();
+    char *buf = slot->ring.reserve(sizeof entry + pathlen);
+    if (!buf) {
+        // 访问日志不能拖慢请求，缓冲区满时丢弃
+        slot->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    memcpy(buf, &entry, sizeof entry);
+    memcpy(buf + sizeof entry, path, pathlen);
+    slot->ring.commit(sizeof entry + pathlen);
+}
+
+// 以微秒输出相对于请求开始的偏移，未经历的阶段输出null
+static char *put_offset(char *p, const char *key, uint64_t ts, uint64_t start)
+{
+    if (ts == 0)
+        return p + sprintf(p, ",\"%s\":null", key);
+    return p + sprintf(p, ",\"%s\":%.1f", key, ((int64_t)(ts - start)) / 1000.0);
+}
+
+void AccessLog::format(const AccessEntry &e, const char *path, size_t pathlen)
+{
+    uint64_t start = e.first_read ? e.first_read : e.accept;
+    uint64_t ns = m_realtime + (start - m_monotonic);
+    time_t sec = ns / 1000000000ull;
+    tm tmt;
+    localtime_r(&sec, &tmt);
+    char head[128];
+    snprintf(head, sizeof head, "{\"time\":\"%d-%02d-%02dT%02d:%02d:%02d.%06llu\",\"method\":\"%s\",\"path\":\"",
+             tmt.tm_year + 1900, tmt.tm_mon + 1, tmt.tm_mday, tmt.tm_hour, tmt.tm_min, tmt.tm_sec,
+             (unsigned long long)(ns % 1000000000ull / 1000), e.method);
+    m_batch += head;
+    // 路径来自客户端，转义引号、反斜杠和控制字符
+    for (size_t i = 0; i < pathlen; ++i) {
+        unsigned char c = path[i];
+        if (c == '"' || c == '\\') {
+            m_batch += '\\';
+            m_batch += c;
+        }
+        else if (c < 0x20 || c == 0x7f) {
+            char esc[8];
+            snprintf(esc, sizeof esc, "\\u%04x", c);
+            m_batch += esc;
+        }
+        else {
+            m_batch += c;
+        }
+    }
+    char tail[320];
+    char *p = tail;
+    p += sprintf(p, "\",\"status\":%d,\"bytes\":%llu,\"reuse\":%u", e.status,
+                 (unsigned long long)e.bytes, e.reuse);
+    // 连接已存在的时间，以及请求各阶段相对于读到第一个字节的时间
+    p = put_offset(p, "conn_age_us", start, e.accept);
+    p = put_offset(p, "parsed_us", e.parsed, start);
+    p = put_offset(p, "dequeued_us", e.dequeued, start);
+    p = put_offset(p, "first_write_us", e.first_write, start);
+    p = put_offset(p, "last_write_us", e.last_write, start);
+    *p++ = '}';
+    *p++ = '\n';
+    m_batch.append(tail, p - tail);
+}
+
+void AccessLog::drain(ThreadRings::Slot *slot)
+{
+    while (true) {
+        uint64_t pos = slot->ring.peek([&](const char *data, uint32_t len) {
+            if (m_batch.size() >= BATCH_SIZE)
+                return false;
+            AccessEntry entry;
+            memcpy(&entry, data, sizeof entry);
+            format(entry, data + sizeof entry, len - sizeof entry);
+            return true;
+        });
+        slot->ring.consume(pos);
+        if (m_batch.size() < BATCH_SIZE)
+            break;
+        flush();
+    }
+    uint64_t dropped = slot->dropped.load(std::memory_order_relaxed);
+    if (dropped != slot->reported) {
+        LOG_WARN("Access log buffer of thread %ld full, dropped %llu entries", slot->tid,
+                 (unsigned long long)(dropped - slot->reported));
+        slot->reported = dropped;
+    }
+}
+
+void AccessLog::flush()
+{
+    if (m_batch.empty())
+        return;
+    if (m_fd != -1 && m_filesize > 0 && m_filesize + m_batch.size() > m_maxsize)
+        rotate();
+    if (m_fd == -1 && !open_file()) {
+        m_batch.clear();
+        return;
+    }
+    const char *p = m_batch.data();
+    size_t left = m_batch.size();
+    while (left > 0) {
+        ssize_t ret = ::write(m_fd, p, left);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Write access log failed: %s", strerror(errno));
+            break;
+        }
+        p += ret;
+        left -= ret;
+    }
+    m_filesize += m_batch.size() - left;
+    m_batch.clear();
+}
+
+bool AccessLog::open_file()
+{
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        LOG_ERROR("Open access log %s failed: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    m_filesize = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    return true;
+}
+
+// name.log.<i>依次后移，最旧的被覆盖，当前文件变为name.log.1
+void AccessLog::rotate()
+{
+    close(m_fd);
+    m_fd = -1;
+    for (int i = m_maxfiles - 1; i >= 1; --i) {
+        std::string from = m_path + "." + std::to_string(i);
+        std::string to = m_path + "." + std::to_string(i + 1);
+        rename(from.c_str(), to.c_str());
+    }
+    if (m_maxfiles > 0)
+        rename(m_path.c_str(), (m_path + ".1").c_str());
+    else
+        unlink(m_path.c_str());
+}
+
+void AccessLog::work()
+{
+    std::vector<ThreadRings::Slot *> slots;
+    while (true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> ulk(m_mutex);
+            if (!m_shutdown)
+                m_cv.wait_for(ulk, std::chrono::milliseconds(m_flushms));
+            stop = m_shutdown;
+        }
+        m_rings.snapshot(slots);
+        for (auto slot : slots)
+            drain(slot);
+        flush();
+        if (stop)
+            return;
+    }
+}
+
+AccessLog::~AccessLog()
+{
+    if (m_thread.joinable()) {
+        m_enabled.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+    if (m_fd != -1)
+        close(m_fd);
+}
@@ -0,0 +1,197 @@
+#include "admin.h"
+#include "log.h"
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+void Admin::add_setting(const std::string &name, const std::string &help, Getter getter,
+                        Setter setter)
+{
+    m_settings[name] = Setting{help, std::move(getter), std::move(setter)};
+}
+
+void Admin::add_command(const std::string &name, const std::string &help, Command command)
+{
+    m_commands[name] = Entry{help, std::move(command)};
+}
+
+bool Admin::start(const std::string &path)
+{
+    if (m_thread.joinable())
+        return false;
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        LOG_ERROR("Admin socket path too long: %s", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    m_listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listenfd < 0)
+        return false;
+    // 上次运行遗留的套接字文件会导致bind失败
+    unlink(path.c_str());
+    // 管理接口可以修改服务器配置，只允许属主访问
+    mode_t old = umask(0077);
+    int ret = bind(m_listenfd, (sockaddr *)&addr, sizeof addr);
+    umask(old);
+    if (ret < 0 || listen(m_listenfd, 8) < 0) {
+        LOG_ERROR("Admin socket %s failed: %s", path.c_str(), strerror(errno));
+        close(m_listenfd);
+        m_listenfd = -1;
+        return false;
+    }
+    m_path = path;
+    struct stat st;
+    m_ino = stat(path.c_str(), &st) == 0 ? st.st_ino : 0;
+    m_thread = std::thread(&Admin::work, this);
+    LOG_INFO("Admin socket listening at %s", path.c_str());
+    return true;
+}
+
+static std::vector<std::string> split(const std::string &line)
+{
+    std::vector<std::string> args;
+    size_t pos = 0;
+    while (true) {
+        pos = line.find_first_not_of(" \t\r", pos);
+        if (pos == std::string::npos)
+            break;
+        size_t end = line.find_first_of(" \t\r", pos);
+        args.push_back(line.substr(pos, end == std::string::npos ? end : end - pos));
+        pos = end;
+    }
+    return args;
+}
+
+std::string Admin::execute(const std::string &line)
+{
+    std::vector<std::string> args = split(line);
+    if (args.empty())
+        return "";
+    std::string cmd = args[0];
+    args.erase(args.begin());
+    if (cmd == "help") {
+        std::string out = "get [NAME]          show settings\n"
+                          "set NAME VALUE      change a setting\n";
+        for (auto &kv : m_commands) {
+            char buf[512];
+            snprintf(buf, sizeof buf, "%-19s %s\n", kv.first.c_str(), kv.second.help.c_str());
+            out += buf;
+        }
+        out += "Settings:\n";
+        for (auto &kv : m_settings) {
+            char buf[512];
+            snprintf(buf, sizeof buf, "  %-17s %s%s\n", kv.first.c_str(), kv.second.help.c_str(),
+                     kv.second.setter ? "" : " (read-only)");
+            out += buf;
+        }
+        return out;
+    }
+    if (cmd == "get") {
+        std::string out;
+        for (auto &kv : m_settings) {
+            if (args.empty() || args[0] == kv.first)
+                out += kv.first + " " + kv.second.getter() + "\n";
+        }
+        if (out.empty())
+            return args.empty() ? "\n" : "ERR unknown setting " + args[0] + "\n";
+        return out;
+    }
+    if (cmd == "set") {
+        if (args.size() != 2)
+            return "ERR usage: set NAME VALUE\n";
+        auto it = m_settings.find(args[0]);
+        if (it == m_settings.end())
+            return "ERR unknown setting " + args[0] + "\n";
+        if (!it->second.setter)
+            return "ERR " + args[0] + " is read-only\n";
+        if (!it->second.setter(args[1]))
+            return "ERR bad value for " + args[0] + ": " + args[1] + "\n";
+        LOG_WARN("Admin set %s to %s", args[0].c_str(), args[1].c_str());
+        return "OK " + args[0] + " " + it->second.getter() + "\n";
+    }
+    auto it = m_commands.find(cmd);
+    if (it == m_commands.end())
+        return "ERR unknown command " + cmd + ", try help\n";
+    return it->second.command(args);
+}
+
+bool Admin::serve(Client &client)
+{
+    char buf[1024];
+    ssize_t n = recv(client.fd, buf, sizeof buf, 0);
+    if (n <= 0)
+        return n < 0 && errno == EINTR;
+    client.in.append(buf, n);
+    size_t eol;
+    while ((eol = client.in.find('\n')) != std::string::npos) {
+        std::string reply = execute(client.in.substr(0, eol));
+        client.in.erase(0, eol + 1);
+        if (!reply.empty() && reply.back() != '\n')
+            reply += '\n';
+        reply += '\n';
+        // 应答很短，阻塞发送即可
+        if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size())
+            return false;
+    }
+    return client.in.size() <= MAX_LINE;
+}
+
+// 管理流量很少，使用poll轮询监听套接字和客户端，定期检查退出标志
+void Admin::work()
+{
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    while (!m_shutdown.load(std::memory_order_relaxed)) {
+        fds.clear();
+        fds.push_back({m_listenfd, POLLIN, 0});
+        for (auto &c : clients)
+            fds.push_back({c.fd, POLLIN, 0});
+        int ret = poll(fds.data(), fds.size(), 200);
+        if (ret <= 0)
+            continue;
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (fds[i + 1].revents && !serve(clients[i])) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(m_listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            if (clients.size() >= MAX_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            clients.push_back(Client{fd, std::string()});
+        }
+    }
+    for (auto &c : clients)
+        close(c.fd);
+}
+
+void Admin::stop()
+{
+    if (m_thread.joinable()) {
+        m_shutdown.store(true);
+        m_thread.join();
+    }
+    if (m_listenfd != -1) {
+        close(m_listenfd);
+        m_listenfd = -1;
+        // 平滑升级后新进程已在同一路径创建了套接字，不能删除
+        struct stat st;
+        if (stat(m_path.c_str(), &st) == 0 && st.st_ino == m_ino)
+            unlink(m_path.c_str());
+    }
+}
+
+Admin::~Admin()
+{
+    stop();
+}
@@ -0,0 +1,154 @@
+#include "capture.h"
+#include "log.h"
+#include <fcntl.h>
+#include <time.h>
+
+using namespace capbin;
+
+bool Capture::open(const std::string &path, size_t maxsize)
+{
+    // 每次运行只捕获一次，达到大小上限停止后不再重新打开
+    if (m_thread.joinable())
+        return false;
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        LOG_ERROR("Open capture %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    m_path = path;
+    m_maxsize = maxsize;
+    timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.realtime_ns = real.tv_sec * 1000000000ull + real.tv_nsec;
+    m_batch.reserve(BATCH_SIZE + 4096);
+    m_batch.append((const char *)&header, sizeof header);
+    m_start = now();
+    m_thread = std::thread(&Capture::work, this);
+    m_enabled.store(true, std::memory_order_release);
+    LOG_INFO("Capturing traffic to %s", path.c_str());
+    return true;
+}
+
+uint32_t Capture::open_conn()
+{
+    if (!enabled())
+        return 0;
+    uint32_t conn = getInstance().m_next_conn.fetch_add(1, std::memory_order_relaxed) + 1;
+    record(OPEN, conn);
+    return conn;
+}
+
+void Capture::record(RECORD_TYPE type, uint32_t conn, const char *data, size_t len)
+{
+    Capture &capture = getInstance();
+    if (!capture.m_enabled.load(std::memory_order_acquire))
+        return;
+    ThreadRings::Slot *slot = capture.m_rings.local();
+    char *buf = slot->ring.reserve(sizeof(RecordHeader) + len);
+    if (!buf) {
+        // 丢弃的数据会使回放的请求不完整，由后台线程告警
+        slot->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    RecordHeader hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.len = len;
+    hdr.type = type;
+    hdr.conn = conn;
+    hdr.ts = now() - capture.m_start;
+    memcpy(buf, &hdr, sizeof hdr);
+    if (len)
+        memcpy(buf + sizeof hdr, data, len);
+    slot->ring.commit(sizeof hdr + len);
+}
+
+void Capture::drain(ThreadRings::Slot *slot)
+{
+    while (true) {
+        uint64_t pos = slot->ring.peek([&](const char *data, uint32_t len) {
+            if (m_batch.size() >= BATCH_SIZE)
+                return false;
+            m_batch.append(data, len);
+            return true;
+        });
+        slot->ring.consume(pos);
+        if (m_batch.size() < BATCH_SIZE)
+            break;
+        flush();
+    }
+    uint64_t dropped = slot->dropped.load(std::memory_order_relaxed);
+    if (dropped != slot->reported) {
+        LOG_WARN("Capture buffer of thread %ld full, dropped %llu records", slot->tid,
+                 (unsigned long long)(dropped - slot->reported));
+        slot->reported = dropped;
+    }
+}
+
+// 只写出完整的批量缓冲，达到大小上限后停止捕获，文件中不会出现截断的记录
+void Capture::flush()
+{
+    if (m_batch.empty() || m_fd == -1) {
+        m_batch.clear();
+        return;
+    }
+    if (m_filesize + m_batch.size() > m_maxsize) {
+        m_enabled.store(false, std::memory_order_relaxed);
+        LOG_WARN("Capture %s reached %lu bytes, stopped", m_path.c_str(), m_filesize);
+        close(m_fd);
+        m_fd = -1;
+        m_batch.clear();
+        return;
+    }
+    const char *p = m_batch.data();
+    size_t left = m_batch.size();
+    while (left > 0) {
+        ssize_t ret = ::write(m_fd, p, left);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Write capture failed: %s", strerror(errno));
+            break;
+        }
+        p += ret;
+        left -= ret;
+    }
+    m_filesize += m_batch.size() - left;
+    m_batch.clear();
+}
+
+void Capture::work()
+{
+    std::vector<ThreadRings::Slot *> slots;
+    while (true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> ulk(m_mutex);
+            if (!m_shutdown)
+                m_cv.wait_for(ulk, std::chrono::milliseconds(100));
+            stop = m_shutdown;
+        }
+        m_rings.snapshot(slots);
+        for (auto slot : slots)
+            drain(slot);
+        flush();
+        if (stop)
+            return;
+    }
+}
+
+Capture::~Capture()
+{
+    if (m_thread.joinable()) {
+        m_enabled.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+    if (m_fd != -1)
+        close(m_fd);
+}
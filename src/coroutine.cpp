@@ -0,0 +1,189 @@
+#include "coroutine.h"
+
+#ifdef MANGO_COROUTINES
+
+#include "log.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/timerfd.h>
+
+std::coroutine_handle<> CoTask::promise_type::FinalAwaiter::await_suspend(
+    std::coroutine_handle<promise_type> h) noexcept
+{
+    promise_type &p = h.promise();
+    if (p.continuation)
+        return p.continuation;
+    // 顶层任务由调度器持有，结束时销毁协程帧后再通知
+    std::function<void()> done = std::move(p.done);
+    CoScheduler::getInstance().forget(h);
+    h.destroy();
+    if (done)
+        done();
+    return std::noop_coroutine();
+}
+
+CoScheduler::CoScheduler()
+    : m_epfd(epoll_create1(EPOLL_CLOEXEC)),
+      m_timerfd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+{
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = m_timerfd;
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_timerfd, &ev);
+}
+
+CoScheduler::~CoScheduler()
+{
+    // 退出时仍挂起的任务直接销毁，不再调用结束回调
+    for (void *addr : m_tasks)
+        std::coroutine_handle<>::from_address(addr).destroy();
+    close(m_timerfd);
+    close(m_epfd);
+}
+
+void CoScheduler::start(CoTask task, std::function<void()> done)
+{
+    CoTask::handle h = task.release();
+    h.promise().done = std::move(done);
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_tasks.insert(h.address());
+    }
+    h.resume();
+}
+
+void CoScheduler::forget(std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_tasks.erase(h.address());
+}
+
+size_t CoScheduler::tasks()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_tasks.size();
+}
+
+void CoScheduler::wait_fd(int fd, uint32_t events, std::coroutine_handle<> h, uint32_t *revents)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_waiters[fd] = Waiter{h, revents};
+    epoll_event ev;
+    // 每次等待只通知一次，恢复前从epoll中移除
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+        (errno != EEXIST || epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+        // 无法等待的fd视为出错，下一轮poll中恢复
+        LOG_ERROR("Coroutine wait on fd %d failed: %s", fd, strerror(errno));
+        m_waiters.erase(fd);
+        *revents = EPOLLERR;
+        m_timers.push(Timer{clock::time_point::min(), h});
+        arm_timer();
+    }
+}
+
+void CoScheduler::wait_until(clock::time_point when, std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_timers.push(Timer{when, h});
+    arm_timer();
+}
+
+void CoScheduler::arm_timer()
+{
+    if (m_timers.empty() || m_timers.top().when >= m_armed)
+        return;
+    m_armed = m_timers.top().when;
+    itimerspec its = {};
+    auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(m_armed - clock::now());
+    // 0会解除定时器，已到期的至少等待1纳秒
+    long long ns = delay.count() > 0 ? delay.count() : 1;
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(m_timerfd, 0, &its, nullptr);
+}
+
+void CoScheduler::poll()
+{
+    epoll_event events[64];
+    int num = epoll_wait(m_epfd, events, 64, 0);
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        for (int i = 0; i < num; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_timerfd) {
+                uint64_t expired;
+                ssize_t n = read(m_timerfd, &expired, sizeof expired);
+                (void)n;
+                continue;
+            }
+            auto it = m_waiters.find(fd);
+            if (it == m_waiters.end())
+                continue;
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+            *it->second.revents = events[i].events;
+            ready.push_back(it->second.handle);
+            m_waiters.erase(it);
+        }
+        clock::time_point now = clock::now();
+        while (!m_timers.empty() && m_timers.top().when <= now) {
+            ready.push_back(m_timers.top().handle);
+            m_timers.pop();
+        }
+        m_armed = clock::time_point::max();
+        arm_timer();
+    }
+    // 在锁外恢复，协程可能再次挂起并重新登记
+    for (auto h : ready)
+        h.resume();
+}
+
+void CoSocket::close()
+{
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool CoSocket::ConnectAwaiter::await_ready()
+{
+    sock.close();
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        result = -1;
+        return true;
+    }
+    sock.m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock.m_fd < 0) {
+        result = -1;
+        return true;
+    }
+    result = ::connect(sock.m_fd, (sockaddr *)&addr, sizeof addr);
+    pending = result < 0 && errno == EINPROGRESS;
+    return !pending;
+}
+
+int CoSocket::ConnectAwaiter::await_resume()
+{
+    if (!pending)
+        return result;
+    int err = 0;
+    socklen_t len = sizeof err;
+    if (getsockopt(sock.m_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return -1;
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+#endif
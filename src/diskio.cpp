@@ -0,0 +1,62 @@
+#include "diskio.h"
+
+void DiskIO::start(unsigned threads)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    if (!m_threads.empty() || m_shutdown)
+        return;
+    for (unsigned i = 0; i < threads; ++i)
+        m_threads.emplace_back(&DiskIO::run, this);
+}
+
+bool DiskIO::submit(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        if (m_threads.empty() || m_shutdown)
+            return false;
+        m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+    return true;
+}
+
+size_t DiskIO::queued()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_jobs.size();
+}
+
+void DiskIO::run()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> ulk(m_mutex);
+            m_cv.wait(ulk, [this]() { return m_shutdown || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+void DiskIO::stop()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_shutdown = true;
+    }
+    m_cv.notify_all();
+    for (std::thread &t : m_threads) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+DiskIO::~DiskIO()
+{
+    stop();
+}
@@ -0,0 +1,259 @@
+#include "handler.h"
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+const char *Params::get(const char *name, size_t &len) const
+{
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(items[i].name, name) == 0) {
+            len = items[i].len;
+            return items[i].value;
+        }
+    }
+    return nullptr;
+}
+
+const char *Headers::get(const char *name) const
+{
+    size_t len = strlen(name);
+    for (int i = 0; i < count; ++i) {
+        if (items[i].name_len == len && strncasecmp(items[i].name, name, len) == 0)
+            return items[i].value;
+    }
+    return nullptr;
+}
+
+bool HandlerTable::insert(const std::string &path, Entry entry)
+{
+    if (path.empty() || path[0] != '/' || path.find('?') != std::string::npos)
+        return false;
+    // 路由模式中的条目可以被重新注册覆盖
+    auto place = [this, &entry](int &slot) {
+        if (slot >= 0) {
+            m_entries[slot] = std::move(entry);
+            return;
+        }
+        slot = m_entries.size();
+        m_entries.push_back(std::move(entry));
+    };
+    const char *begin = path.c_str();
+    const char *p = begin;
+    Node *node = m_root.get();
+    int params = 0;
+    while (*p) {
+        // 参数段和通配段只能紧跟在/之后
+        bool special = p > begin && p[-1] == '/';
+        if (special && *p == ':') {
+            const char *end = strchr(p, '/');
+            if (!end)
+                end = p + strlen(p);
+            std::string name(p + 1, end);
+            if (name.empty() || ++params > Params::MAX_PARAMS)
+                return false;
+            if (!node->param) {
+                node->param.reset(new Node);
+                node->param->name = name;
+            }
+            else if (node->param->name != name) {
+                return false;
+            }
+            node = node->param.get();
+            p = end;
+            continue;
+        }
+        if (special && *p == '*') {
+            std::string name(p + 1);
+            if (name.find('/') != std::string::npos || ++params > Params::MAX_PARAMS ||
+                (node->wildcard >= 0 && node->wildcard_name != name))
+                return false;
+            node->wildcard_name = name;
+            place(node->wildcard);
+            return true;
+        }
+        // 静态段延伸到下一个参数段或通配段之前
+        size_t len = 1;
+        while (p[len] && !(p[len - 1] == '/' && (p[len] == ':' || p[len] == '*')))
+            ++len;
+        size_t k = node->indices.find(p[0]);
+        if (k == std::string::npos) {
+            Node *child = new Node;
+            child->prefix.assign(p, len);
+            node->indices += p[0];
+            node->children.emplace_back(child);
+            node = child;
+            p += len;
+            continue;
+        }
+        Node *child = node->children[k].get();
+        size_t common = 0;
+        while (common < len && common < child->prefix.size() && p[common] == child->prefix[common])
+            ++common;
+        // 只有部分标签相同时在分歧处分裂出中间节点
+        if (common < child->prefix.size()) {
+            std::unique_ptr<Node> mid(new Node);
+            mid->prefix = child->prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            mid->indices += child->prefix[0];
+            mid->children.push_back(std::move(node->children[k]));
+            node->children[k] = std::move(mid);
+            child = node->children[k].get();
+        }
+        node = child;
+        p += common;
+    }
+    place(node->entry);
+    return true;
+}
+
+bool HandlerTable::add_handler(const std::string &path, Handler handler, bool isInline,
+                               bool costly)
+{
+    Entry entry;
+    entry.path = path;
+    entry.handler = std::move(handler);
+    entry.isInline = isInline;
+    entry.costly = costly;
+    return insert(path, std::move(entry));
+}
+
+#ifdef MANGO_COROUTINES
+bool HandlerTable::add_async(const std::string &path, CoHandler handler)
+{
+    Entry entry;
+    entry.path = path;
+    entry.isInline = true;
+    entry.async = std::move(handler);
+    return insert(path, std::move(entry));
+}
+#endif
+
+bool HandlerTable::mount(const std::string &prefix, const std::string &dir)
+{
+    if (dir.empty())
+        return false;
+    std::string path = prefix;
+    while (!path.empty() && path.back() == '/')
+        path.pop_back();
+    path += "/*path";
+    // 读取文件可能阻塞，交给线程池
+    Entry entry;
+    entry.path = path;
+    entry.root = dir;
+    entry.costly = true;
+    return insert(path, std::move(entry));
+}
+
+void HandlerTable::add_static(const std::string &path, const std::string &body,
+                              const char *content_type)
+{
+    auto content = std::make_shared<std::string>(body);
+    add_handler(path, [content, content_type](const Request &, Response &resp) {
+        resp.content_type = content_type;
+        resp.body = content->data();
+        resp.body_len = content->size();
+    });
+}
+
+void HandlerTable::add_redirect(const std::string &path, const std::string &location, int status)
+{
+    auto target = std::make_shared<std::string>(location);
+    add_handler(path, [target, status](const Request &, Response &resp) {
+        resp.status = status;
+        resp.title = status == 301 ? "Moved Permanently" : "Found";
+        resp.location = target->c_str();
+    });
+}
+
+bool HandlerTable::add_file(const std::string &path, const std::string &filename, size_t maxsize)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size > maxsize)
+        return false;
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    add_static(path, ss.str(), mime_type(filename.c_str()));
+    return true;
+}
+
+const HandlerTable::Entry *HandlerTable::find(const char *url, Params *params) const
+{
+    if (params)
+        params->count = 0;
+    if (!url)
+        return nullptr;
+    return match(m_root.get(), url, params);
+}
+
+// node的标签已经匹配，url为其后的剩余部分，以'?'或'\0'结束
+const HandlerTable::Entry *HandlerTable::match(const Node *node, const char *url,
+                                               Params *params) const
+{
+    if (*url == '\0' || *url == '?') {
+        if (node->entry >= 0)
+            return &m_entries[node->entry];
+    }
+    else {
+        size_t k = node->indices.find(*url);
+        if (k != std::string::npos) {
+            const Node *child = node->children[k].get();
+            if (strncmp(url, child->prefix.data(), child->prefix.size()) == 0) {
+                const Entry *e = match(child, url + child->prefix.size(), params);
+                if (e)
+                    return e;
+            }
+        }
+        if (node->param) {
+            size_t len = strcspn(url, "/?");
+            if (len > 0) {
+                int saved = params ? params->count : 0;
+                if (params && params->count < Params::MAX_PARAMS)
+                    params->items[params->count++] = {node->param->name.c_str(), url, len};
+                const Entry *e = match(node->param.get(), url + len, params);
+                if (e)
+                    return e;
+                // 回溯时撤销本段的参数
+                if (params)
+                    params->count = saved;
+            }
+        }
+    }
+    if (node->wildcard >= 0) {
+        if (params && params->count < Params::MAX_PARAMS)
+            params->items[params->count++] = {node->wildcard_name.c_str(), url, strcspn(url, "?")};
+        return &m_entries[node->wildcard];
+    }
+    return nullptr;
+}
+
+const char *method_name(int method)
+{
+    static const char *const names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE",
+                                        "OPTIONS", "CONNECT", "PATCH"};
+    return method >= 0 && method < (int)(sizeof names / sizeof names[0]) ? names[method] : "-";
+}
+
+const char *mime_type(const char *filename)
+{
+    static const std::pair<const char *, const char *> types[] = {
+        {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".js", "application/javascript"}, {".json", "application/json"},
+        {".txt", "text/plain"}, {".png", "image/png"}, {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"}, {".gif", "image/gif"}, {".svg", "image/svg+xml"},
+        {".ico", "image/x-icon"},
+    };
+    const char *ext = strrchr(filename, '.');
+    if (ext) {
+        for (const auto &t : types) {
+            if (strcasecmp(ext, t.first) == 0)
+                return t.second;
+        }
+    }
+    return "application/octet-stream";
+}
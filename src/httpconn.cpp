@@ -1,29 +1,107 @@
 #include "httpconn.h"
 #include "log.h"
+#include "diskio.h"
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 
-// 网站根目录
 static RepInfo ok_200 = RepInfo("2333");
 static RepInfo error_400("Bad Request", "Your request has bad syntax or is inherently impossible to satisfy.\n");
 static RepInfo error_403("Forbidden", "You do not have permission to get file from this server.\n");
 static RepInfo error_404("Not Found", "The requested file was not found on this server.\n");
 static RepInfo error_500("Internal Error", "There was an unusual problem serving the requested file.\n");
-const char *doc_root = "../root";
+static RepInfo created_201("Created", "The file was uploaded.\n");
+static RepInfo error_405("Method Not Allowed", "The method is not allowed for the requested URL.\n");
+static RepInfo error_413("Payload Too Large", "The request body exceeds the limit of this server.\n");
 
 EpollControl &HTTPConn::m_epoller = EpollControl::getInstance();
-int HTTPConn::m_user_count = 0;
+std::atomic<int> HTTPConn::m_user_count{0};
+std::atomic<bool> HTTPConn::m_draining{false};
+std::string HTTPConn::m_upload_dir;
+std::atomic<uint64_t> HTTPConn::m_max_body{1 << 20};
+std::atomic<uint64_t> HTTPConn::m_max_upload{1ULL << 30};
+
+// 上传路径形如/upload/<name>，name只能由字母、数字和._-组成且不以.开头，返回name，不合法时返回nullptr
+static const char UPLOAD_PREFIX[] = "/upload/";
+// splice每次从套接字移入管道的字节数，不超过管道的默认容量
+static const size_t SPLICE_CHUNK = 64 * 1024;
+// 请求体内存超过该大小时在请求结束后释放
+static const size_t BODY_KEEP = 64 * 1024;
+// 待发送的响应或待读取的请求体达到该大小时，在线程池中排入慢队列
+static const size_t SLOW_BYTES = 256 * 1024;
+
+// 不阻塞地检查页缓存的文件长度上限，更大的文件直接交给磁盘IO执行器
+static const size_t RESIDENT_CHECK = 4 << 20;
+// 执行器在发送前读入页缓存并建立映射的长度上限，其后的内容依靠内核预读
+static const size_t PREFETCH_MAX = 16 << 20;
+static const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
+
+// 映射的内容是否全部在页缓存中，发送时不会因缺页读盘
+// 非文件所有者且无写权限时mincore只报告已映射到本进程的页，此时文件总被视为不在缓存中
+static bool resident(void *addr, size_t len)
+{
+    if (len > RESIDENT_CHECK)
+        return false;
+    thread_local std::vector<unsigned char> vec;
+    vec.resize((len + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (mincore(addr, len, vec.data()) < 0)
+        return false;
+    for (unsigned char v : vec) {
+        if (!(v & 1))
+            return false;
+    }
+    return true;
+}
+
+// 在执行器线程中逐页读取映射的内容，使发送线程的writev不再缺页
+static void prefetch(void *addr, size_t len)
+{
+    madvise(addr, len, MADV_WILLNEED);
+    const volatile char *p = static_cast<const volatile char *>(addr);
+    size_t end = std::min(len, PREFETCH_MAX);
+    for (size_t off = 0; off < end; off += PAGE_SIZE)
+        (void)p[off];
+}
+
+static const char *upload_name(const char *url)
+{
+    if (strncmp(url, UPLOAD_PREFIX, sizeof UPLOAD_PREFIX - 1) != 0)
+        return nullptr;
+    const char *name = url + sizeof UPLOAD_PREFIX - 1;
+    size_t len = strspn(name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._-");
+    if (len == 0 || name[len] != '\0' || name[0] == '.')
+        return nullptr;
+    return name;
+}
 
 void HTTPConn::close_conn(bool real_close) 
 {
     if (real_close && (m_sockfd != -1)) {
-        LOG_INFO("Close connection, sock: %d", m_sockfd);
-        m_epoller.removefd(m_sockfd);
-        close(m_sockfd);
+        LOG_INFO<Log::HTTP>("Close connection, sock: %d", m_sockfd);
+        zc_retain();
+        zc_reap();
+        if (!m_zc_holds.empty()) {
+            // 内核仍在引用消息体，套接字交给ZeroCopy，通知全部到达后再关闭
+            epoll_ctl(m_epoller.getfd(), EPOLL_CTL_DEL, m_sockfd, 0);
+            ZeroCopy::getInstance().adopt(m_sockfd, m_zc_done, std::move(m_zc_holds));
+            m_zc_holds.clear();
+        }
+        else {
+            // removefd中已经关闭了fd，不能再次close，否则可能关闭被复用的新连接
+            m_epoller.removefd(m_sockfd);
+        }
         m_sockfd = -1;
+        reset_body();
         m_user_count--;
+        Metrics::add(Metrics::CONN_CLOSED);
+        if (m_capture_id)
+            Capture::record(capbin::CLOSE, m_capture_id);
     }
 }
 
-void HTTPConn::init(int sockfd, ACTOR_MODE amode, TRI_MODE tmode, bool oneshot)
+void HTTPConn::init(int sockfd, ACTOR_MODE amode)
 {
     m_sockfd = sockfd;
 
@@ -32,16 +110,40 @@ void HTTPConn::init(int sockfd, ACTOR_MODE amode, TRI_MODE tmode, bool oneshot)
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
     
     m_actor_mode = amode;
-    m_tri_mode = tmode;
-    m_oneshot = oneshot;
 
-    m_epoller.addfd(sockfd, tmode, oneshot);
+    // 客户端地址，转发给上游时写入X-Forwarded-For
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof peer;
+    m_remote[0] = '\0';
+    if (getpeername(sockfd, (struct sockaddr *)&peer, &peer_len) == 0) {
+        if (peer.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&peer)->sin_addr, m_remote, sizeof m_remote);
+        else if (peer.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&peer)->sin6_addr, m_remote,
+                      sizeof m_remote);
+    }
+
+    m_epoller.addconn(sockfd);
     m_user_count++;
+    Metrics::add(Metrics::CONN_ACCEPTED);
+    m_access = AccessEntry();
+    m_access.accept = AccessLog::now();
+    m_capture_id = Capture::open_conn();
+    m_zc_on = m_zc_off = false;
+    m_zc_seq = m_zc_done = 0;
     init();
 }
 
 void HTTPConn::init() 
 {
+    // 流水线请求：上一个请求之后已读入的数据移到缓冲区开头，留待下一轮解析
+    // 请求体读完时m_checked_idx已位于其末尾
+    int consumed = m_checked_idx;
+    int left = m_read_idx > consumed ? m_read_idx - consumed : 0;
+    if (left > 0)
+        memmove(m_read_buf, m_read_buf + consumed, left);
+    m_pipelined = left > 0 || m_read_more;
+
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
 
@@ -49,12 +151,31 @@ void HTTPConn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    reset_body();
     m_host = 0;
+    m_accept_gzip = false;
+    m_if_none_match = nullptr;
+    m_headers.count = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_read_idx = left;
     m_write_idx = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    m_handler = nullptr;
+    m_params.count = 0;
+    m_response = Response();
+    m_chunk.clear();
+    m_bytes_to_send = 0;
+    m_bytes_have_send = 0;
+    m_zc_body = m_zc_used = false;
+    // 保留连接建立时间和已完成的请求数，其余按请求重新记录
+    AccessEntry last = m_access;
+    m_access = AccessEntry();
+    m_access.accept = last.accept;
+    m_access.reuse = last.reuse;
+    if (m_pipelined)
+        m_access.first_read = AccessLog::now();
+    m_trace_id = Tracer::sample();
+    memset(m_read_buf + left, '\0', READ_BUFFER_SIZE - left);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
 }
@@ -91,37 +212,38 @@ HTTPConn::LINE_STATUS HTTPConn::parse_line()
     return LINE_OPEN;
 }
 
-// 对应epoll的oneshot模式，循环读取直到无数据可读
+// 连接固定为ET模式，循环读取直到无数据可读
 bool HTTPConn::read()
 {
+    TraceSpan span("read", m_trace_id);
     if (m_read_idx >= READ_BUFFER_SIZE)
         return false;
     int bytes_read = 0;
-    // LT模式，只读取一次数据
-    if (m_tri_mode == LT) {
+    m_read_more = false;
+    while (true) {
+        // 缓冲区已满时套接字中可能还有流水线请求，ET模式下不会再通知，处理完当前请求后主动读取
+        if (m_read_idx >= READ_BUFFER_SIZE) {
+            m_read_more = true;
+            break;
+        }
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,
-                          READ_BUFFER_SIZE - m_read_idx, 0);
-        if (bytes_read <= 0)
+                        READ_BUFFER_SIZE - m_read_idx, 0);
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
             return false;
-        m_read_idx += bytes_read;
-        return true;
-    }
-    // ET模式，循环读取直到全部读取完成
-    else {
-        while (true) {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,
-                            READ_BUFFER_SIZE - m_read_idx, 0);
-            if (bytes_read == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                    break;
-                return false;
-            }
-            else if (bytes_read == 0)
-                return false;
-            m_read_idx += bytes_read;
         }
-        return true;
+        else if (bytes_read == 0)
+            return false;
+        if (m_read_idx == 0)
+            m_access.first_read = AccessLog::now();
+        // 捕获与解析器看到的字节完全一致
+        if (m_capture_id)
+            Capture::record(capbin::DATA, m_capture_id, m_read_buf + m_read_idx, bytes_read);
+        m_read_idx += bytes_read;
+        Metrics::add(Metrics::BYTES_IN, bytes_read);
     }
+    return true;
 }
 
 // 解析HTTP请求行
@@ -134,10 +256,16 @@ HTTPConn::HTTP_CODE HTTPConn::parse_request_line(char *text)
         return BAD_REQUEST;
     *m_url++ = '\0'; // 分割字符串
     char *method = text;
-    // 仅支持GET方法
+    // 支持GET方法，以及带请求体的POST和PUT
     if (strcasecmp(method, "GET") == 0) { // 忽略大小写
         m_method = GET;
     }
+    else if (strcasecmp(method, "POST") == 0) {
+        m_method = POST;
+    }
+    else if (strcasecmp(method, "PUT") == 0) {
+        m_method = PUT;
+    }
     else {
         return BAD_REQUEST;
     }
@@ -168,17 +296,29 @@ HTTPConn::HTTP_CODE HTTPConn::parse_headers(char *text)
 {
     // 空行说明解析到了请求末尾，完整解析了请求(buffer初始化为'\0')
     if (text[0] == '\0') {
-        // 若后续还有消息体，则还需要继续解析m_content_length长度
-        if (m_content_length != 0) {
-            // 状态转移至解析消息体
+        // 同时指定两种长度时无法确定请求体的边界
+        if (m_chunked && m_content_length != 0)
+            return BAD_REQUEST;
+        // 若后续还有消息体，则由process_body继续读取
+        // 没有消息体的POST/PUT同样经begin_body判断方法与上传，否则会被当作GET处理
+        if (m_chunked || m_content_length != 0 || m_method != GET) {
             m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+            m_body_start = m_checked_idx;
+            return BODY_REQUEST;
         }
         // 若无消息体，则说明解析完全
         return GET_REQUEST;
     }
+    // 记录头部行，供处理器和反向代理使用
+    const char *colon = strchr(text, ':');
+    if (colon && m_headers.count < Headers::MAX_HEADERS) {
+        Headers::Header &h = m_headers.items[m_headers.count++];
+        h.name = text;
+        h.name_len = colon - text;
+        h.value = colon + 1 + strspn(colon + 1, " \t");
+    }
     // 处理其他头部字段
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
+    if (strncasecmp(text, "Connection:", 11) == 0) {
         text += 11;
         text += strspn(text, " \t");
         // 长连接
@@ -188,40 +328,54 @@ HTTPConn::HTTP_CODE HTTPConn::parse_headers(char *text)
     else if (strncasecmp(text, "Content-Length:", 15) == 0) {
         text += 15;
         text += strspn(text, " \t");
-        m_content_length = atoi(text);
+        char *end;
+        errno = 0;
+        m_content_length = strtoll(text, &end, 10);
+        if (end == text || *end != '\0' || m_content_length < 0 || errno == ERANGE)
+            return BAD_REQUEST;
+    }
+    else if (strncasecmp(text, "Transfer-Encoding:", 18) == 0) {
+        text += 18;
+        text += strspn(text, " \t");
+        // 只支持chunked编码
+        if (strcasecmp(text, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+    }
+    else if (strncasecmp(text, "Expect:", 7) == 0) {
+        text += 7;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "100-continue") == 0)
+            m_expect_continue = true;
     }
     else if (strncasecmp(text, "Host:", 5) == 0) {
         text += 5;
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0) {
+        text += 16;
+        m_accept_gzip = strcasestr(text, "gzip") != nullptr;
+    }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0) {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
     else {
         // LOG_WARN("Can't handle this header: %s", text);
     }
     return NO_REQUEST;
 }
 
-// 解析请求体，但只是检测是否完整读入
-HTTPConn::HTTP_CODE HTTPConn::parse_content(char *text) 
-{
-    // 如果读取数据的末尾位置大于根据请求体长度标识的末尾位置
-    // 说明请求体完全读入了
-    if (m_read_idx >= (m_content_length + m_checked_idx)) {
-        // text仅仅指示当前处理行开头位置的指针
-        text[m_content_length] = '\0';
-        return GET_REQUEST;
-    }
-    return NO_REQUEST;
-}
-
 HTTPConn::HTTP_CODE HTTPConn::process_read()
 {
+    TraceSpan span("process_read", m_trace_id);
     LINE_STATUS linestatus = LINE_OK;
     HTTP_CODE retcode = NO_REQUEST;
     char *text = 0;
     // 主状态机, 从buffer中取出所有的行
-    while (((m_check_state == CHECK_STATE_CONTENT) && (linestatus = LINE_OK))
-        || ((linestatus = parse_line()) == LINE_OK)) {
+    while ((linestatus = parse_line()) == LINE_OK) {
         // startline为行在buffer中的开始位置
         text = get_line();
         m_start_line = m_checked_idx;
@@ -240,102 +394,595 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
                 retcode = parse_headers(text);
                 if (retcode == BAD_REQUEST)
                     return BAD_REQUEST;
-                else if (retcode == GET_REQUEST) {
-                    return do_request();
+                else if (retcode == GET_REQUEST || retcode == BODY_REQUEST) {
+                    return retcode;
                 }
                 break;
             }
-            case CHECK_STATE_CONTENT: {
-                retcode = parse_content(text);
-                if (retcode == GET_REQUEST)
-                    return do_request();
-                linestatus = LINE_OPEN;
-                break;
-            }
             default: {
                 return INTERNAL_ERROR;
             }
         }
     }
-    // 若读取行不完整
+    // 若读取行不完整，请求超出读缓冲区时无法再读入，视为错误请求
     if (linestatus == LINE_OPEN)
-        return NO_REQUEST;
+        return m_read_idx >= READ_BUFFER_SIZE ? BAD_REQUEST : NO_REQUEST;
     else 
         return BAD_REQUEST;
 }
 
+HTTPConn::HTTP_CODE HTTPConn::begin_body()
+{
+    route();
+    const char *name = upload_name(m_url);
+    if (name && !m_upload_dir.empty() && (m_method == PUT || m_method == POST)) {
+        m_body_limit = m_max_upload.load(std::memory_order_relaxed);
+        if (!m_chunked && (uint64_t)m_content_length > m_body_limit)
+            return TOO_LARGE;
+        // 先写入临时文件，完整接收后再改名，读取方不会看到写了一半的文件
+        m_upload_path = m_upload_dir + "/" + name;
+        // 多个工作进程共用上传目录，临时文件名由mkostemp生成以免相互覆盖
+        m_upload_tmp = m_upload_dir + "/." + name + ".XXXXXX";
+        m_upload_fd = mkostemp(&m_upload_tmp[0], O_CLOEXEC);
+        if (m_upload_fd >= 0)
+            fchmod(m_upload_fd, 0644);
+        if (m_upload_fd < 0) {
+            LOG_ERROR("Open upload file %s failed: %s", m_upload_tmp.c_str(), strerror(errno));
+            m_upload_tmp.clear();
+            return INTERNAL_ERROR;
+        }
+        m_body_sink = SINK_FILE;
+        // 捕获流量时需要看到请求体，只能经用户态读取
+        if (!m_chunked && !m_capture_id && pipe2(m_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+            m_pipe[0] = m_pipe[1] = -1;
+    }
+    else if ((m_handler && !m_handler->is_mount()) || m_method == GET) {
+        m_body_limit = m_max_body.load(std::memory_order_relaxed);
+        if (!m_chunked && (uint64_t)m_content_length > m_body_limit)
+            return TOO_LARGE;
+        // GET请求的请求体没有语义，读完后丢弃
+        m_body_sink = m_handler && !m_handler->is_mount() ? SINK_MEMORY : SINK_DISCARD;
+    }
+    else {
+        return BAD_METHOD;
+    }
+    m_body_state = m_chunked ? BODY_CHUNK_SIZE : BODY_IDENTITY;
+    m_body_left = m_chunked ? 0 : m_content_length;
+    // 客户端在收到100 Continue前不发送请求体，已经读到请求体时说明客户端没有等待
+    if (m_expect_continue && (m_chunked || m_content_length != 0) && m_read_idx == m_body_start) {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(m_sockfd, cont, sizeof cont - 1, MSG_NOSIGNAL);
+    }
+    return NO_REQUEST;
+}
+
+HTTPConn::HTTP_CODE HTTPConn::consume_body(const char *data, size_t len)
+{
+    m_body_received += len;
+    if (m_body_received > m_body_limit)
+        return TOO_LARGE;
+    if (m_body_sink == SINK_MEMORY) {
+        m_body.append(data, len);
+    }
+    else if (m_body_sink == SINK_FILE) {
+        while (len > 0) {
+            ssize_t n = ::write(m_upload_fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR("Write upload file %s failed: %s", m_upload_tmp.c_str(), strerror(errno));
+                return INTERNAL_ERROR;
+            }
+            data += n;
+            len -= n;
+        }
+    }
+    return NO_REQUEST;
+}
+
+// 解码[m_checked_idx, m_read_idx)中的请求体，未解码完的部分移到请求体区域开头
+HTTPConn::HTTP_CODE HTTPConn::decode_body()
+{
+    int pos = m_checked_idx;
+    HTTP_CODE ret = NO_REQUEST;
+    while (ret == NO_REQUEST && m_body_state != BODY_DONE) {
+        int avail = m_read_idx - pos;
+        if (m_body_state == BODY_IDENTITY || m_body_state == BODY_CHUNK_DATA) {
+            if (m_body_left == 0) {
+                m_body_state = m_body_state == BODY_IDENTITY ? BODY_DONE : BODY_CHUNK_CRLF;
+                continue;
+            }
+            if (avail == 0)
+                break;
+            size_t n = std::min<uint64_t>(avail, m_body_left);
+            ret = consume_body(m_read_buf + pos, n);
+            pos += n;
+            m_body_left -= n;
+            continue;
+        }
+        // 其余状态按行解析，行以\r\n结尾
+        char *line = m_read_buf + pos;
+        char *eol = (char *)memchr(line, '\n', avail);
+        if (!eol)
+            break;
+        pos = eol - m_read_buf + 1;
+        if (eol == line || eol[-1] != '\r') {
+            ret = BAD_REQUEST;
+            break;
+        }
+        eol[-1] = '\0';
+        switch (m_body_state) {
+            case BODY_CHUNK_SIZE: {
+                // 块长度为十六进制，其后可能带有以;开始的扩展
+                char *end;
+                errno = 0;
+                unsigned long long size = strtoull(line, &end, 16);
+                if (!isxdigit((unsigned char)line[0]) || errno == ERANGE ||
+                    (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+                    ret = BAD_REQUEST;
+                else if (size == 0)
+                    m_body_state = BODY_TRAILER;
+                else {
+                    m_body_left = size;
+                    m_body_state = BODY_CHUNK_DATA;
+                }
+                break;
+            }
+            case BODY_CHUNK_CRLF: {
+                if (line[0] != '\0')
+                    ret = BAD_REQUEST;
+                m_body_state = BODY_CHUNK_SIZE;
+                break;
+            }
+            default: {
+                // 尾部字段直接忽略，空行结束请求体
+                if (line[0] == '\0')
+                    m_body_state = BODY_DONE;
+                break;
+            }
+        }
+    }
+    m_checked_idx = pos;
+    if (ret != NO_REQUEST)
+        return ret;
+    if (m_body_state == BODY_DONE)
+        return finish_body();
+    if (pos > m_body_start) {
+        memmove(m_read_buf + m_body_start, m_read_buf + pos, m_read_idx - pos);
+        m_read_idx -= pos - m_body_start;
+        m_checked_idx = m_body_start;
+    }
+    return NO_REQUEST;
+}
+
+HTTPConn::HTTP_CODE HTTPConn::read_body()
+{
+    TraceSpan span("read_body", m_trace_id);
+    while (true) {
+        HTTP_CODE ret = decode_body();
+        if (ret != NO_REQUEST)
+            return ret;
+        // 缓冲区中的请求体已经取完，其余部分不再经过缓冲区
+        if (m_pipe[0] != -1)
+            return splice_body();
+        int room = READ_BUFFER_SIZE - m_read_idx;
+        // identity请求体只读到其末尾，其后的流水线请求留在套接字中
+        if (m_body_state == BODY_IDENTITY && (uint64_t)room > m_body_left)
+            room = m_body_left;
+        // chunked的一行超出了缓冲区
+        if (room <= 0)
+            return BAD_REQUEST;
+        ssize_t n = recv(m_sockfd, m_read_buf + m_read_idx, room, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return NO_REQUEST;
+            if (errno == EINTR)
+                continue;
+            return CLOSED_CONNECTION;
+        }
+        if (n == 0)
+            return CLOSED_CONNECTION;
+        if (m_capture_id)
+            Capture::record(capbin::DATA, m_capture_id, m_read_buf + m_read_idx, n);
+        m_read_idx += n;
+        Metrics::add(Metrics::BYTES_IN, n);
+    }
+}
+
+HTTPConn::HTTP_CODE HTTPConn::splice_body()
+{
+    while (m_body_left > 0) {
+        size_t want = std::min<uint64_t>(m_body_left, SPLICE_CHUNK);
+        ssize_t n = splice(m_sockfd, nullptr, m_pipe[1], nullptr, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return NO_REQUEST;
+            if (errno == EINTR)
+                continue;
+            return CLOSED_CONNECTION;
+        }
+        if (n == 0)
+            return CLOSED_CONNECTION;
+        Metrics::add(Metrics::BYTES_IN, n);
+        m_body_received += n;
+        m_body_left -= n;
+        // 管道清空后才再次读取套接字，上面的EAGAIN只可能来自套接字
+        while (n > 0) {
+            ssize_t m = splice(m_pipe[0], nullptr, m_upload_fd, nullptr, n, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0) {
+                LOG_ERROR("Splice upload file %s failed: %s", m_upload_tmp.c_str(), strerror(errno));
+                return INTERNAL_ERROR;
+            }
+            n -= m;
+        }
+    }
+    m_body_state = BODY_DONE;
+    return finish_body();
+}
+
+HTTPConn::HTTP_CODE HTTPConn::finish_body()
+{
+    // 读取请求体时未必读到EAGAIN，ET模式下套接字中剩余的流水线请求需要主动读取
+    m_read_more = true;
+    if (m_body_sink != SINK_FILE)
+        return GET_REQUEST;
+    close(m_upload_fd);
+    m_upload_fd = -1;
+    if (rename(m_upload_tmp.c_str(), m_upload_path.c_str()) < 0) {
+        LOG_ERROR("Rename upload file %s failed: %s", m_upload_tmp.c_str(), strerror(errno));
+        return INTERNAL_ERROR;
+    }
+    m_upload_tmp.clear();
+    LOG_INFO<Log::HTTP>("Uploaded %s, %llu bytes", m_upload_path.c_str(),
+                        (unsigned long long)m_body_received);
+    return UPLOAD_REQUEST;
+}
+
+void HTTPConn::reset_body()
+{
+    if (m_upload_fd != -1) {
+        close(m_upload_fd);
+        m_upload_fd = -1;
+    }
+    if (!m_upload_tmp.empty()) {
+        unlink(m_upload_tmp.c_str());
+        m_upload_tmp.clear();
+    }
+    if (m_pipe[0] != -1) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+    if (m_body.capacity() > BODY_KEEP)
+        std::string().swap(m_body);
+    else
+        m_body.clear();
+    m_chunked = false;
+    m_expect_continue = false;
+    m_body_sink = SINK_NONE;
+    m_body_state = BODY_IDENTITY;
+    m_body_start = 0;
+    m_body_left = 0;
+    m_body_received = 0;
+    m_body_limit = 0;
+}
+
+void HTTPConn::fill_request(Request &req)
+{
+    req = Request();
+    req.method = m_method;
+    req.url = m_url;
+    req.host = m_host;
+    req.accept_gzip = m_accept_gzip;
+    req.if_none_match = m_if_none_match;
+    req.keepalive = m_linger;
+    req.remote = m_remote;
+    req.headers = m_headers;
+    if (!m_body.empty()) {
+        req.body = m_body.data();
+        req.body_len = m_body.size();
+    }
+    req.params = m_params;
+}
+
+HTTPConn::HTTP_CODE HTTPConn::do_handler()
+{
+    Request req;
+    fill_request(req);
+    m_handler->handler(req, m_response);
+    return HANDLER_REQUEST;
+}
+
+#ifdef MANGO_COROUTINES
+HTTPConn::HTTP_CODE HTTPConn::do_async()
+{
+    fill_request(m_async_req);
+    m_async_code = HANDLER_REQUEST;
+    m_async.store(ASYNC_STARTING, std::memory_order_release);
+    CoScheduler::getInstance().start(m_handler->async(m_async_req, m_response),
+                                     [this]() { async_done(); });
+    return ASYNC_REQUEST;
+}
+#endif
+
+void HTTPConn::async_done()
+{
+    // 持有者尚未退出时由其在park中继续
+    if (m_async.exchange(ASYNC_DONE, std::memory_order_acq_rel) == ASYNC_PARKED)
+        finish_async();
+}
+
+void HTTPConn::park()
+{
+    if (m_async.exchange(ASYNC_PARKED, std::memory_order_acq_rel) == ASYNC_DONE)
+        finish_async();
+}
+
+void HTTPConn::finish_async()
+{
+    m_async.store(ASYNC_IDLE, std::memory_order_release);
+    if (!process_write(m_async_code) || !write()) {
+        close_conn();
+        return;
+    }
+    // 挂起期间投递的事件已无法区分是否处理过，直接放弃处理权，由EPOLL_CTL_MOD按套接字当前状态重新通知
+    // 之后连接可能已被其他线程处理，不能再访问成员
+    int fd = m_sockfd;
+    m_pending.store(0, std::memory_order_release);
+    m_epoller.rearm(fd);
+}
+
 // 如果请求的文件存在、可读且不是目录，则将其内存映射
+// 磁盘IO执行器开启时先不阻塞地尝试：路径在dentry缓存中且内容全部在页缓存中时直接应答，
+// 否则交给执行器打开文件并读入页缓存，由执行器线程发送响应，冷文件不会阻塞主线程和工作线程
 HTTPConn::HTTP_CODE HTTPConn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    // 拼接请求的URL和网站根目录
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    if (stat(m_real_file, &m_file_stat) < 0) {
+    // 挂载路由的通配段捕获的是相对于挂载目录的路径
+    const Params::Param &rel = m_params.items[m_params.count - 1];
+    int len = snprintf(m_real_file, FILENAME_LEN, "%s/%.*s", m_handler->root.c_str(),
+                       (int)rel.len, rel.value);
+    if (len >= FILENAME_LEN)
         return NO_RESOURCE;
+    DiskIO &io = DiskIO::getInstance();
+    if (!io.enabled())
+        return open_file(false);
+    HTTP_CODE ret = open_file(true);
+    if (ret != ASYNC_REQUEST) {
+        Metrics::add(Metrics::FILE_CACHED);
+        return ret;
+    }
+    m_async.store(ASYNC_STARTING, std::memory_order_release);
+    bool submitted = io.submit([this]() {
+        m_async_code = open_file(false);
+        async_done();
+    });
+    if (!submitted) {
+        m_async.store(ASYNC_IDLE, std::memory_order_release);
+        return open_file(false);
+    }
+    Metrics::add(Metrics::FILE_OFFLOADED);
+    return ASYNC_REQUEST;
+}
+
+HTTPConn::HTTP_CODE HTTPConn::open_file(bool cached)
+{
+    int fd;
+    if (cached) {
+        // RESOLVE_CACHED：路径查找需要读盘时以EAGAIN失败
+        struct open_how how;
+        memset(&how, 0, sizeof how);
+        how.flags = O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+        how.resolve = RESOLVE_CACHED;
+        fd = syscall(SYS_openat2, AT_FDCWD, m_real_file, &how, sizeof how);
+        // 内核不支持openat2或RESOLVE_CACHED时同样交给执行器
+        if (fd < 0 && (errno == EAGAIN || errno == ENOSYS || errno == EINVAL || errno == E2BIG))
+            return ASYNC_REQUEST;
+    }
+    else {
+        // O_NONBLOCK避免打开FIFO时阻塞，对普通文件没有影响
+        fd = open(m_real_file, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+    if (fd < 0)
+        return errno == EACCES ? FORBIDDEN_REQUEST : NO_RESOURCE;
+    HTTP_CODE ret = FILE_REQUEST;
+    if (fstat(fd, &m_file_stat) < 0)
+        ret = NO_RESOURCE;
+    else if (!(m_file_stat.st_mode & S_IROTH)) // 其他用户组的读权限
+        ret = FORBIDDEN_REQUEST;
+    else if (S_ISDIR(m_file_stat.st_mode))
+        ret = BAD_REQUEST;
+    else if (m_file_stat.st_size > 0) {
+        // 在执行器中打开时先让内核异步预读整个文件
+        if (!cached)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        void *addr = mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+            ret = INTERNAL_ERROR;
+        else {
+            m_file_address = (char *)addr;
+            if (!cached)
+                prefetch(addr, m_file_stat.st_size);
+            else if (!resident(addr, m_file_stat.st_size)) {
+                unmap();
+                ret = ASYNC_REQUEST;
+            }
+        }
     }
-    if (!(m_file_stat.st_mode & S_IROTH)) // 其他用户组的读权限
-        return FORBIDDEN_REQUEST;
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ,
-                                  MAP_PRIVATE, fd, 0);
     close(fd);
-    return FILE_REQUEST;
+    return ret;
 }
 
 // 取消内存映射
 void HTTPConn::unmap()
 {
+    zc_retain();
     if (m_file_address) {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = NULL;
     }
 }
 
-// 写HTTP响应
+// 写HTTP响应，返回false表示需要关闭连接
 bool HTTPConn::write() 
 {
+    TraceSpan span("write", m_trace_id);
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if (bytes_to_send == 0) {
+    if (m_bytes_to_send == 0 && !m_response.stream) {
         // 即发送完成
-        m_epoller.reset_oneshot(m_sockfd, EPOLLIN);
         init();
         return true;
     }
     while (true) {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 已有数据发送完毕，流式响应继续生成下一段，生产者出错时关闭连接
+        if (m_bytes_to_send == 0 && !next_chunk()) {
+            finish_request();
+            return false;
+        }
+        temp = m_zc_body ? send_zerocopy() : writev(m_sockfd, m_iv, m_iv_count);
         if (temp <= -1) {
-            // 若写缓存满，等待下一轮EPOLLOUT事件
+            // 若写缓存满，等待下一次EPOLLOUT事件，连接注册时已关注EPOLLOUT，无需重新注册
             if (errno == EAGAIN) {
-                m_epoller.reset_oneshot(m_sockfd, EPOLLOUT);
                 return true;
             }
             unmap();
+            finish_request();
             return false;
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        // bytes_to_send <= bytes_have_send 为什么这么写？
-        if (bytes_to_send <= 0) { 
+        if (m_bytes_have_send == 0)
+            m_access.first_write = AccessLog::now();
+        m_bytes_to_send -= temp;
+        m_bytes_have_send += temp;
+        Metrics::add(Metrics::BYTES_OUT, temp);
+        if (m_bytes_to_send <= 0) { 
+            if (m_response.stream)
+                continue;
+            m_access.last_write = AccessLog::now();
             // 发送HTTP响应成功，根据HTTP请求中的长连接属性决定连接关闭
             unmap();
+            finish_request();
             if (m_linger) {
+                ++m_access.reuse;
                 init();
-                m_epoller.reset_oneshot(m_sockfd, EPOLLIN);
                 return true;
             }
-            else {
-                m_epoller.reset_oneshot(m_sockfd, EPOLLIN);
-                return false;
-            }
+            return false;
+        }
+        // 部分发送，跳过已写完的iovec，调整第一个未写完的起始位置
+        size_t sent = temp;
+        for (int i = 0; i < m_iv_count && sent > 0; ++i) {
+            size_t n = std::min(sent, m_iv[i].iov_len);
+            m_iv[i].iov_base = (char *)m_iv[i].iov_base + n;
+            m_iv[i].iov_len -= n;
+            sent -= n;
         }
     }
 }
 
+bool HTTPConn::use_zerocopy(size_t len)
+{
+    uint64_t threshold = ZeroCopy::m_threshold.load(std::memory_order_relaxed);
+    if (threshold == 0 || len < threshold || m_zc_off)
+        return false;
+    if (!m_zc_on) {
+        int one = 1;
+        if (setsockopt(m_sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) < 0) {
+            m_zc_off = true;
+            return false;
+        }
+        m_zc_on = true;
+    }
+    return true;
+}
+
+ssize_t HTTPConn::send_zerocopy()
+{
+    if (!m_zc_holds.empty())
+        zc_reap();
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iovlen = 1;
+    // 写缓冲区在下一个请求中会被改写，头部不能以零拷贝发送，MSG_MORE使其与消息体合并为完整的报文段
+    if (m_iv[0].iov_len > 0) {
+        msg.msg_iov = &m_iv[0];
+        return sendmsg(m_sockfd, &msg, MSG_NOSIGNAL | MSG_MORE);
+    }
+    msg.msg_iov = &m_iv[1];
+    ssize_t n = sendmsg(m_sockfd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (n >= 0) {
+        // 每次成功的零拷贝发送占用一个序号
+        ++m_zc_seq;
+        m_zc_used = true;
+        Metrics::add(Metrics::BYTES_ZEROCOPY, n);
+    }
+    else if (errno == ENOBUFS) {
+        // 锁定的页超出套接字的optmem限制，本次改为复制发送
+        n = sendmsg(m_sockfd, &msg, MSG_NOSIGNAL);
+    }
+    return n;
+}
+
+void HTTPConn::zc_retain()
+{
+    if (!m_zc_used)
+        return;
+    m_zc_used = false;
+    ZeroCopy::Hold hold;
+    hold.seq = m_zc_seq - 1;
+    if (m_file_address) {
+        size_t len = m_file_stat.st_size;
+        hold.map.reset(m_file_address, [len](char *p) { munmap(p, len); });
+        m_file_address = NULL;
+    }
+    else if (m_response.body == m_response.owned.data()) {
+        // 零拷贝阈值不小于4096，消息体一定在堆上，移动后数据地址不变
+        hold.owned = std::move(m_response.owned);
+        m_response.body = nullptr;
+    }
+    m_zc_holds.push_back(std::move(hold));
+}
+
+void HTTPConn::zc_reap()
+{
+    bool copied = false;
+    ZeroCopy::reap(m_sockfd, m_zc_done, copied);
+    ZeroCopy::release(m_zc_holds, m_zc_done);
+    // 网卡不支持分散读取或对端在本机时内核会退回复制，此后不再使用零拷贝
+    if (copied)
+        m_zc_off = true;
+}
+
+bool HTTPConn::next_chunk()
+{
+    static const char crlf[] = "\r\n";
+    static const char last_chunk[] = "0\r\n\r\n";
+    m_chunk.clear();
+    bool more = m_response.stream(m_chunk) && !m_chunk.empty();
+    if (m_response.abort) {
+        m_response.stream = nullptr;
+        return false;
+    }
+    m_iv_count = 0;
+    m_bytes_to_send = 0;
+    if (!m_chunk.empty()) {
+        int len = snprintf(m_chunk_head, sizeof m_chunk_head, "%zx\r\n", m_chunk.size());
+        m_iv[0] = {m_chunk_head, (size_t)len};
+        m_iv[1] = {&m_chunk[0], m_chunk.size()};
+        m_iv[2] = {(char *)crlf, 2};
+        m_iv_count = 3;
+        m_bytes_to_send = len + m_chunk.size() + 2;
+    }
+    if (!more) {
+        m_iv[m_iv_count++] = {(char *)last_chunk, sizeof last_chunk - 1};
+        m_bytes_to_send += sizeof last_chunk - 1;
+        // 生产者可能持有处理器的资源，结束后立即释放
+        m_response.stream = nullptr;
+    }
+    return true;
+}
+
 // 向写缓存中写入待发送的数据
 bool HTTPConn::add_response(const char *format, ...) 
 {
@@ -356,6 +1003,7 @@ bool HTTPConn::add_response(const char *format, ...)
 
 bool HTTPConn::add_status_line(int status, const char *title)
 {
+    m_access.status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -371,6 +1019,9 @@ bool HTTPConn::add_content_length(int content_length)
 
 bool HTTPConn::add_linger()
 {
+    // 客户端在新连接上发出的后续请求由新进程处理
+    if (m_draining.load(std::memory_order_relaxed))
+        m_linger = false;
     return add_response("Connection: %s\r\n", m_linger ? "keep-alive" : "close");
 }
 
@@ -384,9 +1035,30 @@ bool HTTPConn::add_content(const char *content)
     return add_response("%s", content);
 }
 
-bool HTTPConn::add_content_type() 
+bool HTTPConn::add_content_type(const char *type) 
+{
+    return add_response("Content-Type: %s\r\n", type);
+}
+
+void HTTPConn::finish_request()
 {
-    return add_response("Content-Type: %s\r\n", "text/html");
+    // 未发送完的响应只记入访问日志，不计入状态码和延迟统计
+    if (m_bytes_to_send <= 0) {
+        Metrics::count_status(m_access.status);
+        if (m_access.first_read)
+            Metrics::observe(Metrics::REQUEST_LATENCY, m_access.last_write - m_access.first_read);
+    }
+    AccessLog &accesslog = AccessLog::getInstance();
+    if (!accesslog.enabled())
+        return;
+    m_access.bytes = m_bytes_have_send;
+    // 请求行解析完成后才有可信的方法和路径
+    const char *path = "-";
+    if (m_version && m_url) {
+        m_access.method = method_name(m_method);
+        path = m_url;
+    }
+    accesslog.record(m_access, path, strlen(path));
 }
 
 // 根据服务器处理请求的结果返回给客户端
@@ -414,6 +1086,28 @@ bool HTTPConn::process_write(HTTP_CODE ret)
                 return false;
             break;
         }
+        case BAD_METHOD: {
+            add_status_line(405, error_405.title);
+            add_headers(strlen(error_405.form));
+            if (!add_content(error_405.form))
+                return false;
+            break;
+        }
+        case TOO_LARGE: {
+            add_status_line(413, error_413.title);
+            add_headers(strlen(error_413.form));
+            if (!add_content(error_413.form))
+                return false;
+            break;
+        }
+        case UPLOAD_REQUEST: {
+            add_status_line(201, created_201.title);
+            add_response("Location: %s\r\n", m_url);
+            add_headers(strlen(created_201.form));
+            if (!add_content(created_201.form))
+                return false;
+            break;
+        }
         case FORBIDDEN_REQUEST: {
             add_status_line(403, error_403.title);
             add_headers(strlen(error_403.form));
@@ -430,6 +1124,8 @@ bool HTTPConn::process_write(HTTP_CODE ret)
                 m_iv[1].iov_base = m_file_address;
                 m_iv[1].iov_len = m_file_stat.st_size;
                 m_iv_count = 2;
+                m_zc_body = use_zerocopy(m_file_stat.st_size);
+                m_bytes_to_send = m_write_idx + m_file_stat.st_size;
                 return true;
             }
             else {
@@ -440,6 +1136,40 @@ bool HTTPConn::process_write(HTTP_CODE ret)
             }
             break;
         }
+        case HANDLER_REQUEST: {
+            Response &resp = m_response;
+            if (!resp.body && !resp.stream) {
+                resp.body = resp.owned.data();
+                resp.body_len = resp.owned.size();
+            }
+            add_status_line(resp.status, resp.title);
+            if (resp.content_type)
+                add_content_type(resp.content_type);
+            if (resp.location)
+                add_response("Location: %s\r\n", resp.location);
+            if (!resp.headers.empty() && !add_response("%s", resp.headers.c_str()))
+                return false;
+            if (resp.stream) {
+                // 头部先单独发送，消息体在write中逐段生成
+                if (!add_response("%s", "Transfer-Encoding: chunked\r\n") || !add_linger() ||
+                    !add_blank_line())
+                    return false;
+                break;
+            }
+            if (!add_headers(resp.body_len))
+                return false;
+            if (resp.body_len != 0) {
+                m_iv[0].iov_base = m_write_buf;
+                m_iv[0].iov_len = m_write_idx;
+                m_iv[1].iov_base = (char *)resp.body;
+                m_iv[1].iov_len = resp.body_len;
+                m_iv_count = 2;
+                m_zc_body = use_zerocopy(resp.body_len);
+                m_bytes_to_send = m_write_idx + resp.body_len;
+                return true;
+            }
+            break;
+        }
         default: {
             return false;
         }
@@ -447,43 +1177,209 @@ bool HTTPConn::process_write(HTTP_CODE ret)
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
     m_iv_count = 1;
+    m_bytes_to_send = m_write_idx;
     return true;
 }
 
-// 处理HTTP请求的入口函数，有线程池的工作线程调用
+// 处理HTTP请求的入口函数，由持有处理权的线程调用
 void HTTPConn::process()
 {
+    if (reading_body()) {
+        process_body();
+        return;
+    }
     HTTP_CODE read_ret = process_read();
-    // 若未读取完整，则重新注册EPOLLIN事件继续检测其输入事件
+    // 若未读取完整，则等待下一次EPOLLIN事件继续读入
     if (read_ret == NO_REQUEST) {
-        m_epoller.reset_oneshot(m_sockfd, EPOLLIN);
         return;
     }
+    if (read_ret == BODY_REQUEST) {
+        process_body();
+        return;
+    }
+    m_access.parsed = AccessLog::now();
+    if (read_ret == GET_REQUEST)
+        route();
+    respond(read_ret);
+}
+
+void HTTPConn::process_body()
+{
+    HTTP_CODE ret = m_body_sink == SINK_NONE ? begin_body() : NO_REQUEST;
+    if (ret == NO_REQUEST)
+        ret = read_body();
+    // 套接字暂无数据，等待下一次EPOLLIN
+    if (ret == NO_REQUEST)
+        return;
+    if (ret == CLOSED_CONNECTION) {
+        close_conn();
+        return;
+    }
+    // 请求体未读完就应答时，剩余数据无法与下一个请求区分，应答后关闭连接
+    if (m_body_state != BODY_DONE) {
+        m_body_state = BODY_DONE;
+        m_linger = false;
+    }
+    m_access.parsed = AccessLog::now();
+    respond(ret);
+}
+
+void HTTPConn::respond(HTTP_CODE read_ret)
+{
+    if (read_ret == GET_REQUEST) {
+        if (!m_handler)
+            read_ret = NO_RESOURCE;
+        else if (m_handler->is_mount())
+            read_ret = do_request();
+#ifdef MANGO_COROUTINES
+        else if (m_handler->is_async())
+            read_ret = do_async();
+#endif
+        else
+            read_ret = do_handler();
+    }
+    // 协程处理器结束后才生成响应
+    if (read_ret == ASYNC_REQUEST)
+        return;
     bool write_ret = process_write(read_ret);
     if (!write_ret) {
         close_conn(); // 默认是断开连接并关闭socket
+        return;
+    }
+    // 直接尝试发送，只有写缓存满时才等待EPOLLOUT
+    if (!write()) {
+        close_conn();
     }
-    m_epoller.reset_oneshot(m_sockfd, EPOLLOUT);
 }
 
-bool HTTPReq::do_request() 
+HTTPConn::IO_STATUS HTTPConn::handle_io(uint32_t ev)
 {
-    if (m_httpconn->m_actor_mode == ACTOR_MODE::REACTOR) {
-        if (m_state == READ) {
-            if (m_httpconn->read()) {
-                m_httpconn->process();
+    if (m_sockfd == -1)
+        return IO_CLOSED;
+    // 零拷贝发送的完成通知同样以EPOLLERR报告，套接字本身没有出错时不关闭连接
+    if ((ev & EPOLLERR) && m_zc_on) {
+        zc_reap();
+        int err = 0;
+        socklen_t len = sizeof err;
+        getsockopt(m_sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err == 0)
+            ev &= ~EPOLLERR;
+    }
+    if (ev & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        LOG_ERROR<Log::HTTP>("EpollError, sockfd: %d, relese rec", m_sockfd);
+        close_conn();
+        return IO_CLOSED;
+    }
+    // 请求体由read_body直接从套接字读取
+    if (reading_body())
+        return (ev & EPOLLIN) ? IO_READ : IO_IDLE;
+    if (m_bytes_to_send > 0) {
+        if (!write()) {
+            close_conn();
+            return IO_CLOSED;
+        }
+        // 响应仍未发送完，新请求留在套接字中，待发送完成后再读取
+        if (m_bytes_to_send > 0)
+            return IO_IDLE;
+    }
+    else if (!(ev & EPOLLIN) && !m_read_more) {
+        return take_pipelined() ? IO_READ : IO_IDLE;
+    }
+    int last_idx = m_read_idx;
+    if (!read()) {
+        close_conn();
+        return IO_CLOSED;
+    }
+    return (m_read_idx > last_idx || take_pipelined()) ? IO_READ : IO_IDLE;
+}
+
+bool HTTPConn::reactor_io()
+{
+    while (true) {
+        // 非inline处理器的流式响应可能耗时，可写事件留给工作线程取出并继续生成
+        // 请求体的读取和写入文件同样交给工作线程
+        if ((m_response.stream && !m_handler->isInline) || reading_body())
+            return true;
+        IO_STATUS status = handle_io(take_events());
+        if (status == IO_READ) {
+            HTTP_CODE read_ret = process_read();
+            if (read_ret == BODY_REQUEST)
+                return true;
+            if (read_ret != NO_REQUEST)
+                m_access.parsed = AccessLog::now();
+            if (read_ret == GET_REQUEST) {
+                route();
+                // 非inline处理器可能阻塞，交给工作线程，未匹配的路由直接应答404
+                // 开启磁盘IO执行器时文件请求在主线程中处理，只有冷文件交给执行器
+                if (m_handler && !m_handler->isInline &&
+                    !(m_handler->is_mount() && DiskIO::getInstance().enabled()))
+                    return true;
             }
-            else {
-                m_httpconn->close_conn();
+            // 错误请求和inline处理器在本次唤醒中直接应答
+            if (read_ret != NO_REQUEST)
+                respond(read_ret);
+            if (m_sockfd == -1)
+                return false;
+            // 协程处理器挂起期间保留处理权，结束后由finish_async放弃
+            if (parked()) {
+                park();
+                return false;
             }
+            // 缓冲区中还有流水线请求，继续处理而不释放处理权
+            if (m_pipelined)
+                continue;
         }
-        else if (m_state == WRITE){
-            m_httpconn->write();
-        }
+        // 连接关闭后不再释放处理权，其后的残余事件均被忽略
+        if (status == IO_CLOSED || release())
+            return false;
     }
-    else {
-        m_httpconn->process();
+}
+
+ThreadPool::LANE HTTPConn::lane(bool parsed) const
+{
+    // 继续发送大响应，或读取较大的请求体
+    if (m_response.stream || (size_t)m_bytes_to_send >= SLOW_BYTES)
+        return ThreadPool::SLOW;
+    if (reading_body() && (m_chunked || (uint64_t)m_content_length >= SLOW_BYTES))
+        return ThreadPool::SLOW;
+    // REACTOR模式下请求尚未解析，m_handler属于上一个请求
+    if (parsed && m_handler && m_handler->costly)
+        return ThreadPool::SLOW;
+    return ThreadPool::FAST;
+}
+
+void HTTPConn::run(bool parsed)
+{
+    // 主线程转交的是进行中的流式响应，而不是新解析的请求
+    bool resume = parsed && m_response.stream;
+    // REACTOR模式下请求在出队后才读入，出队时间只对主线程已解析的请求有意义
+    if (parsed && !resume) {
+        if (!m_access.dequeued)
+            m_access.dequeued = AccessLog::now();
+        if (reading_body())
+            process_body();
+        else
+            respond(GET_REQUEST);
     }
+    // 主线程未解析请求时，先处理其投递的事件
+    bool first = !parsed || resume;
+    while (m_sockfd != -1 && !parked() && (first || m_pipelined || !release())) {
+        first = false;
+        if (handle_io(take_events()) == IO_READ)
+            process();
+    }
+    if (m_sockfd != -1 && parked())
+        park();
+}
+
+bool HTTPReq::do_request() 
+{
+    uint64_t id = m_httpconn->trace_id();
+    if (id)
+        Tracer::record("pool_queue", m_enqueue_time, Tracer::now() - m_enqueue_time, id,
+                       Tracer::SPAN_ASYNC);
+    TraceSpan span("do_request", id);
+    m_httpconn->run(m_state == PARSED);
     return true;
 }
 
@@ -492,8 +1388,10 @@ std::shared_ptr<HTTPConn> ConnHandler::add_conn(int connfd)
 {
     auto it = m_conns.find(connfd);
     if (it != m_conns.end()) {
-        LOG_INFO("Multi_add conn, sock: %d", connfd);
-        return nullptr;
+        // fd被内核复用，说明旧连接已经关闭
+        LOG_INFO<Log::HTTP>("Reuse conn, sock: %d", connfd);
+        it->second = std::make_shared<HTTPConn>();
+        return it->second;
     }
     auto ret = m_conns.insert(it, {connfd, std::make_shared<HTTPConn>()});
     return ret->second;
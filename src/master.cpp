@@ -0,0 +1,179 @@
+#include "master.h"
+#include "webserver.h"
+#include "scoreboard.h"
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+// 启动后不足该时长（秒）即退出的工作进程延迟重新fork，避免崩溃循环占满CPU
+static const int MIN_UPTIME = 1;
+// 停止时等待工作进程退出的期限（秒），之后强制结束
+static const int STOP_TIMEOUT = 10;
+
+Master::Master(const char *ip, int port, unsigned workers)
+    : m_ip(ip), m_port(port),
+      m_workers(workers < Scoreboard::MAX_WORKERS ? workers : (unsigned)Scoreboard::MAX_WORKERS),
+      m_pid(getpid()), m_pids(m_workers, 0), m_started(m_workers), m_respawn(m_workers)
+{
+}
+
+int Master::run()
+{
+    // 主进程只使用同步日志，fork时没有其他线程持有锁
+    Log::getInstance().setPrint();
+    const char *levels = getenv("MANGO_LOG");
+    if (levels && !Log::setLevels(levels))
+        LOG_ERROR("Bad MANGO_LOG: %s", levels);
+    LOG_INFO<Log::NET>("Binding server @%s:%d", m_ip.c_str(), m_port);
+    m_listenfd = listen_socket(m_ip.c_str(), m_port);
+    if (m_listenfd < 0) {
+        LOG_ERROR("Listen on %s:%d failed: %s", m_ip.c_str(), m_port, strerror(errno));
+        return 1;
+    }
+    if (!Scoreboard::getInstance().create(m_workers))
+        return 1;
+
+    // 信号在主进程中保持阻塞，由sigtimedwait取出；工作进程在fork后恢复原屏蔽字
+    sigset_t set;
+    sigemptyset(&set);
+    for (int sig : {SIGCHLD, SIGINT, SIGTERM, SIGHUP, SIGUSR1})
+        sigaddset(&set, sig);
+    sigprocmask(SIG_BLOCK, &set, &m_oldmask);
+
+    LOG_WARN("Master %d starting %u workers @%s:%d", (int)m_pid, m_workers, m_ip.c_str(), m_port);
+    for (unsigned i = 0; i < m_workers; ++i)
+        spawn(i);
+    while (!m_stopping || alive() > 0) {
+        timespec timeout = {0, 200 * 1000 * 1000};
+        siginfo_t info;
+        int sig = sigtimedwait(&set, &info, &timeout);
+        switch (sig) {
+            case SIGINT:
+            case SIGTERM:
+                if (!m_stopping) {
+                    LOG_WARN("Master stopping %u workers", alive());
+                    m_stopping = true;
+                    m_stop_deadline = clock::now() + std::chrono::seconds(STOP_TIMEOUT);
+                    broadcast(SIGTERM);
+                }
+                break;
+            case SIGUSR1:
+                report();
+                break;
+            case SIGHUP:
+                LOG_WARN("%s", "Binary upgrade is not supported with MANGO_PROCS, restart instead");
+                break;
+        }
+        // SIGCHLD可能被合并，每轮都回收
+        reap();
+        clock::time_point now = clock::now();
+        if (m_stopping) {
+            if (now >= m_stop_deadline && alive() > 0) {
+                LOG_ERROR("Workers not stopped in %d seconds, killing", STOP_TIMEOUT);
+                broadcast(SIGKILL);
+                m_stop_deadline = clock::time_point::max();
+            }
+            continue;
+        }
+        for (unsigned i = 0; i < m_workers; ++i) {
+            if (m_pids[i] == 0 && now >= m_respawn[i])
+                spawn(i);
+        }
+    }
+    report();
+    close(m_listenfd);
+    return 0;
+}
+
+bool Master::spawn(unsigned idx)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR("Fork worker %u failed: %s", idx, strerror(errno));
+        m_respawn[idx] = clock::now() + std::chrono::seconds(MIN_UPTIME);
+        return false;
+    }
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &m_oldmask, nullptr);
+        // 主进程被强制结束时工作进程随之退出
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != m_pid)
+            _exit(1);
+        // epoll实例在静态初始化时就已创建
+        EpollControl::getInstance().reopen();
+        {
+            WebServer server(m_ip.c_str(), m_port, m_listenfd, idx);
+            server.run();
+        }
+        exit(0);
+    }
+    Scoreboard::Slot &slot = Scoreboard::getInstance().slot(idx);
+    slot.pid.store(pid);
+    slot.started.store(time(nullptr));
+    m_pids[idx] = pid;
+    m_started[idx] = clock::now();
+    LOG_INFO("Worker %u started as pid %d", idx, (int)pid);
+    return true;
+}
+
+void Master::reap()
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        unsigned idx = 0;
+        while (idx < m_workers && m_pids[idx] != pid)
+            ++idx;
+        if (idx == m_workers)
+            continue;
+        Scoreboard &board = Scoreboard::getInstance();
+        board.retire(idx);
+        m_pids[idx] = 0;
+        if (m_stopping) {
+            LOG_INFO("Worker %u (pid %d) exited", idx, (int)pid);
+            continue;
+        }
+        if (WIFSIGNALED(status))
+            LOG_ERROR("Worker %u (pid %d) killed by signal %d, respawning", idx, (int)pid,
+                      WTERMSIG(status));
+        else
+            LOG_ERROR("Worker %u (pid %d) exited with %d, respawning", idx, (int)pid,
+                      WEXITSTATUS(status));
+        board.slot(idx).restarts.fetch_add(1);
+        clock::time_point now = clock::now();
+        m_respawn[idx] = now - m_started[idx] < std::chrono::seconds(MIN_UPTIME)
+                             ? now + std::chrono::seconds(MIN_UPTIME) : now;
+    }
+}
+
+void Master::broadcast(int sig)
+{
+    for (pid_t pid : m_pids) {
+        if (pid != 0)
+            kill(pid, sig);
+    }
+}
+
+unsigned Master::alive() const
+{
+    unsigned n = 0;
+    for (pid_t pid : m_pids)
+        n += pid != 0;
+    return n;
+}
+
+void Master::report()
+{
+    Scoreboard &board = Scoreboard::getInstance();
+    uint64_t c[Metrics::COUNTER_NUM], responses;
+    board.totals(c, responses);
+    uint64_t restarts = 0;
+    for (unsigned i = 0; i < m_workers; ++i)
+        restarts += board.slot(i).restarts.load();
+    uint64_t active = c[Metrics::CONN_ACCEPTED] > c[Metrics::CONN_CLOSED]
+                          ? c[Metrics::CONN_ACCEPTED] - c[Metrics::CONN_CLOSED] : 0;
+    LOG_WARN("Workers %u/%u alive, %llu restarts, %llu responses, %llu accepted, %llu active, "
+             "%llu bytes sent",
+             alive(), m_workers, (unsigned long long)restarts, (unsigned long long)responses,
+             (unsigned long long)c[Metrics::CONN_ACCEPTED], (unsigned long long)active,
+             (unsigned long long)c[Metrics::BYTES_OUT]);
+}
@@ -0,0 +1,193 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+Metrics::ThreadMetrics::ThreadMetrics()
+{
+    for (auto &c : counters)
+        c.store(0, std::memory_order_relaxed);
+    for (auto &c : status)
+        c.store(0, std::memory_order_relaxed);
+    for (auto &h : hists) {
+        for (auto &c : h.counts)
+            c.store(0, std::memory_order_relaxed);
+    }
+}
+
+Metrics::ThreadMetrics *Metrics::local()
+{
+    // 线程退出时交出计数器，累计值保留在汇总中
+    struct Guard {
+        std::shared_ptr<ThreadMetrics> tm;
+        ~Guard() {
+            if (tm)
+                tm->orphan.store(true, std::memory_order_release);
+        }
+    };
+    thread_local Guard guard;
+    thread_local ThreadMetrics *tm = nullptr;
+    if (!tm) {
+        guard.tm = getInstance().attach();
+        tm = guard.tm.get();
+    }
+    return tm;
+}
+
+std::shared_ptr<Metrics::ThreadMetrics> Metrics::attach()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (auto &tm : m_threads) {
+        bool expected = true;
+        if (tm->orphan.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+            return tm;
+    }
+    m_threads.push_back(std::make_shared<ThreadMetrics>());
+    return m_threads.back();
+}
+
+namespace {
+
+struct Totals {
+    uint64_t counters[Metrics::COUNTER_NUM] = {};
+    uint64_t status[Metrics::MAX_STATUS] = {};
+    uint64_t hists[Metrics::HISTOGRAM_NUM][LatencyHistogram::BUCKETS] = {};
+    uint64_t sums[Metrics::HISTOGRAM_NUM] = {};
+};
+
+void put_counter(std::string &out, const char *name, const char *help, uint64_t v,
+                 const char *type = "counter")
+{
+    char buf[256];
+    snprintf(buf, sizeof buf, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type,
+             name, (unsigned long long)v);
+    out += buf;
+}
+
+// 输出为Prometheus直方图，分桶取2的幂的边界，并附加由细粒度分桶估计的分位数
+void put_histogram(std::string &out, const char *name, const char *help, const uint64_t *counts,
+                   uint64_t sum)
+{
+    char buf[256];
+    snprintf(buf, sizeof buf, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += buf;
+    uint64_t total = 0;
+    for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+        total += counts[i];
+        if (i % LatencyHistogram::SUB_BUCKETS != LatencyHistogram::SUB_BUCKETS - 1)
+            continue;
+        snprintf(buf, sizeof buf, "%s_bucket{le=\"%g\"} %llu\n", name,
+                 LatencyHistogram::bucket_upper(i) / 1e6, (unsigned long long)total);
+        out += buf;
+    }
+    snprintf(buf, sizeof buf, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n", name,
+             (unsigned long long)total, name, sum / 1e6, name, (unsigned long long)total);
+    out += buf;
+
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    snprintf(buf, sizeof buf, "# TYPE %s_quantile gauge\n", name);
+    out += buf;
+    for (double q : quantiles) {
+        uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+        double value = 0;
+        for (int i = 0; total && i < LatencyHistogram::BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) {
+                value = LatencyHistogram::bucket_upper(i) / 1e6;
+                break;
+            }
+        }
+        snprintf(buf, sizeof buf, "%s_quantile{quantile=\"%g\"} %g\n", name, q, value);
+        out += buf;
+    }
+}
+
+}
+
+void Metrics::totals(uint64_t (&counters)[COUNTER_NUM], uint64_t &responses)
+{
+    memset(counters, 0, sizeof counters);
+    responses = 0;
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (auto &tm : m_threads) {
+        for (int i = 0; i < COUNTER_NUM; ++i)
+            counters[i] += tm->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < MAX_STATUS; ++i)
+            responses += tm->status[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::string Metrics::scrape()
+{
+    std::unique_ptr<Totals> t(new Totals);
+    {
+        // 只在注册表上加锁，计数器本身不加锁读取
+        std::lock_guard<std::mutex> lg(m_mutex);
+        for (auto &tm : m_threads) {
+            for (int i = 0; i < COUNTER_NUM; ++i)
+                t->counters[i] += tm->counters[i].load(std::memory_order_relaxed);
+            for (int i = 0; i < MAX_STATUS; ++i)
+                t->status[i] += tm->status[i].load(std::memory_order_relaxed);
+            for (int h = 0; h < HISTOGRAM_NUM; ++h) {
+                for (int i = 0; i < LatencyHistogram::BUCKETS; ++i)
+                    t->hists[h][i] += tm->hists[h].counts[i].load(std::memory_order_relaxed);
+                t->sums[h] += tm->hists[h].sum.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    const uint64_t *c = t->counters;
+    std::string out;
+    out.reserve(8192);
+    put_counter(out, "mango_connections_accepted_total", "Connections accepted.", c[CONN_ACCEPTED]);
+    put_counter(out, "mango_connections_closed_total", "Connections closed.", c[CONN_CLOSED]);
+    put_counter(out, "mango_connections_rejected_total", "Connections rejected over MAX_FD.",
+                c[CONN_REJECTED]);
+    // 各线程的计数读取时刻不同，差值可能短暂为负
+    uint64_t active = c[CONN_ACCEPTED] > c[CONN_CLOSED] ? c[CONN_ACCEPTED] - c[CONN_CLOSED] : 0;
+    put_counter(out, "mango_connections_active", "Open connections.", active, "gauge");
+    put_counter(out, "mango_bytes_received_total", "Bytes read from clients.", c[BYTES_IN]);
+    put_counter(out, "mango_bytes_sent_total", "Bytes written to clients.", c[BYTES_OUT]);
+    put_counter(out, "mango_bytes_zerocopy_total", "Bytes written to clients with MSG_ZEROCOPY.",
+                c[BYTES_ZEROCOPY]);
+
+    out += "# HELP mango_requests_total Responses sent by status code.\n"
+           "# TYPE mango_requests_total counter\n";
+    char buf[128];
+    for (int i = 0; i < MAX_STATUS; ++i) {
+        if (t->status[i] == 0)
+            continue;
+        snprintf(buf, sizeof buf, "mango_requests_total{code=\"%d\"} %llu\n", i,
+                 (unsigned long long)t->status[i]);
+        out += buf;
+    }
+
+    uint64_t depth = c[POOL_ENQUEUED] > c[POOL_DEQUEUED] ? c[POOL_ENQUEUED] - c[POOL_DEQUEUED] : 0;
+    put_counter(out, "mango_pool_queue_depth", "Requests waiting in the thread pool queue.", depth,
+                "gauge");
+    put_counter(out, "mango_pool_rejected_total", "Requests rejected by a full pool queue.",
+                c[POOL_REJECTED]);
+    put_counter(out, "mango_file_cached_total",
+                "File requests answered from the page cache without blocking.", c[FILE_CACHED]);
+    put_counter(out, "mango_file_offloaded_total",
+                "File requests handed to the disk I/O threads.", c[FILE_OFFLOADED]);
+    put_histogram(out, "mango_pool_wait_seconds", "Time requests wait in the pool's fast lane.",
+                  t->hists[POOL_WAIT], t->sums[POOL_WAIT]);
+    put_histogram(out, "mango_pool_slow_wait_seconds",
+                  "Time large or costly requests wait in the pool's slow lane.",
+                  t->hists[POOL_WAIT_SLOW], t->sums[POOL_WAIT_SLOW]);
+    put_histogram(out, "mango_request_duration_seconds",
+                  "Time from the first request byte read to the last response byte written.",
+                  t->hists[REQUEST_LATENCY], t->sums[REQUEST_LATENCY]);
+
+    // 常驻内存，用于估算每个连接的内存占用
+    unsigned long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%lu %lu", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    put_counter(out, "process_resident_memory_bytes", "Resident memory size in bytes.",
+                (uint64_t)resident * sysconf(_SC_PAGESIZE), "gauge");
+    return out;
+}
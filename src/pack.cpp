@@ -0,0 +1,150 @@
+#include "pack.h"
+#include "log.h"
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace packbin;
+
+std::shared_ptr<Pack> Pack::open(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Open pack %s failed: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+        LOG_ERROR("Pack %s is truncated", filename.c_str());
+        close(fd);
+        return nullptr;
+    }
+    // 启动时一次性读入，之后的请求不会因缺页读盘
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("Mmap pack %s failed: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+    std::shared_ptr<Pack> pack(new Pack);
+    pack->m_base = static_cast<char *>(addr);
+    pack->m_size = st.st_size;
+
+    // 校验所有偏移，运行期间的查找不再检查
+    FileHeader header;
+    memcpy(&header, pack->m_base, sizeof header);
+    uint64_t index_end = sizeof header + (uint64_t)header.count * sizeof(IndexEntry);
+    // 索引区需先落在文件内，否则后面的减法会回绕
+    if (memcmp(header.magic, MAGIC, sizeof MAGIC) != 0 || header.size != pack->m_size ||
+        index_end > pack->m_size ||
+        header.strings_off != index_end || header.strings_len > pack->m_size - index_end ||
+        (header.strings_len > 0 && pack->m_base[index_end + header.strings_len - 1] != '\0')) {
+        LOG_ERROR("Pack %s is invalid", filename.c_str());
+        return nullptr;
+    }
+    pack->m_index = reinterpret_cast<const IndexEntry *>(pack->m_base + sizeof header);
+    pack->m_count = header.count;
+    pack->m_strings = pack->m_base + header.strings_off;
+    auto bad_str = [&](const Str &s) {
+        return (uint64_t)s.off + s.len >= header.strings_len || pack->m_strings[s.off + s.len] != '\0';
+    };
+    auto bad_data = [&](uint64_t off, uint64_t size) {
+        return off > pack->m_size || size > pack->m_size - off;
+    };
+    for (size_t i = 0; i < pack->m_count; ++i) {
+        const IndexEntry &e = pack->m_index[i];
+        bool bad = bad_str(e.path) || bad_str(e.mime) || bad_str(e.etag) || bad_str(e.headers) ||
+                   bad_data(e.data_off, e.size) ||
+                   (e.gzip_size > 0 && (bad_str(e.gzip_etag) || bad_str(e.gzip_headers) ||
+                                        bad_data(e.gzip_off, e.gzip_size)));
+        // 二分查找要求路径严格递增
+        if (!bad && i > 0) {
+            const Str &a = pack->m_index[i - 1].path;
+            int cmp = memcmp(pack->str(a), pack->str(e.path), std::min(a.len, e.path.len));
+            bad = cmp > 0 || (cmp == 0 && a.len >= e.path.len);
+        }
+        if (bad) {
+            LOG_ERROR("Pack %s has a bad entry %zu", filename.c_str(), i);
+            return nullptr;
+        }
+    }
+    return pack;
+}
+
+Pack::~Pack()
+{
+    if (m_base)
+        munmap(m_base, m_size);
+}
+
+bool Pack::mount(const std::string &prefix, const std::string &filename)
+{
+    std::shared_ptr<Pack> pack = open(filename);
+    if (!pack)
+        return false;
+    std::string path = prefix;
+    while (!path.empty() && path.back() == '/')
+        path.pop_back();
+    path += "/*path";
+    // 资源包已全部在内存中，在主线程中直接应答
+    bool ok = HandlerTable::getInstance().add_handler(path, [pack](const Request &req, Response &resp) {
+        const Params::Param &rel = req.params.items[req.params.count - 1];
+        const IndexEntry *entry = pack->find(rel.value, rel.len);
+        if (!entry) {
+            resp.status = 404;
+            resp.title = "Not Found";
+            resp.content_type = "text/plain";
+            resp.body = "The requested file was not found on this server.\n";
+            resp.body_len = strlen(resp.body);
+            return;
+        }
+        pack->serve(*entry, req, resp);
+    });
+    if (ok)
+        LOG_INFO("Mounted pack %s at %s, %zu files", filename.c_str(), prefix.c_str(), pack->count());
+    return ok;
+}
+
+const IndexEntry *Pack::find(const char *path, size_t len) const
+{
+    size_t lo = 0, hi = m_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const Str &s = m_index[mid].path;
+        int cmp = memcmp(str(s), path, std::min<size_t>(s.len, len));
+        if (cmp == 0)
+            cmp = s.len < len ? -1 : (s.len > len ? 1 : 0);
+        if (cmp == 0)
+            return &m_index[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return nullptr;
+}
+
+void Pack::serve(const IndexEntry &entry, const Request &req, Response &resp) const
+{
+    bool gzip = entry.gzip_size > 0 && req.accept_gzip;
+    const Str &etag = gzip ? entry.gzip_etag : entry.etag;
+    const Str &headers = gzip ? entry.gzip_headers : entry.headers;
+    resp.content_type = str(entry.mime);
+    resp.headers.assign(str(headers), headers.len);
+    if (req.if_none_match && strstr(req.if_none_match, str(etag))) {
+        resp.status = 304;
+        resp.title = "Not Modified";
+        return;
+    }
+    if (gzip) {
+        resp.body = m_base + entry.gzip_off;
+        resp.body_len = entry.gzip_size;
+    }
+    else {
+        resp.body = m_base + entry.data_off;
+        resp.body_len = entry.size;
+    }
+}
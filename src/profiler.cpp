@@ -0,0 +1,151 @@
+#include "profiler.h"
+#include "log.h"
+#include <map>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <sys/time.h>
+
+// 信号处理函数中只做原子操作和backtrace，不分配内存也不加锁
+void Profiler::on_sigprof(int)
+{
+    int save_errno = errno;
+    Profiler &profiler = getInstance();
+    unsigned idx = profiler.m_next.fetch_add(1, std::memory_order_relaxed);
+    if (idx < profiler.m_capacity) {
+        Sample &sample = profiler.m_samples[idx];
+        sample.depth = backtrace(sample.pcs, MAX_DEPTH);
+    }
+    errno = save_errno;
+}
+
+bool Profiler::start_async(const std::string &dir, unsigned seconds, unsigned hz)
+{
+    if (seconds == 0 || hz == 0)
+        return false;
+    bool expected = false;
+    if (!m_running.compare_exchange_strong(expected, true)) {
+        LOG_WARN("%s", "Profiler already running");
+        return false;
+    }
+    // 进程级的CPU定时器在所有线程上的采样总数不超过 频率 * 秒数 * CPU数
+    unsigned long want = (unsigned long)hz * seconds * std::max(1u, std::thread::hardware_concurrency());
+    m_capacity = std::min<unsigned long>(want, MAX_SAMPLES);
+    m_samples.reset(new Sample[m_capacity]);
+    m_next.store(0, std::memory_order_relaxed);
+    // backtrace首次调用时会加载libgcc_s，不能发生在信号处理函数中
+    void *warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof sa);
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &m_oldact);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = std::max(1u, 1000000 / hz);
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    LOG_INFO("Profiling for %u seconds at %u Hz", seconds, hz);
+
+    char name[64];
+    snprintf(name, sizeof name, "profile_%d_%ld.folded", (int)getpid(), (long)time(nullptr));
+    std::string path = dir + name;
+    std::thread([this, path, seconds]() {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        stop();
+        long count = dump(path);
+        if (count < 0)
+            LOG_ERROR("Dump profile to %s failed", path.c_str());
+        else
+            LOG_INFO("Dumped %ld profile samples to %s", count, path.c_str());
+        m_samples.reset();
+        m_running.store(false);
+    }).detach();
+    return true;
+}
+
+void Profiler::stop()
+{
+    struct itimerval timer;
+    memset(&timer, 0, sizeof timer);
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    // 等待其他线程上已进入的信号处理函数返回，之后不会再有写入
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sigaction(SIGPROF, &m_oldact, nullptr);
+}
+
+// 返回地址指向调用指令之后，减一后再查找才能落在调用者的范围内
+static std::string symbolize(void *pc, bool caller)
+{
+    Dl_info info;
+    void *addr = (char *)pc - (caller ? 1 : 0);
+    if (!dladdr(addr, &info) || !info.dli_fname)
+        return "[unknown]";
+    if (info.dli_sname) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string name = status == 0 ? demangled : info.dli_sname;
+        free(demangled);
+        return name;
+    }
+    // 未导出的符号（如static函数）以模块名加偏移表示
+    const char *base = strrchr(info.dli_fname, '/');
+    char buf[256];
+    snprintf(buf, sizeof buf, "%s+0x%lx", base ? base + 1 : info.dli_fname,
+             (unsigned long)((char *)addr - (char *)info.dli_fbase));
+    return buf;
+}
+
+long Profiler::dump(const std::string &path)
+{
+    unsigned total = m_next.load(std::memory_order_relaxed);
+    unsigned count = std::min(total, m_capacity);
+    if (total > m_capacity)
+        LOG_WARN("Profiler buffer full, dropped %u samples", total - m_capacity);
+    // 前两帧为信号处理函数和内核插入的信号返回帧
+    const int SKIP = 2;
+    std::map<std::vector<void *>, unsigned long> stacks;
+    for (unsigned i = 0; i < count; ++i) {
+        const Sample &sample = m_samples[i];
+        if (sample.depth <= SKIP)
+            continue;
+        ++stacks[std::vector<void *>(sample.pcs + SKIP, sample.pcs + sample.depth)];
+    }
+    std::unordered_map<void *, std::string> names;
+    std::map<std::string, unsigned long> folded;
+    for (const auto &kv : stacks) {
+        std::string line;
+        // 折叠格式从栈底到栈顶，以分号分隔
+        for (size_t i = kv.first.size(); i-- > 0;) {
+            void *pc = kv.first[i];
+            auto it = names.find(pc);
+            if (it == names.end())
+                it = names.emplace(pc, symbolize(pc, i > 0)).first;
+            if (!line.empty())
+                line += ';';
+            line += it->second;
+        }
+        folded[line] += kv.second;
+    }
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return -1;
+    long written = 0;
+    for (const auto &kv : folded) {
+        fprintf(fp, "%s %lu\n", kv.first.c_str(), kv.second);
+        written += kv.second;
+    }
+    bool ok = ferror(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+    return ok ? written : -1;
+}
@@ -0,0 +1,755 @@
+#include "proxy.h"
+#include "log.h"
+#include "httpconn.h"
+#include <algorithm>
+#include <chrono>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// 连接上游的超时（毫秒）
+static const int CONNECT_TIMEOUT = 1000;
+// 等待上游响应或消息体下一段数据的超时（毫秒）
+static const int IO_TIMEOUT = 30000;
+// 上游响应头部的长度上限
+static const size_t MAX_HEAD = 16 * 1024;
+// 消息体不超过该长度时读取完整后直接作为普通响应发送
+static const size_t INLINE_BODY = 16 * 1024;
+// 流式转发时每段的长度上限
+static const size_t CHUNK_SIZE = 64 * 1024;
+// 透传给客户端的上游头部及其总长度上限，其余头部由HTTPConn生成或属于逐跳头部
+static const char *const PASS_HEADERS[] = {
+    "Content-Type", "Location", "Cache-Control", "ETag", "Last-Modified",
+    "Content-Encoding", "Vary", "Set-Cookie",
+};
+static const size_t MAX_PASS = 512;
+// 转发给上游时去掉的请求头部：逐跳头部，以及由代理重新生成的头部
+static const char *const HOP_HEADERS[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization",
+    "TE", "Trailer", "Transfer-Encoding", "Upgrade", "Host", "Content-Length", "Expect",
+    "X-Forwarded-For",
+};
+// 每个上游保留的空闲连接数上限
+static const size_t MAX_IDLE = 32;
+// 连续失败MAX_FAILS次的上游在DOWN_SECONDS秒内不再被选择
+static const int MAX_FAILS = 3;
+static const int DOWN_SECONDS = 10;
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// 等待fd就绪，超时（errno为ETIMEDOUT）或出错返回false
+static bool wait_fd(int fd, short events, int timeout)
+{
+    struct pollfd pfd = {fd, events, 0};
+    int ret;
+    do {
+        ret = ::poll(&pfd, 1, timeout);
+    } while (ret < 0 && errno == EINTR);
+    if (ret == 0)
+        errno = ETIMEDOUT;
+    return ret > 0;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && wait_fd(fd, POLLOUT, IO_TIMEOUT))
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 读取上游数据追加到buf，返回读到的字节数，0表示上游关闭，-1表示出错或超时
+static ssize_t recv_some(int fd, std::string &buf, size_t max)
+{
+    size_t old = buf.size();
+    buf.resize(old + max);
+    while (true) {
+        ssize_t n = recv(fd, &buf[old], max, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN && wait_fd(fd, POLLIN, IO_TIMEOUT))
+            continue;
+        buf.resize(old + (n > 0 ? n : 0));
+        return n;
+    }
+}
+
+static int connect_to(const std::string &ip, int port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1)
+        return -1;
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof address) < 0) {
+        int err = 0;
+        socklen_t len = sizeof err;
+        if (errno != EINPROGRESS || !wait_fd(fd, POLLOUT, CONNECT_TIMEOUT) ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            if (err != 0)
+                errno = err;
+            else if (errno == EINPROGRESS)
+                errno = ETIMEDOUT;
+            close(fd);
+            return -1;
+        }
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
+
+static const char *status_title(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+    }
+    static const char *const classes[] = {"Unknown", "Informational", "Success", "Redirection",
+                                          "Client Error", "Server Error"};
+    return status >= 100 && status < 600 ? classes[status / 100] : classes[0];
+}
+
+// name是否为逐跳头部，或出现在客户端Connection头部中的头部
+static bool hop_header(const char *name, size_t len, const char *connection)
+{
+    for (const char *hop : HOP_HEADERS) {
+        if (strlen(hop) == len && strncasecmp(name, hop, len) == 0)
+            return true;
+    }
+    while (connection && *connection) {
+        connection += strspn(connection, " \t,");
+        size_t n = strcspn(connection, " \t,");
+        if (n == len && strncasecmp(connection, name, len) == 0)
+            return true;
+        connection += n;
+    }
+    return false;
+}
+
+static void bad_gateway(Response &resp)
+{
+    resp.status = 502;
+    resp.title = status_title(502);
+    resp.content_type = "text/plain";
+    resp.owned = "Bad Gateway\n";
+}
+
+// 一次转发的上游连接及其消息体解码状态，流式响应时由生产者持有
+// 消息体完整读取且上游未要求关闭时连接归还连接池，否则关闭；析构时减少上游的进行中请求数
+struct Exchange {
+    enum MODE { LENGTH, CHUNKED, UNTIL_CLOSE };
+    enum CHUNK_STATE { CHUNK_SIZE_LINE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER, CHUNK_DONE };
+
+    Proxy::Upstream *up;
+    int fd;
+    bool keepalive = true;
+    bool done = false;
+    MODE mode = LENGTH;
+    // LENGTH模式下剩余的长度，CHUNKED模式下当前块剩余的长度
+    unsigned long long left = 0;
+    CHUNK_STATE chunk = CHUNK_SIZE_LINE;
+    // 已读入但尚未解码的数据
+    std::string buf;
+
+    Exchange(Proxy::Upstream *up, int fd) : up(up), fd(fd) {}
+    Exchange(const Exchange &) = delete;
+    Exchange &operator=(const Exchange &) = delete;
+    ~Exchange() {
+        if (fd >= 0) {
+            if (done && keepalive)
+                Proxy::getInstance().recycle(up, fd);
+            else
+                close(fd);
+        }
+        up->outstanding.fetch_sub(1);
+    }
+
+    // 从buf中解码消息体追加到out，返回false表示数据格式错误
+    bool decode(std::string &out) {
+        if (mode != CHUNKED) {
+            size_t n = buf.size();
+            if (mode == LENGTH && n > left)
+                n = left;
+            out.append(buf, 0, n);
+            buf.erase(0, n);
+            if (mode == LENGTH) {
+                left -= n;
+                done = left == 0;
+            }
+            return true;
+        }
+        size_t pos = 0;
+        while (chunk != CHUNK_DONE) {
+            if (chunk == CHUNK_DATA) {
+                size_t n = std::min<unsigned long long>(left, buf.size() - pos);
+                out.append(buf, pos, n);
+                pos += n;
+                left -= n;
+                if (left > 0)
+                    break;
+                chunk = CHUNK_DATA_END;
+                continue;
+            }
+            size_t eol = buf.find("\r\n", pos);
+            if (eol == std::string::npos)
+                break;
+            if (chunk == CHUNK_SIZE_LINE) {
+                char *end;
+                left = strtoull(buf.c_str() + pos, &end, 16);
+                if (end == buf.c_str() + pos)
+                    return false;
+                chunk = left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            }
+            else if (chunk == CHUNK_DATA_END) {
+                if (eol != pos)
+                    return false;
+                chunk = CHUNK_SIZE_LINE;
+            }
+            else if (eol == pos) {
+                // 尾部头部以空行结束
+                chunk = CHUNK_DONE;
+                done = true;
+            }
+            pos = eol + 2;
+        }
+        buf.erase(0, pos);
+        // 块长度行不会无限增长
+        return chunk == CHUNK_DATA || buf.size() <= MAX_HEAD;
+    }
+
+    // 读取并解码下一段消息体，返回false表示上游出错
+    bool next(std::string &out) {
+        while (!done && out.empty()) {
+            if (!decode(out))
+                return false;
+            if (done || !out.empty())
+                break;
+            ssize_t n = recv_some(fd, buf, CHUNK_SIZE);
+            if (n == 0 && mode == UNTIL_CLOSE) {
+                done = true;
+                keepalive = false;
+                break;
+            }
+            if (n <= 0)
+                return false;
+        }
+        // 上游在消息体之后又发送了数据，连接状态不明，不再复用
+        if (done && !buf.empty())
+            keepalive = false;
+        return true;
+    }
+};
+
+Proxy::Proxy()
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0)
+        LOG_ERROR("Proxy epoll_create failed: %s", strerror(errno));
+}
+
+Proxy::~Proxy()
+{
+    for (auto &kv : m_idle)
+        close(kv.first);
+    if (m_epfd >= 0)
+        close(m_epfd);
+}
+
+bool Proxy::configure(const std::string &spec)
+{
+    unsigned threads = ThreadPool::getInstance().threads();
+    m_limit.store(threads > 2 ? threads / 2 : 1);
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(';', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string route = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (route.empty())
+            continue;
+        size_t eq = route.find('=');
+        if (eq == std::string::npos) {
+            LOG_ERROR("Bad proxy route: %s", route.c_str());
+            return false;
+        }
+        std::vector<std::string> upstreams;
+        size_t p = eq + 1;
+        while (p <= route.size()) {
+            size_t comma = route.find(',', p);
+            if (comma == std::string::npos)
+                comma = route.size();
+            if (comma > p)
+                upstreams.push_back(route.substr(p, comma - p));
+            p = comma + 1;
+        }
+        if (!add_route(route.substr(0, eq), upstreams))
+            return false;
+    }
+    return true;
+}
+
+bool Proxy::add_route(const std::string &prefix, const std::vector<std::string> &upstreams)
+{
+    if (m_epfd < 0 || upstreams.empty() || prefix.empty() || prefix[0] != '/') {
+        LOG_ERROR("Bad proxy route: %s", prefix.c_str());
+        return false;
+    }
+    std::unique_ptr<Group> group(new Group);
+    for (const std::string &addr : upstreams) {
+        size_t colon = addr.rfind(':');
+        int port = colon == std::string::npos ? 0 : atoi(addr.c_str() + colon + 1);
+        struct in_addr tmp;
+        if (port <= 0 || port > 65535 ||
+            inet_pton(AF_INET, addr.substr(0, colon).c_str(), &tmp) != 1) {
+            LOG_ERROR("Bad upstream address: %s", addr.c_str());
+            return false;
+        }
+        std::unique_ptr<Upstream> up(new Upstream);
+        up->addr = addr;
+        up->ip = addr.substr(0, colon);
+        up->port = port;
+        group->push_back(std::move(up));
+    }
+    Group *g = group.get();
+    Handler handler = [this, g](const Request &req, Response &resp) { forward(*g, req, resp); };
+    // "/api"同时匹配"/api"和"/api/..."，"/"匹配全部路径
+    std::string base = prefix;
+    while (!base.empty() && base.back() == '/')
+        base.pop_back();
+    HandlerTable &table = HandlerTable::getInstance();
+    if ((!base.empty() && !table.add_handler(base, handler, false)) ||
+        !table.add_handler(base + "/*path", handler, false)) {
+        LOG_ERROR("Bad proxy route: %s", prefix.c_str());
+        return false;
+    }
+    m_groups.push_back(std::move(group));
+    LOG_INFO("Proxy %s -> %zu upstreams", prefix.c_str(), upstreams.size());
+    return true;
+}
+
+Proxy::Upstream *Proxy::pick(Group &group)
+{
+    int64_t now = now_ms();
+    // 从轮转位置开始，进行中请求数相同时依次选择不同的上游
+    size_t n = group.size();
+    size_t start = m_next.fetch_add(1, std::memory_order_relaxed) % n;
+    Upstream *best = nullptr, *fallback = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        Upstream *up = group[(start + i) % n].get();
+        int load = up->outstanding.load(std::memory_order_relaxed);
+        if (!fallback || load < fallback->outstanding.load(std::memory_order_relaxed))
+            fallback = up;
+        if (up->down_until.load(std::memory_order_relaxed) > now)
+            continue;
+        if (!best || load < best->outstanding.load(std::memory_order_relaxed))
+            best = up;
+    }
+    // 全部不可用时仍然尝试，避免上游恢复后需要等待标记过期
+    if (!best)
+        best = fallback;
+    best->outstanding.fetch_add(1);
+    best->requests.fetch_add(1, std::memory_order_relaxed);
+    return best;
+}
+
+int Proxy::acquire(Upstream *up, bool &reused)
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        if (!up->idle.empty()) {
+            int fd = up->idle.back();
+            up->idle.pop_back();
+            m_idle.erase(fd);
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+            reused = true;
+            return fd;
+        }
+    }
+    reused = false;
+    return connect_to(up->ip, up->port);
+}
+
+void Proxy::recycle(Upstream *up, int fd)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (up->idle.size() >= MAX_IDLE || epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return;
+    }
+    up->idle.push_back(fd);
+    m_idle[fd] = up;
+}
+
+void Proxy::poll()
+{
+    struct epoll_event events[64];
+    int n = epoll_wait(m_epfd, events, 64, 0);
+    if (n <= 0)
+        return;
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        auto it = m_idle.find(fd);
+        // 已被工作线程取出
+        if (it == m_idle.end())
+            continue;
+        std::vector<int> &idle = it->second->idle;
+        idle.erase(std::find(idle.begin(), idle.end(), fd));
+        m_idle.erase(it);
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+}
+
+void Proxy::report(Upstream *up, bool ok)
+{
+    if (ok) {
+        up->failures.store(0, std::memory_order_relaxed);
+        return;
+    }
+    up->errors.fetch_add(1, std::memory_order_relaxed);
+    if (up->failures.fetch_add(1) + 1 == MAX_FAILS) {
+        up->down_until.store(now_ms() + DOWN_SECONDS * 1000);
+        up->failures.store(0);
+        LOG_WARN("Upstream %s failed %d times, marked down for %d seconds", up->addr.c_str(),
+                 MAX_FAILS, DOWN_SECONDS);
+    }
+}
+
+void Proxy::forward(Group &group, const Request &req, Response &resp)
+{
+    // 转发期间工作线程阻塞在上游IO上，超出上限时直接拒绝，保证其余请求仍有可用的线程
+    std::shared_ptr<Slot> slot = admit();
+    if (!slot) {
+        resp.status = 503;
+        resp.title = status_title(503);
+        resp.content_type = "text/plain";
+        resp.headers = "Retry-After: 1\r\n";
+        resp.owned = "Service Unavailable\n";
+        return;
+    }
+
+    std::string out;
+    out.reserve(512 + req.body_len);
+    out += method_name(req.method);
+    out += ' ';
+    out += req.url;
+    out += " HTTP/1.1\r\nHost: ";
+    out += req.host ? req.host : group[0]->addr.c_str();
+    out += "\r\nConnection: keep-alive\r\n";
+    // 端到端头部原样转发
+    const char *connection = req.headers.get("Connection");
+    for (int i = 0; i < req.headers.count; ++i) {
+        const Headers::Header &h = req.headers.items[i];
+        if (hop_header(h.name, h.name_len, connection))
+            continue;
+        out.append(h.name, h.name_len).append(": ").append(h.value).append("\r\n");
+    }
+    out += "X-Forwarded-For: ";
+    const char *forwarded = req.headers.get("X-Forwarded-For");
+    if (forwarded && *forwarded)
+        out.append(forwarded).append(", ");
+    out += req.remote && *req.remote ? req.remote : "unknown";
+    out += "\r\n";
+    // 请求体已解除chunked编码，按实际长度发送
+    if (req.body || req.method != HTTPConn::GET) {
+        char line[64];
+        snprintf(line, sizeof line, "Content-Length: %zu\r\n", req.body_len);
+        out += line;
+    }
+    out += "\r\n";
+    if (req.body)
+        out.append(req.body, req.body_len);
+
+    // 连接失败时请求尚未发出，换用其他上游
+    std::shared_ptr<Exchange> ex;
+    Upstream *up = nullptr;
+    bool reused = false;
+    for (size_t tries = 0; tries < group.size(); ++tries) {
+        ex.reset(new Exchange(pick(group), -1));
+        up = ex->up;
+        ex->fd = acquire(up, reused);
+        if (ex->fd >= 0)
+            break;
+        LOG_WARN("Upstream %s: connect failed: %s", up->addr.c_str(), strerror(errno));
+        report(up, false);
+    }
+    if (ex->fd < 0) {
+        bad_gateway(resp);
+        return;
+    }
+
+    // 上游可能恰好在取出前关闭了空闲连接：复用的连接立即被关闭或重置、且未收到任何数据时，换用新连接重试一次
+    // 超时说明上游可能已在处理请求，不重试；只有GET可以安全地重复发送
+    std::string &buf = ex->buf;
+    size_t head_end = std::string::npos;
+    while (true) {
+        bool stale = false;
+        if (!send_all(ex->fd, out.data(), out.size())) {
+            stale = errno == EPIPE || errno == ECONNRESET;
+        }
+        else {
+            while (head_end == std::string::npos && buf.size() < MAX_HEAD) {
+                size_t from = buf.size() > 3 ? buf.size() - 3 : 0;
+                ssize_t n = recv_some(ex->fd, buf, 4096);
+                if (n <= 0) {
+                    stale = n == 0 || errno == ECONNRESET;
+                    break;
+                }
+                head_end = buf.find("\r\n\r\n", from);
+            }
+        }
+        if (head_end != std::string::npos || !stale || !reused || !buf.empty() ||
+            req.method != HTTPConn::GET)
+            break;
+        LOG_INFO("Upstream %s: pooled connection closed, retrying", up->addr.c_str());
+        close(ex->fd);
+        reused = false;
+        ex->fd = connect_to(up->ip, up->port);
+        if (ex->fd < 0)
+            break;
+    }
+    if (head_end == std::string::npos) {
+        LOG_WARN("Upstream %s: no valid response for %s", up->addr.c_str(), req.url);
+        report(up, false);
+        ex->keepalive = false;
+        bad_gateway(resp);
+        return;
+    }
+
+    // 状态行
+    int minor = 0, status = 0;
+    if (sscanf(buf.c_str(), "HTTP/1.%d %d", &minor, &status) != 2 || status < 100 || status > 599) {
+        LOG_WARN("Upstream %s: bad status line", up->addr.c_str());
+        report(up, false);
+        ex->keepalive = false;
+        bad_gateway(resp);
+        return;
+    }
+    report(up, true);
+    resp.status = status;
+    resp.title = status_title(status);
+    resp.content_type = nullptr;
+
+    // 头部，HTTP/1.0的上游只有声明keep-alive时才复用连接
+    bool has_length = false;
+    ex->keepalive = minor > 0;
+    size_t pos = buf.find("\r\n") + 2;
+    while (pos < head_end + 2) {
+        size_t eol = buf.find("\r\n", pos);
+        const char *line = buf.c_str() + pos;
+        size_t len = eol - pos;
+        pos = eol + 2;
+        const char *colon = static_cast<const char *>(memchr(line, ':', len));
+        if (!colon)
+            continue;
+        size_t name_len = colon - line;
+        const char *value = colon + 1;
+        while (*value == ' ' || *value == '\t')
+            ++value;
+        if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+            ex->left = strtoull(value, nullptr, 10);
+            has_length = true;
+        }
+        else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+            if (strcasestr(std::string(value, line + len).c_str(), "chunked"))
+                ex->mode = Exchange::CHUNKED;
+        }
+        else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+            if (strncasecmp(value, "close", 5) == 0)
+                ex->keepalive = false;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                ex->keepalive = true;
+        }
+        else {
+            for (const char *name : PASS_HEADERS) {
+                if (strlen(name) == name_len && strncasecmp(line, name, name_len) == 0) {
+                    if (resp.headers.size() + len + 2 <= MAX_PASS)
+                        resp.headers.append(line, len).append("\r\n");
+                    break;
+                }
+            }
+        }
+    }
+    buf.erase(0, head_end + 4);
+
+    // 消息体：1xx/204/304没有消息体，既无长度也非chunked时读到上游关闭为止
+    if (status < 200 || status == 204 || status == 304) {
+        ex->mode = Exchange::LENGTH;
+        ex->left = 0;
+    }
+    else if (ex->mode != Exchange::CHUNKED && !has_length) {
+        ex->mode = Exchange::UNTIL_CLOSE;
+    }
+    // 较短的消息体读取完整后作为普通响应发送
+    if (ex->mode == Exchange::LENGTH && ex->left <= INLINE_BODY) {
+        while (buf.size() < ex->left) {
+            if (recv_some(ex->fd, buf, ex->left - buf.size()) <= 0) {
+                LOG_WARN("Upstream %s: response body truncated", up->addr.c_str());
+                report(up, false);
+                ex->keepalive = false;
+                resp.headers.clear();
+                bad_gateway(resp);
+                return;
+            }
+        }
+        ex->decode(resp.owned);
+        if (!buf.empty())
+            ex->keepalive = false;
+        return;
+    }
+    // 其余情况逐段转发，生产者持有上游连接和转发名额直到消息体结束
+    Response *r = &resp;
+    resp.stream = [ex, slot, r](std::string &chunk) mutable {
+        if (!ex)
+            return false;
+        if (!ex->next(chunk)) {
+            LOG_WARN("Upstream %s: response body truncated", ex->up->addr.c_str());
+            Proxy::getInstance().report(ex->up, false);
+            ex->keepalive = false;
+            r->abort = true;
+            ex.reset();
+            slot.reset();
+            return false;
+        }
+        if (ex->done) {
+            // 立即归还连接，不等待生产者被销毁
+            ex.reset();
+            slot.reset();
+            return false;
+        }
+        return true;
+    };
+}
+
+std::shared_ptr<Proxy::Slot> Proxy::admit()
+{
+    unsigned limit = m_limit.load(std::memory_order_relaxed);
+    if (m_active.fetch_add(1) >= limit) {
+        m_active.fetch_sub(1);
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return std::make_shared<Slot>(this);
+}
+
+std::string Proxy::status()
+{
+    std::string out;
+    char buf[256];
+    int64_t now = now_ms();
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (auto &group : m_groups) {
+        for (auto &up : *group) {
+            int64_t down = up->down_until.load() - now;
+            snprintf(buf, sizeof buf,
+                     "%s outstanding=%d idle=%zu requests=%llu errors=%llu down=%llds\n",
+                     up->addr.c_str(), up->outstanding.load(), up->idle.size(),
+                     (unsigned long long)up->requests.load(),
+                     (unsigned long long)up->errors.load(),
+                     (long long)(down > 0 ? (down + 999) / 1000 : 0));
+            out += buf;
+        }
+    }
+    snprintf(buf, sizeof buf,
+             "active=%u limit=%u rejected=%llu\n", m_active.load(), m_limit.load(),
+             (unsigned long long)m_rejected.load());
+    out += buf;
+    return out;
+}
+
+std::string Proxy::scrape()
+{
+    std::string out;
+    if (m_groups.empty())
+        return out;
+    struct Series {
+        const char *name;
+        const char *help;
+        const char *type;
+    };
+    static const Series series[] = {
+        {"mango_upstream_up", "Whether the upstream is considered healthy.", "gauge"},
+        {"mango_upstream_outstanding", "Requests in flight to the upstream.", "gauge"},
+        {"mango_upstream_idle_connections", "Pooled keep-alive connections.", "gauge"},
+        {"mango_upstream_requests_total", "Requests forwarded to the upstream.", "counter"},
+        {"mango_upstream_errors_total", "Failed exchanges with the upstream.", "counter"},
+    };
+    char buf[256];
+    snprintf(buf, sizeof buf,
+             "# HELP mango_proxy_rejected_total Requests rejected over the proxy limit.\n"
+             "# TYPE mango_proxy_rejected_total counter\nmango_proxy_rejected_total %llu\n",
+             (unsigned long long)m_rejected.load(std::memory_order_relaxed));
+    out += buf;
+    int64_t now = now_ms();
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (size_t k = 0; k < sizeof series / sizeof series[0]; ++k) {
+        snprintf(buf, sizeof buf, "# HELP %s %s\n# TYPE %s %s\n", series[k].name, series[k].help,
+                 series[k].name, series[k].type);
+        out += buf;
+        for (auto &group : m_groups) {
+            for (auto &up : *group) {
+                uint64_t values[] = {
+                    up->down_until.load(std::memory_order_relaxed) <= now,
+                    (uint64_t)up->outstanding.load(std::memory_order_relaxed),
+                    up->idle.size(),
+                    up->requests.load(std::memory_order_relaxed),
+                    up->errors.load(std::memory_order_relaxed),
+                };
+                snprintf(buf, sizeof buf, "%s{upstream=\"%s\"} %llu\n", series[k].name,
+                         up->addr.c_str(), (unsigned long long)values[k]);
+                out += buf;
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,145 @@
+#include "scoreboard.h"
+#include "log.h"
+#include <new>
+#include <sys/mman.h>
+
+bool Scoreboard::create(unsigned workers)
+{
+    if (m_slots || workers == 0 || workers > MAX_WORKERS)
+        return false;
+    size_t size = sizeof(Slot) * (workers + 1);
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        LOG_ERROR("Scoreboard mmap failed: %s", strerror(errno));
+        return false;
+    }
+    // 匿名映射的内容为零，placement new只是为了开始原子对象的生存期
+    m_slots = static_cast<Slot *>(mem);
+    for (unsigned i = 0; i <= workers; ++i)
+        new (&m_slots[i]) Slot();
+    m_workers = workers;
+    return true;
+}
+
+void Scoreboard::update()
+{
+    uint64_t counters[Metrics::COUNTER_NUM], responses;
+    Metrics::getInstance().totals(counters, responses);
+    Slot &s = m_slots[m_index];
+    for (int i = 0; i < Metrics::COUNTER_NUM; ++i)
+        s.counters[i].store(counters[i], std::memory_order_relaxed);
+    s.responses.store(responses, std::memory_order_relaxed);
+}
+
+void Scoreboard::publish(unsigned idx)
+{
+    if (!m_slots || idx >= m_workers || m_thread.joinable())
+        return;
+    m_index = idx;
+    m_thread = std::thread(&Scoreboard::work, this);
+}
+
+void Scoreboard::work()
+{
+    while (true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> ulk(m_mutex);
+            if (!m_shutdown)
+                m_cv.wait_for(ulk, std::chrono::seconds(1));
+            stop = m_shutdown;
+        }
+        update();
+        if (stop)
+            return;
+    }
+}
+
+void Scoreboard::retire(unsigned idx)
+{
+    Slot &s = m_slots[idx];
+    Slot &r = m_slots[m_workers];
+    for (int i = 0; i < Metrics::COUNTER_NUM; ++i) {
+        r.counters[i].fetch_add(s.counters[i].load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+        s.counters[i].store(0, std::memory_order_relaxed);
+    }
+    r.responses.fetch_add(s.responses.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    s.responses.store(0, std::memory_order_relaxed);
+    s.pid.store(0);
+}
+
+void Scoreboard::totals(uint64_t (&counters)[Metrics::COUNTER_NUM], uint64_t &responses)
+{
+    memset(counters, 0, sizeof counters);
+    responses = 0;
+    for (unsigned w = 0; w <= m_workers; ++w) {
+        Slot &s = m_slots[w];
+        for (int i = 0; i < Metrics::COUNTER_NUM; ++i)
+            counters[i] += s.counters[i].load(std::memory_order_relaxed);
+        responses += s.responses.load(std::memory_order_relaxed);
+    }
+}
+
+std::string Scoreboard::scrape()
+{
+    std::string out;
+    if (!m_slots)
+        return out;
+    // 抓取到的是应答进程最新的计数，其他进程的计数最多延迟一秒
+    if (m_index >= 0)
+        update();
+    struct Series {
+        const char *name;
+        const char *help;
+        const char *type;
+    };
+    static const Series series[] = {
+        {"mango_worker_up", "Whether the worker process is running.", "gauge"},
+        {"mango_worker_restarts_total", "Times the worker was respawned.", "counter"},
+        {"mango_worker_responses_total", "Responses sent by the worker.", "counter"},
+        {"mango_worker_connections_accepted_total", "Connections accepted by the worker.", "counter"},
+        {"mango_worker_connections_active", "Open connections of the worker.", "gauge"},
+        {"mango_worker_bytes_sent_total", "Bytes written to clients by the worker.", "counter"},
+    };
+    char buf[160];
+    for (size_t k = 0; k < sizeof series / sizeof series[0]; ++k) {
+        snprintf(buf, sizeof buf, "# HELP %s %s\n# TYPE %s %s\n", series[k].name, series[k].help,
+                 series[k].name, series[k].type);
+        out += buf;
+        for (unsigned w = 0; w < m_workers; ++w) {
+            Slot &s = m_slots[w];
+            uint64_t accepted = s.counters[Metrics::CONN_ACCEPTED].load(std::memory_order_relaxed);
+            uint64_t closed = s.counters[Metrics::CONN_CLOSED].load(std::memory_order_relaxed);
+            uint64_t values[] = {
+                s.pid.load(std::memory_order_relaxed) != 0,
+                s.restarts.load(std::memory_order_relaxed),
+                s.responses.load(std::memory_order_relaxed),
+                accepted,
+                accepted > closed ? accepted - closed : 0,
+                s.counters[Metrics::BYTES_OUT].load(std::memory_order_relaxed),
+            };
+            snprintf(buf, sizeof buf, "%s{worker=\"%u\"} %llu\n", series[k].name, w,
+                     (unsigned long long)values[k]);
+            out += buf;
+        }
+    }
+    return out;
+}
+
+void Scoreboard::stop()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+}
+
+Scoreboard::~Scoreboard()
+{
+    stop();
+}
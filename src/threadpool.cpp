@@ -1,11 +1,28 @@
 #include "threadpool.h"
+#include "metrics.h"
 #include <iostream>
 
+// 慢请求默认的最长等待时间（毫秒）
+static const unsigned DEFAULT_MAX_WAIT = 200;
+
 ThreadPool::ThreadPool(size_t thread_num, size_t max_reqs)
-: m_thread_num(thread_num), m_max_requests(max_reqs)
+: m_thread_num(0), m_max_requests(max_reqs), m_max_wait(DEFAULT_MAX_WAIT * 1000000ull)
+{
+    resize(thread_num);
+}
+
+void ThreadPool::resize(size_t thread_num)
 {
+    std::lock_guard<std::mutex> lg(m_mtx);
+    reap();
+    m_thread_num = thread_num;
+    // 缩容时唤醒空闲线程，由它们自行退出
+    if (m_running > m_thread_num) {
+        m_cv.notify_all();
+        return;
+    }
     m_threads.reserve(m_thread_num);
-    for (int i = 0; i < m_thread_num; ++i) {
+    for (; m_running < m_thread_num; ++m_running) {
         std::thread tt(worker);
         // tt.detach(); 
         // 采用析构时join的方式，确保线程正确释放
@@ -13,14 +30,82 @@ ThreadPool::ThreadPool(size_t thread_num, size_t max_reqs)
     }
 }
 
+ThreadPool::size_t ThreadPool::threads()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_thread_num;
+}
+
+void ThreadPool::setMaxRequests(size_t max_requests)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    m_max_requests = max_requests;
+}
+
+ThreadPool::size_t ThreadPool::maxRequests()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_max_requests;
+}
+
+void ThreadPool::setWeight(size_t weight)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    m_weight = weight;
+}
+
+ThreadPool::size_t ThreadPool::weight()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_weight;
+}
+
+void ThreadPool::setMaxWait(size_t ms)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    m_max_wait = ms * 1000000ull;
+}
+
+ThreadPool::size_t ThreadPool::maxWait()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_max_wait / 1000000;
+}
+
+std::string ThreadPool::status()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return "fast " + std::to_string(m_lanes[FAST].size()) + " queued, slow " +
+           std::to_string(m_lanes[SLOW].size()) + " queued, " + std::to_string(m_slow_running) +
+           " running";
+}
+
+void ThreadPool::reap()
+{
+    for (auto id : m_exited) {
+        for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+            if (it->get_id() == id) {
+                it->join();
+                m_threads.erase(it);
+                break;
+            }
+        }
+    }
+    m_exited.clear();
+}
+
 bool ThreadPool::appendReq(std::shared_ptr<WorkRequest> req)
 {
     std::lock_guard<std::mutex> lg(m_mtx);
-    if (m_workqueue.size() >= m_max_requests) 
+    if (m_queued >= m_max_requests) 
     {
+        Metrics::add(Metrics::POOL_REJECTED);
         return false;
     }
-    m_workqueue.push(req);
+    req->m_enqueue_time = Metrics::now();
+    Metrics::add(Metrics::POOL_ENQUEUED);
+    m_lanes[req->m_lane].push(req);
+    ++m_queued;
     m_cv.notify_one();
     return true;
 }
@@ -31,28 +116,75 @@ void ThreadPool::worker()
     pool.run();
 }
 
+bool ThreadPool::pop(std::shared_ptr<WorkRequest> &req)
+{
+    auto &fast = m_lanes[FAST];
+    auto &slow = m_lanes[SLOW];
+    // 保留一个线程给快请求
+    size_t slow_limit = m_running > 1 ? m_running - 1 : 1;
+    bool take_slow = !slow.empty() && m_slow_running < slow_limit;
+    if (take_slow && !fast.empty()) {
+        take_slow = m_streak >= m_weight ||
+                    Metrics::now() - slow.front()->m_enqueue_time >= m_max_wait;
+    }
+    if (take_slow) {
+        req = std::move(slow.front());
+        slow.pop();
+        m_streak = 0;
+        ++m_slow_running;
+    }
+    else if (!fast.empty()) {
+        req = std::move(fast.front());
+        fast.pop();
+        ++m_streak;
+    }
+    else {
+        return false;
+    }
+    --m_queued;
+    return true;
+}
+
 void ThreadPool::run()
 {
     while (true)
     {
+        std::shared_ptr<WorkRequest> req;
         std::unique_lock<std::mutex> ulk(m_mtx);
-        while (m_workqueue.empty()) {
+        while (m_running > m_thread_num || !pop(req)) {
             if (m_shutdown)
                 return;
+            // 线程数超过目标值，本线程退出，由下一次调整时join
+            if (m_running > m_thread_num) {
+                --m_running;
+                m_exited.push_back(std::this_thread::get_id());
+                return;
+            }
             m_cv.wait(ulk);
         }
-        auto req = m_workqueue.front();
-        m_workqueue.pop();
         ulk.unlock();
-        if (!req)
-            continue;
+        LANE lane = req->m_lane;
+        Metrics::add(Metrics::POOL_DEQUEUED);
+        Metrics::observe(lane == SLOW ? Metrics::POOL_WAIT_SLOW : Metrics::POOL_WAIT,
+                         Metrics::now() - req->m_enqueue_time);
         req->do_request();
+        req.reset();
+        if (lane == SLOW) {
+            // 让出的名额交给等待中的慢请求
+            std::lock_guard<std::mutex> lg(m_mtx);
+            --m_slow_running;
+            if (!m_lanes[SLOW].empty())
+                m_cv.notify_one();
+        }
     }
 }
 
 ThreadPool::~ThreadPool() 
 {
-    m_shutdown = true;
+    {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_shutdown = true;
+    }
     for (auto &t : m_threads) {
         m_cv.notify_all();
         t.join();
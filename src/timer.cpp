@@ -24,9 +24,10 @@ void TimerWheelHandler::set_timer(timer_type &timer, size_t timeout)
 
 void TimerWheelHandler::mod_timer(std::shared_ptr<timer_type> _timer, size_t timeout) 
 {
-    printf("mod timer\n");
-
+    // 从原来的槽中取出，按新的超时时间放入对应的槽
+    delete_timer(_timer);
     set_timer(*_timer, timeout);
+    add_timer(_timer);
 }
 
 void TimerWheelHandler::add_timer(std::shared_ptr<timer_type> _timer)
@@ -38,7 +39,7 @@ void TimerWheelHandler::add_timer(std::shared_ptr<timer_type> _timer)
 
 void TimerWheelHandler::delete_timer(std::shared_ptr<timer_type> _timer)
 {
-    auto curlist = m_slots[_timer->args[1]];
+    auto &curlist = m_slots[_timer->args[1]];
     for (auto it = curlist.begin(); it != curlist.end(); ) {
         if (*it == _timer) {
             auto tmp = it++;
@@ -70,7 +71,7 @@ void TimerWheelHandler::tick()
             curlist.erase(tmp);
         }
     }
-    m_curslot = ++m_curslot % m_slots.size();
+    m_curslot = (m_curslot + 1) % m_slots.size();
 }
 
 std::shared_ptr<timer_type> TimerWheelHandler::get_timer(std::shared_ptr<HTTPConn> _conn, size_t timeout)
@@ -0,0 +1,134 @@
+#include "trace.h"
+#include "log.h"
+#include <thread>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// 缓冲区在线程首次记录时分配，只在追踪开启后产生开销；线程退出后保留，导出时仍可见，
+// 直到被线程池扩容时新建的线程复用
+Tracer::ThreadTrace *Tracer::local()
+{
+    struct Guard {
+        std::shared_ptr<ThreadTrace> tt;
+        ~Guard() {
+            if (tt)
+                tt->orphan.store(true, std::memory_order_release);
+        }
+    };
+    thread_local Guard guard;
+    thread_local ThreadTrace *tt = nullptr;
+    if (!tt) {
+        guard.tt = getInstance().attach();
+        tt = guard.tt.get();
+    }
+    return tt;
+}
+
+std::shared_ptr<Tracer::ThreadTrace> Tracer::attach()
+{
+    long tid = syscall(SYS_gettid);
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (auto &tt : m_threads) {
+        bool expected = true;
+        if (tt->orphan.compare_exchange_strong(expected, false, std::memory_order_acq_rel)) {
+            // 序号从0重新开始，导出时旧线程的区间因seq不符被跳过，不会记在新线程名下
+            tt->tid.store(tid, std::memory_order_relaxed);
+            tt->next.store(0, std::memory_order_release);
+            return tt;
+        }
+    }
+    m_threads.push_back(std::make_shared<ThreadTrace>());
+    m_threads.back()->tid.store(tid, std::memory_order_relaxed);
+    return m_threads.back();
+}
+
+void Tracer::record(const char *name, uint64_t start, uint64_t dur, uint64_t id, SPAN_KIND kind)
+{
+    ThreadTrace *tt = local();
+    uint64_t n = tt->next.load(std::memory_order_relaxed);
+    Span &span = tt->spans[n % CAPACITY];
+    span.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    span.name.store(name, std::memory_order_relaxed);
+    span.start.store(start, std::memory_order_relaxed);
+    span.dur.store(dur, std::memory_order_relaxed);
+    span.id.store(id, std::memory_order_relaxed);
+    span.kind.store(kind, std::memory_order_relaxed);
+    span.seq.store(2 * n + 2, std::memory_order_release);
+    tt->next.store(n + 1, std::memory_order_release);
+}
+
+long Tracer::dump(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return -1;
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        threads = m_threads;
+    }
+    int pid = getpid();
+    long count = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (auto &tt : threads) {
+        long tid = tt->tid.load(std::memory_order_relaxed);
+        uint64_t end = tt->next.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        for (uint64_t n = begin; n < end; ++n) {
+            Span &span = tt->spans[n % CAPACITY];
+            uint64_t seq = span.seq.load(std::memory_order_acquire);
+            if (seq != 2 * n + 2)
+                continue;
+            const char *name = span.name.load(std::memory_order_relaxed);
+            uint64_t start = span.start.load(std::memory_order_relaxed);
+            uint64_t dur = span.dur.load(std::memory_order_relaxed);
+            uint64_t id = span.id.load(std::memory_order_relaxed);
+            uint8_t kind = span.kind.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // 读取期间被写者覆盖
+            if (span.seq.load(std::memory_order_relaxed) != seq)
+                continue;
+            const char *sep = count++ ? "," : "";
+            if (kind == SPAN_SYNC) {
+                fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":%d,\"tid\":%ld,\"args\":{\"req\":%llu}}\n", sep, name, start / 1e3,
+                        dur / 1e3, pid, tid, (unsigned long long)id);
+            }
+            else {
+                // 异步区间以开始和结束两个事件表示，按请求id关联
+                fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"queue\",\"ph\":\"b\",\"id\":%llu,\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%ld}\n", sep, name, (unsigned long long)id, start / 1e3,
+                        pid, tid);
+                fprintf(fp, ",{\"name\":\"%s\",\"cat\":\"queue\",\"ph\":\"e\",\"id\":%llu,\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%ld}\n", name, (unsigned long long)id, (start + dur) / 1e3,
+                        pid, tid);
+            }
+        }
+    }
+    fprintf(fp, "]}\n");
+    bool ok = ferror(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+    return ok ? count : -1;
+}
+
+void Tracer::dump_async(const std::string &dir)
+{
+    bool expected = false;
+    if (!m_dumping.compare_exchange_strong(expected, true)) {
+        LOG_WARN("%s", "Trace dump already in progress");
+        return;
+    }
+    char name[64];
+    snprintf(name, sizeof name, "trace_%d_%ld.json", (int)getpid(), (long)time(nullptr));
+    std::string path = dir + name;
+    std::thread([this, path]() {
+        long count = dump(path);
+        if (count < 0)
+            LOG_ERROR("Dump trace to %s failed", path.c_str());
+        else
+            LOG_INFO("Dumped %ld trace spans to %s", count, path.c_str());
+        m_dumping.store(false);
+    }).detach();
+}
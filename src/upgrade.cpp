@@ -0,0 +1,222 @@
+#include "upgrade.h"
+#include "log.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+extern char **environ;
+
+// 新进程中与旧进程通信的描述符固定为3，其余描述符全部关闭
+static const int INHERIT_FD = 3;
+
+static bool send_fd(int sock, int fd)
+{
+    char byte = 'L';
+    iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof control);
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static int recv_fd(int sock)
+{
+    char byte;
+    iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+        return -1;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+    return fd;
+}
+
+// 升级时通常已用新版本覆盖了原路径，按启动时的argv[0]执行；不含路径时使用当前可执行文件
+static std::string exe_path(const std::string &argv0)
+{
+    if (argv0.find('/') != std::string::npos)
+        return argv0;
+    char buf[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", buf, sizeof buf - 1);
+    if (n <= 0)
+        return "";
+    std::string path(buf, n);
+    const std::string deleted = " (deleted)";
+    if (path.size() > deleted.size() &&
+        path.compare(path.size() - deleted.size(), deleted.size(), deleted) == 0)
+        path.resize(path.size() - deleted.size());
+    return path;
+}
+
+int Upgrade::start(int listenfd)
+{
+    if (m_sock != -1) {
+        LOG_WARN("%s", "Upgrade already in progress");
+        return -1;
+    }
+    // 命令行参数原样传给新进程
+    std::ifstream in("/proc/self/cmdline", std::ios::binary);
+    std::string cmdline((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<std::string> args;
+    for (size_t pos = 0; pos < cmdline.size();) {
+        size_t end = cmdline.find('\0', pos);
+        if (end == std::string::npos)
+            end = cmdline.size();
+        args.push_back(cmdline.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    std::string path = args.empty() ? "" : exe_path(args[0]);
+    if (path.empty()) {
+        LOG_ERROR("%s", "Upgrade failed: cannot determine executable");
+        return -1;
+    }
+    std::vector<std::string> envs;
+    std::string prefix = std::string(ENV_FD) + "=";
+    for (char **e = environ; *e; ++e) {
+        if (strncmp(*e, prefix.c_str(), prefix.size()) != 0)
+            envs.push_back(*e);
+    }
+    envs.push_back(prefix + std::to_string(INHERIT_FD));
+    // fork之后子进程只能调用异步信号安全的函数，参数在此之前准备好
+    std::vector<char *> argv, envp;
+    for (auto &s : args)
+        argv.push_back(&s[0]);
+    argv.push_back(nullptr);
+    for (auto &s : envs)
+        envp.push_back(&s[0]);
+    envp.push_back(nullptr);
+    struct rlimit rl;
+    long maxfd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+                     ? (long)rl.rlim_cur : 65536;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        LOG_ERROR("Upgrade socketpair failed: %s", strerror(errno));
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR("Upgrade fork failed: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // dup2得到的描述符不带CLOEXEC，若恰好已是3则需要手动清除
+        if (sv[1] == INHERIT_FD)
+            fcntl(INHERIT_FD, F_SETFD, 0);
+        else
+            dup2(sv[1], INHERIT_FD);
+        // 连接、epoll等描述符不能泄漏给新进程
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, INHERIT_FD + 1, ~0u, 0) != 0)
+#endif
+            for (long fd = INHERIT_FD + 1; fd < maxfd; ++fd)
+                close(fd);
+        execve(path.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    if (!send_fd(sv[0], listenfd)) {
+        LOG_ERROR("Upgrade send listenfd failed: %s", strerror(errno));
+        m_sock = sv[0];
+        m_pid = pid;
+        abort();
+        return -1;
+    }
+    m_sock = sv[0];
+    m_pid = pid;
+    LOG_WARN("Upgrading: started %s as pid %d", path.c_str(), (int)pid);
+    return m_sock;
+}
+
+bool Upgrade::finish()
+{
+    char byte;
+    ssize_t n;
+    do {
+        n = recv(m_sock, &byte, 1, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) {
+        LOG_ERROR("Upgrade failed: pid %d exited before ready", (int)m_pid);
+        abort();
+        return false;
+    }
+    LOG_WARN("Upgrade: pid %d ready, draining", (int)m_pid);
+    close(m_sock);
+    m_sock = -1;
+    // 新进程成为本进程的子进程，本进程退出后由init回收
+    m_pid = -1;
+    return true;
+}
+
+void Upgrade::abort()
+{
+    if (m_sock == -1)
+        return;
+    // 新进程在就绪前不会accept，可以直接结束
+    if (m_pid > 0) {
+        kill(m_pid, SIGKILL);
+        waitpid(m_pid, nullptr, 0);
+    }
+    close(m_sock);
+    m_sock = -1;
+    m_pid = -1;
+}
+
+int Upgrade::inherit()
+{
+    const char *env = getenv(ENV_FD);
+    if (!env)
+        return -1;
+    int sock = atoi(env);
+    // 本进程再次升级时不能继承旧的值
+    unsetenv(ENV_FD);
+    int fd = recv_fd(sock);
+    if (fd < 0) {
+        LOG_ERROR("Upgrade receive listenfd failed: %s", strerror(errno));
+        close(sock);
+        return -1;
+    }
+    m_sock = sock;
+    return fd;
+}
+
+void Upgrade::ready()
+{
+    if (m_sock == -1)
+        return;
+    char byte = 'R';
+    if (send(m_sock, &byte, 1, MSG_NOSIGNAL) != 1)
+        LOG_ERROR("Upgrade notify failed: %s", strerror(errno));
+    close(m_sock);
+    m_sock = -1;
+}
@@ -1,4 +1,7 @@
 #include "utils.h"
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 int setnonblocking(int fd)
 {
@@ -8,7 +11,34 @@ int setnonblocking(int fd)
     return old_option;
 }
 
-void EpollControl::addfd(int fd, TRI_MODE tmode, bool oneshot)
+int listen_socket(const char *ip, int port)
+{
+    struct sockaddr_in address;
+    bzero(&address, sizeof address);
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0)
+        return -1;
+    // struct linger tmp = {1, 0}; // 强制退出模式，非优雅关闭
+    // setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof tmp);
+
+    // 用于调试，取消对应socket的time_wait状态
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+    // 压测时大量连接同时到达，队列过短会导致SYN被丢弃并在1秒后重传
+    if (bind(listenfd, (struct sockaddr *)&address, sizeof address) < 0 ||
+        listen(listenfd, SOMAXCONN) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+void EpollControl::addfd(int fd, TRI_MODE tmode, bool oneshot, bool exclusive)
 {
     struct epoll_event event;
     event.events = EPOLLIN | EPOLLRDHUP;
@@ -21,6 +51,9 @@ void EpollControl::addfd(int fd, TRI_MODE tmode, bool oneshot)
         // 只会触发一次，除非使用epoll_ctl函数重置该文件描述符上注册的EPOLLONESHOT事件
         event.events |= EPOLLONESHOT;
     }
+    // EPOLLEXCLUSIVE不能与EPOLLRDHUP同时使用，监听套接字也不需要
+    if (exclusive)
+        event.events = (event.events & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
     epoll_ctl(getfd(), EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 }
@@ -31,17 +64,27 @@ void EpollControl::removefd(int fd)
     close(fd);
 }
 
-void EpollControl::reset_oneshot(int fd, int ev) 
+void EpollControl::addconn(int fd)
 {
-    epoll_event event;
+    struct epoll_event event;
+    event.data.fd = fd;
+    // 读写事件同时关注，ET模式下仅在状态变化时通知，无需在每次请求后EPOLL_CTL_MOD
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(getfd(), EPOLL_CTL_ADD, fd, &event);
+    setnonblocking(fd);
+}
+
+void EpollControl::rearm(int fd)
+{
+    struct epoll_event event;
     event.data.fd = fd;
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
     epoll_ctl(getfd(), EPOLL_CTL_MOD, fd, &event);
 }
 
-int EpollControl::wait(epoll_event **events)
+int EpollControl::wait(epoll_event **events, int timeout)
 {
-    int num = epoll_wait(getfd(), m_events, MAX_EVENT_NUMBER, -1);
+    int num = epoll_wait(getfd(), m_events, MAX_EVENT_NUMBER, timeout);
     *events = m_events;
     return num;
 }
@@ -2,8 +2,9 @@
 
 void WebServer::init(const char *ip, int port)
 {
-    LOG_INFO("%s", "Initializing");
     init_log();
+    LOG_INFO("%s", "Initializing");
+    init_fdlimit();
     // 信号处理相关
     init_signal();
     // 向某个已被关闭或未连接的socket发送数据时，产生SIGPIPE信号
@@ -15,144 +16,345 @@ void WebServer::init(const char *ip, int port)
     m_sighdr.delaysig(SIGINT);
     // kill命令处理方式，添加到延后处理队列中
     m_sighdr.delaysig(SIGTERM);
+    // 导出请求追踪记录
+    m_sighdr.delaysig(SIGUSR1);
+    // CPU采样，结束后导出折叠调用栈
+    m_sighdr.delaysig(SIGUSR2);
+    // 平滑升级，启动新的可执行文件并交出监听套接字
+    m_sighdr.delaysig(SIGHUP);
     // 初始化定时器管理类，这里采用时间轮
     // TimerWheelHandler timer_hdr;
+    init_routes();
+    init_body();
+    init_diskio();
+    init_zerocopy();
 
-    LOG_INFO("Binding server @%s:%d", ip, port);
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof address);
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
+    // 工作进程使用主进程的监听套接字；由旧进程启动时直接使用其监听套接字，不重新绑定
+    if (m_worker >= 0)
+        LOG_INFO<Log::NET>("Worker %d sharing listenfd %d @%s:%d", m_worker, m_listenfd, ip, port);
+    else if ((m_listenfd = m_upgrade.inherit()) != -1)
+        LOG_INFO<Log::NET>("Inherited listenfd %d @%s:%d", m_listenfd, ip, port);
+    else {
+        LOG_INFO<Log::NET>("Binding server @%s:%d", ip, port);
+        m_listenfd = listen_socket(ip, port);
+        assert(m_listenfd >= 0);
+    }
+    // listenfd关闭oneshot模式，否则每accept一个连接就需要重置
+    LOG_INFO<Log::NET>("Listening at sockfd: %d", m_listenfd);
+    m_epoller.addfd(m_listenfd, TRI_MODE::ET, false, m_worker >= 0);
+#ifdef MANGO_COROUTINES
+    // 挂起的协程处理器在主线程中恢复
+    m_epoller.addfd(CoScheduler::getInstance().fd(), TRI_MODE::LT, false);
+#endif
+    // 关闭时仍有零拷贝发送未完成的套接字由主线程等待其通知
+    m_epoller.addfd(ZeroCopy::getInstance().fd(), TRI_MODE::LT, false);
+    // 上游关闭的空闲连接由主线程移出连接池
+    if (Proxy::getInstance().enabled())
+        m_epoller.addfd(Proxy::getInstance().fd(), TRI_MODE::LT, false);
+    if (m_worker >= 0)
+        Scoreboard::getInstance().publish(m_worker);
+    init_admin(ip, port);
+    // 初始化完成，旧进程可以停止accept
+    m_upgrade.ready();
+}
 
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
-    // struct linger tmp = {1, 0}; // 强制退出模式，非优雅关闭
-    // setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof tmp);
-    
-    // 用于调试，取消对应socket的time_wait状态
-    int reuse = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+// 解析[lo, hi]范围内的无符号整数
+static bool parse_uint(const std::string &s, unsigned long lo, unsigned long hi,
+                       unsigned long &out)
+{
+    char *end = nullptr;
+    errno = 0;
+    unsigned long v = strtoul(s.c_str(), &end, 10);
+    if (s.empty() || s[0] == '-' || *end != '\0' || errno != 0 || v < lo || v > hi)
+        return false;
+    out = v;
+    return true;
+}
 
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof address);
-    assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
-    assert(ret >= 0);
-    // listenfd关闭oneshot模式，否则每accept一个连接就需要重置
-    LOG_INFO("Listening at sockfd: %d", m_listenfd);
-    m_epoller.addfd(m_listenfd, TRI_MODE::ET, false);
+void WebServer::init_admin(const char *ip, int port)
+{
+    const char *path = getenv("MANGO_ADMIN");
+    if (!path)
+        path = "../mango.sock";
+    if (!*path)
+        return;
+    std::string admin_path = path + file_suffix();
+    Admin &admin = Admin::getInstance();
+    std::string listen_addr = std::string(ip) + ":" + std::to_string(port);
+    admin.add_setting("listen", "listening address",
+                      [listen_addr]() { return listen_addr; });
+    admin.add_setting("connections", "open connections",
+                      []() { return std::to_string(HTTPConn::m_user_count.load()); });
+    admin.add_setting("workers", "thread pool size, 1-1024",
+                      [this]() { return std::to_string(m_pool.threads()); },
+                      [this](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 1, 1024, n))
+                              return false;
+                          m_pool.resize(n);
+                          return true;
+                      });
+    admin.add_setting("queue_limit", "requests queued for the pool before rejecting",
+                      [this]() { return std::to_string(m_pool.maxRequests()); },
+                      [this](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 1, 1u << 24, n))
+                              return false;
+                          m_pool.setMaxRequests(n);
+                          return true;
+                      });
+    admin.add_setting("pool_weight", "fast requests dequeued per slow request, 1-1024",
+                      [this]() { return std::to_string(m_pool.weight()); },
+                      [this](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 1, 1024, n))
+                              return false;
+                          m_pool.setWeight(n);
+                          return true;
+                      });
+    admin.add_setting("pool_max_wait", "milliseconds before a slow request jumps the fast lane",
+                      [this]() { return std::to_string(m_pool.maxWait()); },
+                      [this](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 1, 600000, n))
+                              return false;
+                          m_pool.setMaxWait(n);
+                          return true;
+                      });
+    admin.add_setting("pool_lanes", "requests queued in each pool lane",
+                      [this]() { return m_pool.status(); });
+    admin.add_setting("max_conns", "connections accepted before rejecting",
+                      [this]() { return std::to_string(m_max_fd.load()); },
+                      [this](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 1, 1u << 24, n))
+                              return false;
+                          m_max_fd.store(n);
+                          return true;
+                      });
+    admin.add_setting("log", "log levels, e.g. warn,net=info",
+                      []() { return Log::getLevels(); },
+                      [](const std::string &v) { return Log::setLevels(v); });
+    admin.add_setting("trace_sampling", "trace 1 in N requests, 0 to disable",
+                      []() { return std::to_string(Tracer::sampling()); },
+                      [](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 0, 1u << 30, n))
+                              return false;
+                          Tracer::setSampling(n);
+                          return true;
+                      });
+    admin.add_setting("max_body", "request body bytes accepted for handlers",
+                      []() { return std::to_string(HTTPConn::m_max_body.load()); },
+                      [](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 0, 1ul << 32, n))
+                              return false;
+                          HTTPConn::m_max_body.store(n);
+                          return true;
+                      });
+    admin.add_setting("max_upload", "upload bytes accepted per file",
+                      []() { return std::to_string(HTTPConn::m_max_upload.load()); },
+                      [](const std::string &v) {
+                          unsigned long n;
+                          if (!parse_uint(v, 0, 1ul << 40, n))
+                              return false;
+                          HTTPConn::m_max_upload.store(n);
+                          return true;
+                      });
+    admin.add_setting("upload_dir", "directory receiving PUT /upload/<name>, empty if disabled",
+                      []() { return HTTPConn::m_upload_dir; });
+#ifdef MANGO_COROUTINES
+    admin.add_setting("coroutines", "suspended coroutine handlers",
+                      []() { return std::to_string(CoScheduler::getInstance().tasks()); });
+#endif
+    admin.add_setting("zerocopy", "minimum body bytes sent with MSG_ZEROCOPY, 0 if disabled, else >= 4096",
+                      []() { return std::to_string(ZeroCopy::m_threshold.load()); },
+                      [](const std::string &v) {
+                          unsigned long n;
+                          return parse_uint(v, 0, 1ul << 32, n) && ZeroCopy::setThreshold(n);
+                      });
+    admin.add_setting("zerocopy_orphans", "closed sockets waiting for zerocopy completions",
+                      []() { return std::to_string(ZeroCopy::getInstance().orphans()); });
+    admin.add_setting("zerocopy_leaked", "buffers leaked because zerocopy completions never arrived",
+                      []() { return std::to_string(ZeroCopy::getInstance().leaked()); });
+    if (DiskIO::getInstance().enabled())
+        admin.add_setting("disk_queue", "file requests waiting for the disk I/O threads",
+                          []() { return std::to_string(DiskIO::getInstance().queued()); });
+    if (Proxy::getInstance().enabled()) {
+        admin.add_setting("upstreams", "reverse proxy upstreams and their pools",
+                          []() { return Proxy::getInstance().status(); });
+        admin.add_setting("proxy_limit", "concurrent proxied requests before answering 503",
+                          []() { return std::to_string(Proxy::getInstance().limit()); },
+                          [](const std::string &v) {
+                              unsigned long n;
+                              if (!parse_uint(v, 1, 1u << 16, n))
+                                  return false;
+                              Proxy::getInstance().setLimit(n);
+                              return true;
+                          });
+    }
+    admin.add_command("metrics", "print the Prometheus metrics",
+                      [](const std::vector<std::string> &) {
+                          return Metrics::getInstance().scrape();
+                      });
+    admin.add_command("trace-dump", "dump sampled traces next to the log",
+                      [](const std::vector<std::string> &) {
+                          Tracer::getInstance().dump_async("../");
+                          return std::string("OK\n");
+                      });
+    admin.add_command("profile", "[SECONDS [HZ]] sample CPU stacks, then dump them",
+                      [this](const std::vector<std::string> &args) {
+                          unsigned long seconds = m_profile_seconds, hz = m_profile_hz;
+                          if ((args.size() > 0 && !parse_uint(args[0], 1, 3600, seconds)) ||
+                              (args.size() > 1 && !parse_uint(args[1], 1, 10000, hz)))
+                              return std::string("ERR usage: profile [SECONDS [HZ]]\n");
+                          if (!Profiler::getInstance().start_async("../", seconds, hz))
+                              return std::string("ERR profiler already running\n");
+                          return "OK profiling for " + std::to_string(seconds) + "s\n";
+                      });
+    if (m_worker < 0)
+        admin.add_command("upgrade", "start a new binary and hand over the listen socket",
+                          [this](const std::vector<std::string> &) {
+                              // 管理线程只发出信号，升级在主线程中进行
+                              kill(getpid(), SIGHUP);
+                              return std::string("OK\n");
+                          });
+    admin.start(admin_path);
+}
+
+void WebServer::init_fdlimit()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    // 为监听、epoll、日志等保留一部分描述符，超出上限的连接在accept后立即拒绝
+    const rlim_t reserved = 64;
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > reserved)
+        m_max_fd = rl.rlim_cur - reserved;
+    else if (rl.rlim_cur == RLIM_INFINITY)
+        m_max_fd = 1 << 20;
+    LOG_INFO<Log::NET>("Fd limit %llu, max connections %u", (unsigned long long)rl.rlim_cur,
+                       m_max_fd.load());
 }
 
 void WebServer::run()
 {
     while (!m_stopserver) {
-        int num = m_epoller.wait(&m_events);
+        // 升级或排空期间定期醒来检查期限
+        bool waiting = m_draining || m_upgrade.fd() != -1;
+        int num = m_epoller.wait(&m_events, waiting ? 100 : -1);
         // 对异常进行处理，避免因为信号中断导致epoll失败
         if ((num < 0) && (errno != EINTR)) {
-            LOG_ERROR("%s", "epoll failure");
+            LOG_ERROR<Log::NET>("%s", "epoll failure");
             break;
         }
         // 遍历处理epoll事件
         for (int i = 0; i < num; ++i) {
             m_eventfd = m_events[i].data.fd;
-            LOG_INFO("handle sockfd: %d", m_eventfd);
+            // 每个epoll事件都会经过这里，采样记录
+            static LogSampler event_sampler(1024);
+            LOG_LIMITED<Log::INFO, Log::NET>(event_sampler, "handle sockfd: %d", m_eventfd);
             if (m_eventfd == m_listenfd)
             {
-                int connfd = handle_listen();
-                if (connfd == -1) {
-                    LOG_ERROR("%s", "Listen error");
-                    continue;
-                }
-                if (HTTPConn::m_user_count >= MAX_FD) {
-                    LOG_ERROR("More than MAXFD: %d", MAX_FD);
-                    send_error(connfd, "Internal server busy");
-                    close(connfd);
-                    continue;
-                }
-                LOG_INFO("Connect with sock: %d", connfd);
-                // 添加事件，ET且关闭oneshot
-                // m_epoller.addfd(connfd, TRI_MODE::ET, false);
-                auto conn = m_connhdr.add_conn(connfd);
-                conn->init(connfd, ACTOR_MODE::PROACTOR, TRI_MODE::ET, true);
+                TraceSpan span("handle_listen", Tracer::sample());
+                handle_listen();
+            }
+            else if (m_eventfd == m_sighdr.get_sockread())
+            {
+                if (m_events[i].events & EPOLLIN)
+                    handle_signal();
             }
-            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            else if (m_eventfd == m_upgrade.fd())
             {
-                // 出错，关闭当前处理的fd并释放所有资源
-                LOG_ERROR("EpollError, sockfd: %d, relese rec", m_eventfd);
-                closefd(m_eventfd);
+                handle_upgrade();
             }
-            else if (m_eventfd == m_sighdr.get_sockread() && (m_events[i].events & EPOLLIN))
+#ifdef MANGO_COROUTINES
+            else if (m_eventfd == CoScheduler::getInstance().fd())
             {
-                handle_signal();
+                CoScheduler::getInstance().poll();
             }
-            else if (m_events[i].events & EPOLLIN) {
-                handle_read();
+#endif
+            else if (m_eventfd == ZeroCopy::getInstance().fd())
+            {
+                ZeroCopy::getInstance().poll();
+            }
+            else if (m_eventfd == Proxy::getInstance().fd())
+            {
+                Proxy::getInstance().poll();
             }
-            else if (m_events[i].events & EPOLLOUT) {
-                handle_write();
+            else {
+                // 错误事件同样交给连接的持有者处理，主线程不直接关闭连接
+                handle_conn(m_events[i].events);
             }
             if (m_timeout) {
                 LOG_INFO("%s", "Handle time");
             }
         }
+        if (waiting)
+            check_deadline();
     }
 }
 
-int WebServer::handle_listen() 
+void WebServer::handle_listen() 
 {
-    LOG_INFO("Listen sock: %d", m_listenfd);
-    struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof client_address;
-    int connfd = accept(m_listenfd, (struct sockaddr *)&client_address,
-                        &client_addrlength);
-    if (connfd < 0) {
-        LOG_ERROR("errno is %d. connfd is invalid.", errno);
-        return -1;
-    }
-
-    return connfd;
-}
-
-void WebServer::handle_read()
-{
-    LOG_INFO("%s", "Handle read");
-    auto conn = m_connhdr.find_conn(m_eventfd);
-    if (conn->m_actor_mode == PROACTOR)
-    {
-        // 若读成功，则加入工作队列处理（缓存区读写）
-        if (conn->read()) {
-            auto workreq = std::make_shared<HTTPReq>(conn);
-            m_pool.appendReq(workreq);
-            // 更新定时器
-            // timer_hdr.mod_timer(conns[sockfd]->m_timer, 3 * TIMESLOT);
+    LOG_INFO<Log::NET>("Listen sock: %d", m_listenfd);
+    // listenfd为ET模式，一次通知可能对应多个连接，需要accept直到队列为空
+    while (true) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof client_address;
+        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address,
+                            &client_addrlength);
+        if (connfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR<Log::NET>("errno is %d. connfd is invalid.", errno);
+            return;
         }
-        // 若读错误，则关闭连接并移除定时器
-        else {
-            // auto timer = conns[sockfd]->m_timer;
-            // conns[sockfd]->close_conn();
-            // timer_hdr.delete_timer(timer);
+        size_t max_fd = m_max_fd.load(std::memory_order_relaxed);
+        if (HTTPConn::m_user_count >= (int)max_fd) {
+            LOG_ERROR<Log::NET>("More than MAXFD: %u", max_fd);
+            Metrics::add(Metrics::CONN_REJECTED);
+            send_error(connfd, "Internal server busy");
+            close(connfd);
+            continue;
         }
-    }
-    else if (conn->m_actor_mode == REACTOR) {
-        auto workreq = std::make_shared<HTTPReq>(conn, HTTPReq::READ);
-        m_pool.appendReq(workreq);
+        LOG_INFO<Log::NET>("Connect with sock: %d", connfd);
+        // 连接一次性注册读写事件，ET且不使用oneshot
+        auto conn = m_connhdr.add_conn(connfd);
+        conn->init(connfd, ACTOR_MODE::PROACTOR);
     }
 }
 
-void WebServer::handle_write()
+void WebServer::handle_conn(uint32_t ev)
 {
-    LOG_INFO("%s", "Handle write");
     auto conn = m_connhdr.find_conn(m_eventfd);
+    if (!conn) {
+        LOG_ERROR<Log::NET>("Unknown sockfd: %d", m_eventfd);
+        return;
+    }
+    // 已有线程持有该连接，事件已记录，由持有者在释放前处理
+    if (!conn->post_events(ev))
+        return;
+    std::shared_ptr<HTTPReq> workreq;
     if (conn->m_actor_mode == PROACTOR) {
-        // 工作线程中直接完成缓存区读写，不需要再添加任务
-        if (!conn->write()) {
-            conn->close_conn();
-        }
+        // 主线程完成缓存区读写和请求解析，inline请求直接应答，其余加入工作队列处理
+        if (!conn->reactor_io())
+            return;
+        workreq = std::make_shared<HTTPReq>(conn, HTTPReq::PARSED);
     }
     else if (conn->m_actor_mode == REACTOR) {
-        auto workreq = std::make_shared<HTTPReq>(conn, HTTPReq::WRITE);
-        m_pool.appendReq(workreq);
+        workreq = std::make_shared<HTTPReq>(conn, HTTPReq::EVENTS);
+    }
+    workreq->m_lane = conn->lane(conn->m_actor_mode == PROACTOR);
+    // 工作队列已满时处理权仍在主线程，直接关闭连接
+    if (!m_pool.appendReq(workreq)) {
+        LOG_ERROR<Log::POOL>("Workqueue full, close sock: %d", m_eventfd);
+        conn->close_conn();
     }
 }
 
@@ -178,17 +380,78 @@ void WebServer::handle_signal()
                 m_stopserver = true;
                 break;
             }
+            case (SIGUSR1): {
+                // 导出追踪记录，与日志位于同一目录
+                Tracer::getInstance().dump_async("../");
+                break;
+            }
+            case (SIGUSR2): {
+                Profiler::getInstance().start_async("../", m_profile_seconds, m_profile_hz);
+                break;
+            }
+            case (SIGHUP): {
+                start_upgrade();
+                break;
+            }
         }
     }
 }
 
-void WebServer::closefd(int fd)
+// 等待新进程就绪的期限（秒），超时则放弃升级
+static const unsigned UPGRADE_TIMEOUT = 10;
+
+bool WebServer::start_upgrade()
 {
-    auto conn = m_connhdr.find_conn(fd);
-    if (conn) {
-        conn->close_conn();
+    // 多进程模式下监听套接字属于主进程
+    if (m_worker >= 0) {
+        LOG_WARN("%s", "Binary upgrade is not supported with MANGO_PROCS");
+        return false;
+    }
+    if (m_draining) {
+        LOG_WARN("%s", "Already upgraded, draining connections");
+        return false;
+    }
+    int fd = m_upgrade.start(m_listenfd);
+    if (fd == -1)
+        return false;
+    m_epoller.addfd(fd, TRI_MODE::LT, false);
+    m_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(UPGRADE_TIMEOUT);
+    return true;
+}
+
+void WebServer::handle_upgrade()
+{
+    // 失败时继续用原监听套接字服务
+    if (!m_upgrade.finish())
+        return;
+    // 新进程已在同一个监听套接字上accept，本进程关闭自己的引用即可，队列中的连接不受影响
+    m_epoller.removefd(m_listenfd);
+    m_listenfd = -1;
+    m_draining = true;
+    HTTPConn::m_draining.store(true);
+    m_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(m_drain_seconds);
+    LOG_WARN("Draining %d connections within %u seconds", HTTPConn::m_user_count.load(),
+             m_drain_seconds);
+}
+
+void WebServer::check_deadline()
+{
+    bool expired = std::chrono::steady_clock::now() >= m_deadline;
+    if (m_upgrade.fd() != -1) {
+        if (expired) {
+            LOG_ERROR("New process not ready in %u seconds, upgrade aborted", UPGRADE_TIMEOUT);
+            m_upgrade.abort();
+        }
+        return;
+    }
+    if (!m_draining)
+        return;
+    int users = HTTPConn::m_user_count.load();
+    if (users == 0 || expired) {
+        if (users > 0)
+            LOG_WARN("Drain deadline reached, closing %d connections", users);
+        else
+            LOG_WARN("%s", "All connections drained, exiting");
+        m_stopserver = true;
     }
-    m_connhdr.delete_conn(fd);
-    m_epoller.removefd(fd);
-    close(fd);
 }
@@ -0,0 +1,224 @@
+#include "zerocopy.h"
+#include "log.h"
+#include <chrono>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/errqueue.h>
+
+// 被接管的套接字等待通知的期限（毫秒），对端长期不接收时到期重置连接
+static const int64_t ORPHAN_TIMEOUT = 60 * 1000;
+// 重置连接后等待剩余通知的期限（毫秒）
+static const int64_t RESET_TIMEOUT = 10 * 1000;
+
+// 零拷贝阈值的下限，远大于std::string内联缓冲区的容量
+static const uint64_t MIN_THRESHOLD = 4096;
+
+std::atomic<uint64_t> ZeroCopy::m_threshold{0};
+
+bool ZeroCopy::setThreshold(uint64_t n)
+{
+    if (n > 0 && n < MIN_THRESHOLD)
+        return false;
+    m_threshold.store(n);
+    return true;
+}
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ZeroCopy::ZeroCopy()
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0) {
+        LOG_ERROR("ZeroCopy epoll_create failed: %s", strerror(errno));
+        return;
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_timerfd;
+    if (m_timerfd < 0 || epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_timerfd, &event) < 0)
+        LOG_ERROR("ZeroCopy timerfd failed: %s", strerror(errno));
+}
+
+ZeroCopy::~ZeroCopy()
+{
+    for (auto &kv : m_orphans)
+        drop(kv.first, kv.second.holds);
+    if (m_timerfd >= 0)
+        close(m_timerfd);
+    if (m_epfd >= 0)
+        close(m_epfd);
+}
+
+void ZeroCopy::reap(int fd, uint32_t &done, bool &copied)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+    while (true) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof serr);
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // 通知覆盖序号区间[ee_info, ee_data]
+            uint32_t next = serr.ee_data + 1;
+            if ((int32_t)(next - done) > 0)
+                done = next;
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                copied = true;
+        }
+    }
+}
+
+bool ZeroCopy::release(Holds &holds, uint32_t done)
+{
+    while (!holds.empty() && (int32_t)(done - holds.front().seq) > 0)
+        holds.pop_front();
+    return holds.empty();
+}
+
+void ZeroCopy::drop(int fd, Holds &holds)
+{
+    if (!holds.empty()) {
+        // 丢弃发送队列，避免内核在关闭后继续发送
+        struct linger lin = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof lin);
+        LOG_ERROR("Zerocopy completions lost on sockfd %d, leaking %zu buffers", fd, holds.size());
+        m_leaked += holds.size();
+        new Holds(std::move(holds));
+    }
+    close(fd);
+}
+
+void ZeroCopy::adopt(int fd, uint32_t done, Holds holds)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    // 错误队列有新通知时报告EPOLLERR；边沿触发，对端关闭后的EPOLLHUP不会反复报告
+    struct epoll_event event;
+    event.events = EPOLLET;
+    event.data.fd = fd;
+    if (m_epfd < 0 || epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        LOG_ERROR("Zerocopy adopt sockfd %d failed: %s", fd, strerror(errno));
+        drop(fd, holds);
+        return;
+    }
+    Orphan &orphan = m_orphans[fd];
+    orphan.done = done;
+    orphan.holds = std::move(holds);
+    orphan.deadline = now_ms() + ORPHAN_TIMEOUT;
+    // 登记前到达的通知不会再次触发EPOLLERR
+    bool copied = false;
+    reap(fd, orphan.done, copied);
+    if (release(orphan.holds, orphan.done)) {
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        m_orphans.erase(fd);
+    }
+    arm_timer();
+}
+
+void ZeroCopy::poll()
+{
+    struct epoll_event events[64];
+    int n = epoll_wait(m_epfd, events, 64, 0);
+    std::lock_guard<std::mutex> lg(m_mutex);
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == m_timerfd) {
+            uint64_t expired;
+            ssize_t ret = read(m_timerfd, &expired, sizeof expired);
+            (void)ret;
+            continue;
+        }
+        auto it = m_orphans.find(fd);
+        if (it == m_orphans.end())
+            continue;
+        // 连接出错或被对端重置时内核丢弃发送队列，通知随之到达，仍需等到通知后才释放缓冲区
+        bool copied = false;
+        reap(fd, it->second.done, copied);
+        if (release(it->second.holds, it->second.done)) {
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            m_orphans.erase(it);
+        }
+    }
+    expire();
+    arm_timer();
+}
+
+void ZeroCopy::expire()
+{
+    int64_t now = now_ms();
+    for (auto it = m_orphans.begin(); it != m_orphans.end();) {
+        Orphan &orphan = it->second;
+        if (orphan.deadline > now) {
+            ++it;
+            continue;
+        }
+        int fd = it->first;
+        if (!orphan.reset) {
+            // 以AF_UNSPEC调用connect断开TCP连接并丢弃发送队列，套接字保持打开，之后仍能收到通知
+            LOG_WARN("Zerocopy sends on sockfd %d not completed in %d seconds, resetting", fd,
+                     (int)(ORPHAN_TIMEOUT / 1000));
+            struct sockaddr addr;
+            memset(&addr, 0, sizeof addr);
+            addr.sa_family = AF_UNSPEC;
+            connect(fd, &addr, sizeof addr);
+            orphan.reset = true;
+            orphan.deadline = now + RESET_TIMEOUT;
+            bool copied = false;
+            reap(fd, orphan.done, copied);
+            if (!release(orphan.holds, orphan.done)) {
+                ++it;
+                continue;
+            }
+        }
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        drop(fd, orphan.holds);
+        it = m_orphans.erase(it);
+    }
+}
+
+void ZeroCopy::arm_timer()
+{
+    bool want = !m_orphans.empty();
+    if (want == m_armed || m_timerfd < 0)
+        return;
+    struct itimerspec its;
+    memset(&its, 0, sizeof its);
+    if (want) {
+        its.it_value.tv_sec = 1;
+        its.it_interval.tv_sec = 1;
+    }
+    timerfd_settime(m_timerfd, 0, &its, nullptr);
+    m_armed = want;
+}
+
+size_t ZeroCopy::orphans()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_orphans.size();
+}
+
+size_t ZeroCopy::leaked()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_leaked;
+}
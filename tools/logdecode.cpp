@@ -0,0 +1,175 @@
+// 二进制日志解码工具：将Log::setBinary()写出的日志还原为文本
+// 用法：logdecode log_2022_5_6.bin [log_2022_5_6_2.bin ...]
+// 每个文件开头都带有之前用过的格式串定义，可以单独解码，也可以按顺序一起传入
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include "logformat.h"
+
+using namespace logbin;
+
+struct Arg {
+    uint8_t tag;
+    uint64_t raw;
+    std::string str;
+};
+
+static const char *const level_prefix[] = {"[Error] ", "[Warn] ", "[Debug] ", "[Info] "};
+
+// 按格式串渲染参数，每个转换说明重新交给snprintf处理，整数统一使用ll长度修饰
+static std::string render(const std::string &fmt, const std::vector<Arg> &args)
+{
+    std::string out;
+    size_t argi = 0;
+    char buf[512];
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%') {
+            out += fmt[i];
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%') {
+            out += '%';
+            ++i;
+            continue;
+        }
+        // 标志、宽度和精度原样保留，丢弃长度修饰
+        std::string spec = "%";
+        size_t j = i + 1;
+        while (j < fmt.size() && strchr("-+ #0123456789.", fmt[j]))
+            spec += fmt[j++];
+        while (j < fmt.size() && strchr("hlLqjzt", fmt[j]))
+            ++j;
+        if (j >= fmt.size()) {
+            out += fmt.substr(i);
+            break;
+        }
+        char conv = fmt[j];
+        i = j;
+        if (argi >= args.size()) {
+            out += "<missing>";
+            continue;
+        }
+        const Arg &a = args[argi++];
+        if (strchr("di", conv)) {
+            long long v = a.tag == ARG_DOUBLE ? (long long)*(const double *)&a.raw : (long long)a.raw;
+            snprintf(buf, sizeof buf, (spec + "ll" + conv).c_str(), v);
+        }
+        else if (strchr("uoxXc", conv)) {
+            unsigned long long v = (unsigned long long)a.raw;
+            if (conv == 'c')
+                snprintf(buf, sizeof buf, (spec + conv).c_str(), (int)v);
+            else
+                snprintf(buf, sizeof buf, (spec + "ll" + conv).c_str(), v);
+        }
+        else if (strchr("fFeEgGaA", conv)) {
+            double v;
+            if (a.tag == ARG_DOUBLE)
+                memcpy(&v, &a.raw, sizeof v);
+            else
+                v = (double)(long long)a.raw;
+            snprintf(buf, sizeof buf, (spec + conv).c_str(), v);
+        }
+        else if (conv == 's') {
+            snprintf(buf, sizeof buf, (spec + conv).c_str(),
+                     a.tag == ARG_STR ? a.str.c_str() : "<bad arg>");
+        }
+        else if (conv == 'p') {
+            snprintf(buf, sizeof buf, (spec + conv).c_str(), (void *)(uintptr_t)a.raw);
+        }
+        else {
+            snprintf(buf, sizeof buf, "<bad conv %c>", conv);
+        }
+        out += buf;
+    }
+    return out;
+}
+
+static bool decode(const char *path, std::unordered_map<uint64_t, std::string> &formats)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "Open %s failed\n", path);
+        return false;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    const std::string data = ss.str();
+    const char *p = data.data();
+    const char *end = p + data.size();
+
+    FileHeader fh;
+    if (data.size() < sizeof fh || memcmp(p, MAGIC, sizeof MAGIC) != 0) {
+        fprintf(stderr, "%s is not a binary log\n", path);
+        return false;
+    }
+    memcpy(&fh, p, sizeof fh);
+    p += sizeof fh;
+
+    while (p + sizeof(RecordHeader) <= end) {
+        RecordHeader hdr;
+        memcpy(&hdr, p, sizeof hdr);
+        if (hdr.len < sizeof hdr || p + hdr.len > end) {
+            fprintf(stderr, "%s: truncated record at offset %ld\n", path, (long)(p - data.data()));
+            return false;
+        }
+        const char *rec_end = p + hdr.len;
+        if (hdr.type == FORMAT && hdr.len >= sizeof(FormatRecord)) {
+            FormatRecord rec;
+            memcpy(&rec, p, sizeof rec);
+            formats[rec.id].assign(p + sizeof rec, rec_end);
+        }
+        else if (hdr.type == EVENT && hdr.len >= sizeof(EventRecord)) {
+            EventRecord rec;
+            memcpy(&rec, p, sizeof rec);
+            const char *q = p + sizeof rec;
+            std::vector<Arg> args;
+            for (int i = 0; i < hdr.nargs && q < rec_end; ++i) {
+                Arg a;
+                a.tag = *q++;
+                if (a.tag == ARG_STR) {
+                    uint32_t len;
+                    memcpy(&len, q, sizeof len);
+                    q += sizeof len;
+                    a.str.assign(q, len);
+                    q += len;
+                }
+                else {
+                    memcpy(&a.raw, q, sizeof a.raw);
+                    q += sizeof a.raw;
+                }
+                args.push_back(std::move(a));
+            }
+            // 单调时钟时间戳换算为墙上时间
+            uint64_t ns = fh.realtime_ns + (rec.ts - fh.monotonic_ns);
+            time_t sec = ns / 1000000000ull;
+            tm tmt;
+            localtime_r(&sec, &tmt);
+            auto it = formats.find(rec.id);
+            std::string msg = it == formats.end() ? "<unknown format>" : render(it->second, args);
+            printf("%s%d/%d/%d %02d:%02d:%02d.%06llu %s\n", level_prefix[hdr.level & 3],
+                   tmt.tm_year + 1900, tmt.tm_mon + 1, tmt.tm_mday, tmt.tm_hour, tmt.tm_min,
+                   tmt.tm_sec, (unsigned long long)(ns % 1000000000ull / 1000), msg.c_str());
+        }
+        p = rec_end;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s logfile.bin [more.bin ...]\n", argv[0]);
+        return 1;
+    }
+    std::unordered_map<uint64_t, std::string> formats;
+    for (int i = 1; i < argc; ++i) {
+        if (!decode(argv[i], formats))
+            return 1;
+    }
+    return 0;
+}
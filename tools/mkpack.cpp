@@ -0,0 +1,291 @@
+// 静态资源打包工具：将目录下的全部文件打包为一个带索引的资源包，由服务器通过MANGO_PACK加载
+// 用法：mkpack [--no-gzip] DIR OUT        打包DIR，写入OUT
+//       mkpack --list PACK                输出资源包中的文件
+// 索引按路径排序，记录每个文件的偏移、长度、ETag和MIME类型；以zlib构建时为可压缩的文本类文件附加gzip版本
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef MANGO_ZLIB
+#include <zlib.h>
+#endif
+#include "packformat.h"
+#include "handler.h"
+
+using namespace packbin;
+
+struct Item {
+    std::string path;
+    std::string data;
+    std::string gzip;
+    const char *mime;
+};
+
+static bool read_file(const std::string &filename, std::string &out)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+// 递归收集dir下的普通文件，rel为相对于打包根目录的前缀
+static bool walk(const std::string &dir, const std::string &rel, std::vector<Item> &items)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        fprintf(stderr, "cannot open directory %s: %s\n", dir.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    while (struct dirent *ent = readdir(d)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        std::string full = dir + "/" + ent->d_name;
+        std::string path = rel + ent->d_name;
+        struct stat st;
+        if (stat(full.c_str(), &st) < 0) {
+            fprintf(stderr, "cannot stat %s: %s\n", full.c_str(), strerror(errno));
+            ok = false;
+            break;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (!walk(full, path + "/", items)) {
+                ok = false;
+                break;
+            }
+        }
+        else if (S_ISREG(st.st_mode)) {
+            Item item;
+            item.path = path;
+            if (!read_file(full, item.data)) {
+                fprintf(stderr, "cannot read %s\n", full.c_str());
+                ok = false;
+                break;
+            }
+            item.mime = mime_type(path.c_str());
+            items.push_back(std::move(item));
+        }
+    }
+    closedir(d);
+    return ok;
+}
+
+static uint64_t fnv1a(const std::string &data)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#ifdef MANGO_ZLIB
+// 小于该长度的文件不压缩
+static const size_t GZIP_MIN = 256;
+
+static bool compressible(const char *mime)
+{
+    return strncmp(mime, "text/", 5) == 0 || strstr(mime, "javascript") || strstr(mime, "json") ||
+           strstr(mime, "xml") || strstr(mime, "svg");
+}
+
+// 以最高压缩级别生成gzip格式的数据，不写入文件名和时间，保证结果可重现
+static bool gzip(const std::string &in, std::string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof zs);
+    if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+// 字符串区，相同的字符串只保存一次
+struct Strings {
+    std::string data;
+    std::map<std::string, Str> seen;
+
+    Str add(const std::string &s) {
+        auto it = seen.find(s);
+        if (it != seen.end())
+            return it->second;
+        Str str = {(uint32_t)data.size(), (uint32_t)s.size()};
+        data += s;
+        data += '\0';
+        seen.emplace(s, str);
+        return str;
+    }
+};
+
+static int pack(const std::string &dir, const std::string &out, bool use_gzip)
+{
+    std::vector<Item> items;
+    if (!walk(dir, "", items))
+        return 1;
+    std::sort(items.begin(), items.end(),
+              [](const Item &a, const Item &b) { return a.path < b.path; });
+
+    std::vector<IndexEntry> index(items.size());
+    Strings strings;
+    size_t gzipped = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        Item &item = items[i];
+#ifdef MANGO_ZLIB
+        std::string gz;
+        // 压缩后至少减少10%才保留
+        if (use_gzip && item.data.size() >= GZIP_MIN && compressible(item.mime) &&
+            gzip(item.data, gz) && gz.size() < item.data.size() / 10 * 9) {
+            item.gzip.swap(gz);
+            ++gzipped;
+        }
+#else
+        (void)use_gzip;
+#endif
+        char etag[32];
+        snprintf(etag, sizeof etag, "\"%016llx\"", (unsigned long long)fnv1a(item.data));
+        std::string vary = item.gzip.empty() ? "" : "Vary: Accept-Encoding\r\n";
+        IndexEntry &e = index[i];
+        memset(&e, 0, sizeof e);
+        e.path = strings.add(item.path);
+        e.mime = strings.add(item.mime);
+        e.etag = strings.add(etag);
+        e.headers = strings.add(std::string("ETag: ") + etag + "\r\n" + vary);
+        if (!item.gzip.empty()) {
+            std::string gz_etag = std::string(etag, strlen(etag) - 1) + "-gz\"";
+            e.gzip_etag = strings.add(gz_etag);
+            e.gzip_headers = strings.add("ETag: " + gz_etag + "\r\n" + vary +
+                                         "Content-Encoding: gzip\r\n");
+        }
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.count = items.size();
+    header.strings_off = sizeof header + sizeof(IndexEntry) * index.size();
+    header.strings_len = strings.data.size();
+    // 数据区按8字节对齐
+    uint64_t off = (header.strings_off + header.strings_len + 7) & ~7ULL;
+    for (size_t i = 0; i < items.size(); ++i) {
+        index[i].data_off = off;
+        index[i].size = items[i].data.size();
+        off += (items[i].data.size() + 7) & ~7ULL;
+        if (!items[i].gzip.empty()) {
+            index[i].gzip_off = off;
+            index[i].gzip_size = items[i].gzip.size();
+            off += (items[i].gzip.size() + 7) & ~7ULL;
+        }
+    }
+    header.size = off;
+
+    // 先写入临时文件再改名，服务器不会读到写了一半的资源包
+    std::string tmp = out + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        fprintf(stderr, "cannot create %s: %s\n", tmp.c_str(), strerror(errno));
+        return 1;
+    }
+    static const char zeros[8] = {0};
+    uint64_t written = 0;
+    auto put = [&](const void *data, size_t len) {
+        fwrite(data, 1, len, fp);
+        written += len;
+    };
+    auto align = [&]() { put(zeros, (8 - written % 8) % 8); };
+    put(&header, sizeof header);
+    put(index.data(), sizeof(IndexEntry) * index.size());
+    put(strings.data.data(), strings.data.size());
+    for (Item &item : items) {
+        align();
+        put(item.data.data(), item.data.size());
+        if (!item.gzip.empty()) {
+            align();
+            put(item.gzip.data(), item.gzip.size());
+        }
+    }
+    align();
+    if (fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) != 0) {
+        fprintf(stderr, "write %s failed: %s\n", tmp.c_str(), strerror(errno));
+        fclose(fp);
+        unlink(tmp.c_str());
+        return 1;
+    }
+    fclose(fp);
+    if (rename(tmp.c_str(), out.c_str()) < 0) {
+        fprintf(stderr, "rename to %s failed: %s\n", out.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("%zu files, %zu gzipped, %llu bytes -> %s\n", items.size(), gzipped,
+           (unsigned long long)header.size, out.c_str());
+    return 0;
+}
+
+static int list(const std::string &filename)
+{
+    std::string data;
+    FileHeader header;
+    if (!read_file(filename, data) || data.size() < sizeof header) {
+        fprintf(stderr, "cannot read %s\n", filename.c_str());
+        return 1;
+    }
+    memcpy(&header, data.data(), sizeof header);
+    if (memcmp(header.magic, MAGIC, sizeof MAGIC) != 0 || header.size != data.size() ||
+        header.strings_off + header.strings_len > data.size()) {
+        fprintf(stderr, "%s is not a valid pack\n", filename.c_str());
+        return 1;
+    }
+    const char *strings = data.data() + header.strings_off;
+    for (uint32_t i = 0; i < header.count; ++i) {
+        IndexEntry e;
+        memcpy(&e, data.data() + sizeof header + sizeof e * i, sizeof e);
+        printf("%10llu %10llu  %-24s %s  %s\n", (unsigned long long)e.size,
+               (unsigned long long)e.gzip_size, strings + e.mime.off, strings + e.etag.off,
+               strings + e.path.off);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bool use_gzip = true;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "--list") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "usage: %s --list PACK\n", argv[0]);
+            return 2;
+        }
+        return list(argv[2]);
+    }
+    if (i < argc && strcmp(argv[i], "--no-gzip") == 0) {
+        use_gzip = false;
+        ++i;
+    }
+    if (argc - i != 2) {
+        fprintf(stderr, "usage: %s [--no-gzip] DIR OUT\n       %s --list PACK\n", argv[0], argv[0]);
+        return 2;
+    }
+    return pack(argv[i], argv[i + 1], use_gzip);
+}
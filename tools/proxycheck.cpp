@@ -0,0 +1,365 @@
+// 反向代理检查工具：在本进程内启动替身上游，通过路由表调用代理处理器，检查转发的请求和响应
+// 用法：proxycheck          全部检查通过时返回0，否则输出失败的检查并返回1
+// 覆盖请求头部的透传、较短和流式的消息体、空闲连接失效后的重试、连接失败的上游切换和转发名额上限
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <unistd.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "proxy.h"
+#include "httpconn.h"
+#include "log.h"
+
+static int g_failures = 0;
+
+#define CHECK(cond, what)                                                \
+    do {                                                                 \
+        if (!(cond)) {                                                   \
+            ++g_failures;                                                \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, what); \
+        }                                                                \
+    } while (0)
+
+// 替身上游：每个连接一个线程，逐个读取请求并按respond的返回值应答
+struct Backend {
+    struct Reply {
+        std::string data;
+        // 应答后直接关闭连接，不在头部中声明
+        bool close = false;
+    };
+    using Respond = std::function<Reply(const std::string &head, const std::string &body)>;
+
+    int listenfd = -1;
+    int port = 0;
+    Respond respond;
+    std::atomic<int> requests{0};
+    std::atomic<int> conns{0};
+    std::string last_head;
+    std::string last_body;
+
+    explicit Backend(Respond r) : respond(std::move(r)) {
+        listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        if (bind(listenfd, (struct sockaddr *)&addr, len) < 0 || listen(listenfd, 64) < 0 ||
+            getsockname(listenfd, (struct sockaddr *)&addr, &len) < 0) {
+            perror("backend");
+            exit(2);
+        }
+        port = ntohs(addr.sin_port);
+        std::thread([this]() { accept_loop(); }).detach();
+    }
+    std::string addr() const {
+        return "127.0.0.1:" + std::to_string(port);
+    }
+
+    void accept_loop() {
+        while (true) {
+            int fd = accept(listenfd, nullptr, nullptr);
+            if (fd < 0)
+                return;
+            conns.fetch_add(1);
+            std::thread([this, fd]() { serve(fd); }).detach();
+        }
+    }
+    void serve(int fd) {
+        std::string buf;
+        char tmp[65536];
+        while (true) {
+            size_t head_end;
+            while ((head_end = buf.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, tmp, sizeof tmp, 0);
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                buf.append(tmp, n);
+            }
+            std::string head = buf.substr(0, head_end + 4);
+            size_t length = 0;
+            const char *cl = strcasestr(head.c_str(), "\r\nContent-Length:");
+            if (cl)
+                length = strtoul(cl + 17, nullptr, 10);
+            while (buf.size() < head_end + 4 + length) {
+                ssize_t n = recv(fd, tmp, sizeof tmp, 0);
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                buf.append(tmp, n);
+            }
+            std::string body = buf.substr(head_end + 4, length);
+            buf.erase(0, head_end + 4 + length);
+            last_head = head;
+            last_body = body;
+            requests.fetch_add(1);
+            Reply reply = respond(head, body);
+            send(fd, reply.data.data(), reply.data.size(), MSG_NOSIGNAL);
+            if (reply.close) {
+                close(fd);
+                return;
+            }
+        }
+    }
+};
+
+static Backend::Reply ok(const std::string &body, const std::string &headers = "")
+{
+    Backend::Reply reply;
+    reply.data = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" +
+                 headers + "\r\n" + body;
+    return reply;
+}
+
+// 构造交给处理器的请求，头部字符串由storage持有
+struct TestRequest {
+    std::deque<std::string> storage;
+    Request req;
+
+    TestRequest(int method, const char *url) {
+        req.method = method;
+        req.url = keep(url);
+        req.remote = "10.0.0.7";
+    }
+    const char *keep(const std::string &s) {
+        storage.push_back(s);
+        return storage.back().c_str();
+    }
+    TestRequest &header(const std::string &name, const std::string &value) {
+        Headers::Header &h = req.headers.items[req.headers.count++];
+        h.name = keep(name);
+        h.name_len = name.size();
+        h.value = keep(value);
+        if (strcasecmp(name.c_str(), "Host") == 0)
+            req.host = h.value;
+        return *this;
+    }
+    TestRequest &body(const std::string &data) {
+        req.body = keep(data);
+        req.body_len = data.size();
+        return *this;
+    }
+};
+
+// 通过路由表调用处理器，流式响应读取到结束为止
+static std::string run(const char *url, TestRequest &t, Response &resp)
+{
+    const HandlerTable::Entry *entry = HandlerTable::getInstance().find(url);
+    if (!entry) {
+        CHECK(false, "route not found");
+        return std::string();
+    }
+    entry->handler(t.req, resp);
+    if (!resp.stream)
+        return resp.body ? std::string(resp.body, resp.body_len) : resp.owned;
+    std::string out, chunk;
+    while (true) {
+        chunk.clear();
+        bool more = resp.stream(chunk);
+        out += chunk;
+        if (!more || chunk.empty())
+            break;
+    }
+    return out;
+}
+
+static bool has_line(const std::string &head, const std::string &line)
+{
+    return head.find("\r\n" + line + "\r\n") != std::string::npos;
+}
+
+static bool has_header(const std::string &head, const char *name)
+{
+    return strcasestr(head.c_str(), ("\r\n" + std::string(name) + ":").c_str()) != nullptr;
+}
+
+static void check_headers(Backend &echo)
+{
+    TestRequest t(HTTPConn::POST, "/echo/submit?x=1");
+    t.header("Host", "example.test")
+        .header("Content-Type", "application/json")
+        .header("Authorization", "Bearer abc")
+        .header("Cookie", "sid=1")
+        .header("Accept", "*/*")
+        .header("User-Agent", "proxycheck")
+        .header("Connection", "keep-alive, X-Hop")
+        .header("X-Hop", "1")
+        .header("Keep-Alive", "timeout=5")
+        .header("TE", "trailers")
+        .header("Transfer-Encoding", "chunked")
+        .header("X-Forwarded-For", "192.0.2.1")
+        .body("{\"a\":1}");
+    Response resp;
+    std::string body = run("/echo/submit", t, resp);
+    const std::string &head = echo.last_head;
+    CHECK(resp.status == 200 && body == "echo", "POST forwarded");
+    CHECK(head.rfind("POST /echo/submit?x=1 HTTP/1.1\r\n", 0) == 0, "request line");
+    CHECK(has_line(head, "Host: example.test"), "Host passed through");
+    CHECK(has_line(head, "Content-Type: application/json"), "Content-Type passed through");
+    CHECK(has_line(head, "Authorization: Bearer abc"), "Authorization passed through");
+    CHECK(has_line(head, "Cookie: sid=1"), "Cookie passed through");
+    CHECK(has_line(head, "Accept: */*"), "Accept passed through");
+    CHECK(has_line(head, "User-Agent: proxycheck"), "User-Agent passed through");
+    CHECK(has_line(head, "X-Forwarded-For: 192.0.2.1, 10.0.0.7"), "X-Forwarded-For appended");
+    CHECK(has_line(head, "Content-Length: 7"), "Content-Length of the decoded body");
+    CHECK(has_line(head, "Connection: keep-alive"), "upstream connection kept alive");
+    CHECK(!has_header(head, "X-Hop"), "header listed in Connection dropped");
+    CHECK(!has_header(head, "Keep-Alive"), "Keep-Alive dropped");
+    CHECK(!has_header(head, "TE"), "TE dropped");
+    CHECK(!has_header(head, "Transfer-Encoding"), "Transfer-Encoding dropped");
+    CHECK(echo.last_body == "{\"a\":1}", "request body forwarded");
+
+    TestRequest empty(HTTPConn::POST, "/echo/empty");
+    Response resp2;
+    run("/echo/empty", empty, resp2);
+    CHECK(has_line(echo.last_head, "Content-Length: 0"), "empty POST carries Content-Length: 0");
+}
+
+static void check_bodies()
+{
+    std::string big(100 * 1024, 'x');
+    for (size_t i = 0; i < big.size(); ++i)
+        big[i] = 'a' + i % 26;
+    Backend backend([&big](const std::string &head, const std::string &) {
+        if (head.find(" /body/small ") != std::string::npos)
+            return ok("small", "Content-Type: text/plain\r\nX-Internal: 1\r\n");
+        if (head.find(" /body/large ") != std::string::npos)
+            return ok(big);
+        // chunked编码，分为多个块
+        Backend::Reply reply;
+        reply.data = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+        for (size_t off = 0; off < big.size(); off += 30000) {
+            size_t n = std::min<size_t>(30000, big.size() - off);
+            char line[32];
+            snprintf(line, sizeof line, "%zx\r\n", n);
+            reply.data += line + big.substr(off, n) + "\r\n";
+        }
+        reply.data += "0\r\n\r\n";
+        return reply;
+    });
+    Proxy::getInstance().configure("/body=" + backend.addr());
+
+    TestRequest small(HTTPConn::GET, "/body/small");
+    Response r1;
+    CHECK(run("/body/small", small, r1) == "small" && !r1.stream, "small body answered inline");
+    CHECK(r1.headers.find("Content-Type: text/plain\r\n") != std::string::npos,
+          "Content-Type returned to the client");
+    CHECK(r1.headers.find("X-Internal") == std::string::npos, "unlisted header not returned");
+
+    TestRequest large(HTTPConn::GET, "/body/large");
+    Response r2;
+    CHECK(run("/body/large", large, r2) == big && !r2.abort, "large body streamed");
+
+    TestRequest chunked(HTTPConn::GET, "/body/chunked");
+    Response r3;
+    CHECK(run("/body/chunked", chunked, r3) == big && !r3.abort, "chunked body streamed");
+    CHECK(backend.conns.load() == 1, "upstream connection reused across requests");
+}
+
+static void check_retry()
+{
+    // 应答后关闭连接但不声明，代理会把已失效的连接放回连接池
+    Backend backend([](const std::string &, const std::string &) {
+        Backend::Reply reply = ok("fine");
+        reply.close = true;
+        return reply;
+    });
+    Proxy::getInstance().configure("/stale=" + backend.addr());
+
+    TestRequest first(HTTPConn::GET, "/stale/a");
+    Response r1;
+    CHECK(run("/stale/a", first, r1) == "fine", "first request");
+    usleep(50 * 1000);
+    TestRequest second(HTTPConn::GET, "/stale/b");
+    Response r2;
+    CHECK(run("/stale/b", second, r2) == "fine" && r2.status == 200,
+          "GET on a closed pooled connection retried");
+    CHECK(backend.requests.load() == 2, "GET retried on a new connection");
+
+    usleep(50 * 1000);
+    TestRequest post(HTTPConn::POST, "/stale/c");
+    post.body("once");
+    Response r3;
+    run("/stale/c", post, r3);
+    CHECK(r3.status == 502, "POST on a closed pooled connection not retried");
+    CHECK(backend.requests.load() == 2, "POST not sent twice");
+}
+
+static void check_failover()
+{
+    // 监听后关闭，连接被拒绝
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof addr;
+    bind(fd, (struct sockaddr *)&addr, len);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+    std::string dead = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+
+    Backend backend([](const std::string &, const std::string &) { return ok("alive"); });
+    Proxy::getInstance().configure("/fail=" + dead + "," + backend.addr());
+    for (int i = 0; i < 6; ++i) {
+        TestRequest t(HTTPConn::GET, "/fail/x");
+        Response resp;
+        CHECK(run("/fail/x", t, resp) == "alive", "refused upstream skipped");
+    }
+    std::string status = Proxy::getInstance().status();
+    size_t pos = status.find(dead + " ");
+    std::string line = pos == std::string::npos ? "" : status.substr(pos, status.find('\n', pos) - pos);
+    CHECK(!line.empty() && line.find("down=0s") == std::string::npos, "refused upstream marked down");
+}
+
+static void check_limit()
+{
+    Backend backend([](const std::string &, const std::string &) { return ok("ok"); });
+    Proxy &proxy = Proxy::getInstance();
+    proxy.configure("/limit=" + backend.addr());
+    unsigned limit = proxy.limit();
+    proxy.setLimit(1);
+    std::shared_ptr<Proxy::Slot> busy = proxy.admit();
+    TestRequest t(HTTPConn::GET, "/limit/x");
+    Response r1;
+    run("/limit/x", t, r1);
+    CHECK(r1.status == 503 && backend.requests.load() == 0, "request over the limit rejected");
+    busy.reset();
+    Response r2;
+    CHECK(run("/limit/x", t, r2) == "ok", "slot returned after the request");
+    proxy.setLimit(limit);
+}
+
+int main()
+{
+    Log::getInstance().setPrint();
+    Log::setLevel(Log::ERROR);
+    Backend echo([](const std::string &, const std::string &) { return ok("echo"); });
+    if (!Proxy::getInstance().configure("/echo=" + echo.addr())) {
+        fprintf(stderr, "configure failed\n");
+        return 2;
+    }
+    check_headers(echo);
+    check_bodies();
+    check_retry();
+    check_failover();
+    check_limit();
+    if (g_failures) {
+        fprintf(stderr, "%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all proxy checks passed\n");
+    return 0;
+}
@@ -0,0 +1,463 @@
+// 流量回放工具：按捕获时的连接和相对时间重新发出MANGO_CAPTURE记录的请求字节
+// 用法：replay [-h HOST] [-p PORT] [--speed X] capture.bin
+//       replay --info capture.bin               输出捕获的概况
+//       replay --extract DIR capture.bin        按请求拆分写入DIR，可作为microbench --corpus的输入
+// 每个连接内的字节顺序与捕获时一致，不同连接之间按时间戳交错；--speed 2表示以两倍速回放，0表示不等待
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "capformat.h"
+
+using namespace capbin;
+
+struct Event {
+    uint8_t type;
+    uint32_t conn;
+    uint64_t ts;
+    // 在文件内容中的偏移和长度
+    size_t off;
+    uint32_t len;
+};
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 读取捕获文件并按时间排序，同一连接的记录时间戳单调，稳定排序保持其原有顺序
+static bool load(const char *path, std::string &content, std::vector<Event> &events)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "Open %s failed\n", path);
+        return false;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    content = ss.str();
+    if (content.size() < sizeof(FileHeader) || memcmp(content.data(), MAGIC, sizeof MAGIC) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        return false;
+    }
+    size_t off = sizeof(FileHeader);
+    while (off + sizeof(RecordHeader) <= content.size()) {
+        RecordHeader hdr;
+        memcpy(&hdr, content.data() + off, sizeof hdr);
+        off += sizeof hdr;
+        if (off + hdr.len > content.size())
+            break;
+        events.push_back({hdr.type, hdr.conn, hdr.ts, off, hdr.len});
+        off += hdr.len;
+    }
+    if (off != content.size())
+        fprintf(stderr, "Warning: %zu trailing bytes ignored\n", content.size() - off);
+    std::stable_sort(events.begin(), events.end(),
+                     [](const Event &a, const Event &b) { return a.ts < b.ts; });
+    return true;
+}
+
+// 从连接的字节流开头切出一个完整请求或响应的长度，不完整时返回0，只支持Content-Length
+static size_t message_length(const std::string &stream)
+{
+    size_t hdr_end = stream.find("\r\n\r\n");
+    if (hdr_end == std::string::npos)
+        return 0;
+    long length = 0;
+    for (size_t p = 0; p < hdr_end;) {
+        size_t eol = stream.find("\r\n", p);
+        if (strncasecmp(stream.c_str() + p, "Content-Length:", 15) == 0)
+            length = atol(stream.c_str() + p + 15);
+        p = eol + 2;
+    }
+    size_t total = hdr_end + 4 + length;
+    return stream.size() >= total ? total : 0;
+}
+
+static int info(const std::string &content, const std::vector<Event> &events)
+{
+    uint64_t conns = 0, closes = 0, bytes = 0, requests = 0, chunks = 0;
+    size_t active = 0, peak = 0;
+    std::unordered_map<uint32_t, std::string> streams;
+    for (const auto &e : events) {
+        if (e.type == OPEN) {
+            ++conns;
+            peak = std::max(peak, ++active);
+        }
+        else if (e.type == CLOSE) {
+            ++closes;
+            active -= active > 0;
+            streams.erase(e.conn);
+        }
+        else if (e.type == DATA) {
+            ++chunks;
+            bytes += e.len;
+            std::string &s = streams[e.conn];
+            s.append(content, e.off, e.len);
+            while (size_t n = message_length(s)) {
+                ++requests;
+                s.erase(0, n);
+            }
+        }
+    }
+    double secs = events.empty() ? 0 : events.back().ts / 1e9;
+    printf("duration    %.3fs\n", secs);
+    printf("connections %llu opened, %llu closed, %zu peak concurrent\n",
+           (unsigned long long)conns, (unsigned long long)closes, peak);
+    printf("requests    %llu (%.1f req/s)\n", (unsigned long long)requests,
+           secs > 0 ? requests / secs : 0.0);
+    printf("bytes       %llu in %llu reads\n", (unsigned long long)bytes,
+           (unsigned long long)chunks);
+    return 0;
+}
+
+static int extract(const std::string &content, const std::vector<Event> &events,
+                   const std::string &dir)
+{
+    mkdir(dir.c_str(), 0755);
+    std::unordered_map<uint32_t, std::string> streams;
+    std::unordered_map<uint32_t, unsigned> counts;
+    unsigned long written = 0;
+    for (const auto &e : events) {
+        if (e.type != DATA)
+            continue;
+        std::string &s = streams[e.conn];
+        s.append(content, e.off, e.len);
+        while (size_t n = message_length(s)) {
+            char name[64];
+            snprintf(name, sizeof name, "/%u_%u.req", e.conn, counts[e.conn]++);
+            std::ofstream out(dir + name, std::ios::binary);
+            out.write(s.data(), n);
+            if (!out) {
+                fprintf(stderr, "Write %s%s failed\n", dir.c_str(), name);
+                return 1;
+            }
+            ++written;
+            s.erase(0, n);
+        }
+    }
+    printf("%lu requests written to %s\n", written, dir.c_str());
+    return 0;
+}
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    // 捕获中该连接已被服务器关闭，发完剩余数据并收到全部响应后关闭写端，读到EOF后关闭
+    // 服务器在读到EOF时会直接关闭连接而不应答，过早关闭写端会丢失响应
+    bool closing = false;
+    bool shut = false;
+    std::string out;
+    size_t out_off = 0;
+    // 已发出请求中尚未收到响应的个数，以及用于切分请求和响应的未完整部分
+    unsigned pending = 0;
+    std::string req;
+    std::string resp;
+};
+
+class Replayer {
+public:
+    Replayer(const sockaddr_in &addr, double speed): m_addr(addr), m_speed(speed) {}
+    int run(const std::string &content, const std::vector<Event> &events);
+
+private:
+    void open_conn(uint32_t id);
+    void close_conn(uint32_t id, bool failed);
+    void flush(uint32_t id);
+    void on_event(uint32_t id, uint32_t ev);
+    void shutdown_idle();
+
+    sockaddr_in m_addr;
+    double m_speed;
+    int m_epfd = -1;
+    std::unordered_map<uint32_t, Conn> m_conns;
+    std::vector<uint32_t> m_closing;
+    uint64_t m_opened = 0, m_failed = 0, m_sent = 0, m_received = 0, m_requests = 0,
+             m_responses = 0;
+    // 连接已被服务器关闭而未能发出的字节
+    uint64_t m_skipped = 0;
+    // 实际发出时间相对于计划时间的滞后，反映回放端或服务器是否跟得上
+    uint64_t m_lag_sum = 0, m_lag_max = 0, m_lag_count = 0;
+};
+
+void Replayer::open_conn(uint32_t id)
+{
+    Conn &c = m_conns[id];
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    int ret = connect(c.fd, (sockaddr *)&m_addr, sizeof m_addr);
+    if (c.fd < 0 || (ret < 0 && errno != EINPROGRESS)) {
+        ++m_failed;
+        close_conn(id, false);
+        return;
+    }
+    ++m_opened;
+    c.connecting = ret < 0;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u32 = id;
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+void Replayer::close_conn(uint32_t id, bool failed)
+{
+    auto it = m_conns.find(id);
+    if (it == m_conns.end())
+        return;
+    if (it->second.fd != -1)
+        close(it->second.fd);
+    if (failed)
+        ++m_failed;
+    m_conns.erase(it);
+}
+
+void Replayer::flush(uint32_t id)
+{
+    Conn &c = m_conns[id];
+    if (c.fd == -1 || c.connecting)
+        return;
+    while (c.out_off < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN)
+                close_conn(id, true);
+            return;
+        }
+        c.out_off += n;
+        m_sent += n;
+    }
+    c.out.clear();
+    c.out_off = 0;
+}
+
+// 服务器在捕获中主动关闭的连接通常会自行关闭，这里处理捕获中由客户端先关闭的连接
+void Replayer::shutdown_idle()
+{
+    for (size_t i = 0; i < m_closing.size();) {
+        auto it = m_conns.find(m_closing[i]);
+        if (it == m_conns.end() || it->second.shut) {
+            m_closing[i] = m_closing.back();
+            m_closing.pop_back();
+            continue;
+        }
+        Conn &c = it->second;
+        if (!c.connecting && c.out.empty() && c.pending == 0) {
+            shutdown(c.fd, SHUT_WR);
+            c.shut = true;
+        }
+        ++i;
+    }
+}
+
+void Replayer::on_event(uint32_t id, uint32_t ev)
+{
+    auto it = m_conns.find(id);
+    if (it == m_conns.end())
+        return;
+    Conn &c = it->second;
+    if (c.connecting) {
+        int err = 0;
+        socklen_t len = sizeof err;
+        getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            close_conn(id, true);
+            return;
+        }
+        c.connecting = false;
+    }
+    // 响应只计数后丢弃
+    if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        char buf[65536];
+        while (true) {
+            ssize_t n = recv(c.fd, buf, sizeof buf, 0);
+            if (n > 0) {
+                m_received += n;
+                c.resp.append(buf, n);
+                while (size_t len = message_length(c.resp)) {
+                    c.pending -= c.pending > 0;
+                    ++m_responses;
+                    c.resp.erase(0, len);
+                }
+                continue;
+            }
+            if (n == 0 || errno != EAGAIN) {
+                close_conn(id, false);
+                return;
+            }
+            break;
+        }
+    }
+    if (ev & EPOLLOUT)
+        flush(id);
+}
+
+int Replayer::run(const std::string &content, const std::vector<Event> &events)
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    // 每轮处理的事件数较少，到期的记录能及时发出
+    std::vector<epoll_event> evs(128);
+    uint64_t start = now_ns();
+    size_t next = 0;
+    while (next < events.size() || !m_conns.empty()) {
+        uint64_t now = now_ns();
+        // 发出所有已到计划时间的记录
+        while (next < events.size()) {
+            const Event &e = events[next];
+            uint64_t due = start + (m_speed > 0 ? (uint64_t)(e.ts / m_speed) : 0);
+            if (due > now)
+                break;
+            ++next;
+            if (e.type == OPEN) {
+                open_conn(e.conn);
+                continue;
+            }
+            auto it = m_conns.find(e.conn);
+            if (it == m_conns.end()) {
+                if (e.type == DATA)
+                    m_skipped += e.len;
+                continue;
+            }
+            if (e.type == CLOSE) {
+                it->second.closing = true;
+                m_closing.push_back(e.conn);
+            }
+            else if (e.type == DATA) {
+                Conn &c = it->second;
+                c.out.append(content, e.off, e.len);
+                c.req.append(content, e.off, e.len);
+                while (size_t len = message_length(c.req)) {
+                    ++c.pending;
+                    ++m_requests;
+                    c.req.erase(0, len);
+                }
+                uint64_t lag = now - due;
+                m_lag_sum += lag;
+                m_lag_max = std::max(m_lag_max, lag);
+                ++m_lag_count;
+            }
+            flush(e.conn);
+        }
+        int timeout = 100;
+        if (next < events.size()) {
+            uint64_t due = start + (m_speed > 0 ? (uint64_t)(events[next].ts / m_speed) : 0);
+            timeout = due > now ? (int)std::min<uint64_t>((due - now) / 1000000, 100) : 0;
+        }
+        else if (now > start + (m_speed > 0 ? (uint64_t)(events.back().ts / m_speed) : 0) +
+                 5000000000ull) {
+            // 服务器未关闭的连接在最后一条记录5秒后关闭，足够覆盖监听队列溢出时的SYN重传
+            break;
+        }
+        shutdown_idle();
+        int n = epoll_wait(m_epfd, evs.data(), evs.size(), std::min(timeout, 10));
+        for (int i = 0; i < n; ++i)
+            on_event(evs[i].data.u32, evs[i].events);
+    }
+    double secs = (now_ns() - start) / 1e9;
+    uint64_t connecting = 0;
+    for (auto &kv : m_conns) {
+        connecting += kv.second.connecting;
+        close(kv.second.fd);
+    }
+    close(m_epfd);
+    printf("replayed %zu records in %.3fs\n", events.size(), secs);
+    printf("connections %llu opened, %llu failed, %zu left open, %llu never connected\n",
+           (unsigned long long)m_opened, (unsigned long long)m_failed, m_conns.size(),
+           (unsigned long long)connecting);
+    printf("bytes       %llu sent, %llu received, %llu skipped on closed connections\n",
+           (unsigned long long)m_sent, (unsigned long long)m_received,
+           (unsigned long long)m_skipped);
+    printf("requests    %llu sent, %llu responses\n", (unsigned long long)m_requests,
+           (unsigned long long)m_responses);
+    printf("send lag    mean %.1fus  max %.1fus\n",
+           m_lag_count ? m_lag_sum / 1e3 / m_lag_count : 0.0, m_lag_max / 1e3);
+    return m_failed ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture.bin\n"
+            "  -h HOST        server address (127.0.0.1)\n"
+            "  -p PORT        server port (5005)\n"
+            "  --speed X      replay speed relative to the capture, 0 for no delays (1)\n"
+            "  --info         print a summary of the capture instead of replaying it\n"
+            "  --extract DIR  write each captured request to DIR, for microbench --corpus\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string host = "127.0.0.1", extract_dir;
+    int port = 5005;
+    double speed = 1;
+    bool show_info = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--info") {
+            show_info = true;
+            continue;
+        }
+        if (arg[0] != '-') {
+            path = argv[i];
+            continue;
+        }
+        if (!val) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (arg == "-h") host = val;
+        else if (arg == "-p") port = atoi(val);
+        else if (arg == "--speed") speed = atof(val);
+        else if (arg == "--extract") extract_dir = val;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if (!path || speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string content;
+    std::vector<Event> events;
+    if (!load(path, content, events))
+        return 1;
+    if (show_info)
+        return info(content, events);
+    if (!extract_dir.empty())
+        return extract(content, events, extract_dir);
+    if (events.empty())
+        return 0;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad address %s\n", host.c_str());
+        return 1;
+    }
+    return Replayer(addr, speed).run(content, events);
+}